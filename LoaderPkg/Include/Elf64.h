@@ -59,6 +59,17 @@ struct Elf64_Sym {
   UINT64            st_size;
 };
 
+struct Elf64_Dyn {
+  INT64             d_tag;
+  UINT64            d_val;
+};
+
+struct Elf64_Rela {
+  UINT64            r_offset;
+  UINT64            r_info;
+  INT64             r_addend;
+};
+
 /* Values for e_type. */
 #define ET_NONE    0  /* Unknown type. */
 #define ET_REL    1  /* Relocatable. */
@@ -160,5 +171,31 @@ struct Elf64_Sym {
 
 /* Values for Secthdr::sh_name */
 #define ELF_SHN_UNDEF           0
+#define ELF_SHN_ABS             0xfff1
+
+/* Values for Elf64_Dyn::d_tag */
+#define DT_NULL                 0       /* Marks end of dynamic section */
+#define DT_PLTRELSZ             2       /* Size in bytes of PLT relocs */
+#define DT_SYMTAB               6       /* Address of symbol table */
+#define DT_RELA                 7       /* Address of Rela relocs */
+#define DT_RELASZ               8       /* Total size of Rela relocs */
+#define DT_RELAENT              9       /* Size of one Rela reloc */
+#define DT_SYMENT               11      /* Size of one symbol table entry */
+#define DT_PLTREL               20      /* Type of reloc in PLT */
+#define DT_TEXTREL              22      /* Reloc might modify .text */
+#define DT_JMPREL               23      /* Address of PLT relocs */
+
+/*
+ * Macros for manipulating Elf64_Rela::r_info
+ */
+#define ELF64_R_SYM(i)          ((i) >> 32)
+#define ELF64_R_TYPE(i)         ((i) & 0xffffffffL)
+
+/* x86-64 relocation types */
+#define R_X86_64_NONE           0       /* No reloc */
+#define R_X86_64_64             1       /* Direct 64 bit  */
+#define R_X86_64_GLOB_DAT       6       /* Create GOT entry */
+#define R_X86_64_JUMP_SLOT      7       /* Create PLT entry */
+#define R_X86_64_RELATIVE       8       /* Adjust by program base */
 
 #endif /* JOS_UEFI_ELF_H */
@@ -62,6 +62,12 @@ typedef struct {
   EFI_PHYSICAL_ADDRESS     StringTableStart;
   EFI_PHYSICAL_ADDRESS     StringTableEnd;
 
+  ///
+  /// Pre-digested symbolization database, see inc/symdb.h
+  ///
+  EFI_PHYSICAL_ADDRESS     SymdbStart;
+  EFI_PHYSICAL_ADDRESS     SymdbEnd;
+
 } LOADER_PARAMS;
 
 #endif // LOADER_PARAMS_H
@@ -610,6 +610,7 @@ LoadKernel(
             {".debug_pubtypes", OFFSET_OF(LOADER_PARAMS, DebugPubtypesStart), OFFSET_OF(LOADER_PARAMS, DebugPubtypesEnd)},
             {".symtab", OFFSET_OF(LOADER_PARAMS, SymbolTableStart), OFFSET_OF(LOADER_PARAMS, SymbolTableEnd)},
             {".strtab", OFFSET_OF(LOADER_PARAMS, StringTableStart), OFFSET_OF(LOADER_PARAMS, StringTableEnd)},
+            {".symdb", OFFSET_OF(LOADER_PARAMS, SymdbStart), OFFSET_OF(LOADER_PARAMS, SymdbEnd)},
     };
 
     Status = EFI_SUCCESS;
@@ -915,6 +916,10 @@ VOID
     ASSERT_EFI_ERROR(Status);
     Status = gRT->ConvertPointer(EFI_OPTIONAL_PTR, (VOID **)&LoaderParams->StringTableEnd);
     ASSERT_EFI_ERROR(Status);
+    Status = gRT->ConvertPointer(EFI_OPTIONAL_PTR, (VOID **)&LoaderParams->SymdbStart);
+    ASSERT_EFI_ERROR(Status);
+    Status = gRT->ConvertPointer(EFI_OPTIONAL_PTR, (VOID **)&LoaderParams->SymdbEnd);
+    ASSERT_EFI_ERROR(Status);
 #endif
 }
 
@@ -92,6 +92,9 @@
 
 #define DW_TAG_hi_user 0xffff
 
+#define DW_CHILDREN_no  0x00
+#define DW_CHILDREN_yes 0x01
+
 /*  The following two are non-standard. Use DW_CHILDREN_yes
     and DW_CHILDREN_no instead.  These could
     probably be deleted, but someone might be using them,
@@ -417,9 +420,10 @@ dwarf_entry_len(const uint8_t *addr, uint64_t *len) {
 }
 
 /* Decode an unsigned LEB128 encoded datum. The algorithm is taken from Appendix C
- * of the DWARF 4 spec. Return the number of bytes read */
+ * of the DWARF 4 spec. Return the number of bytes read.
+ * Byte at a time, never touches memory past the terminating byte */
 static inline uint64_t
-dwarf_read_uleb128(const uint8_t *addr, uint64_t *ret) {
+dwarf_read_uleb128_slow(const uint8_t *addr, uint64_t *ret) {
     uint64_t result = 0;
     size_t shift = 0, count = 0;
     uint8_t byte;
@@ -443,7 +447,7 @@ dwarf_read_uleb128(const uint8_t *addr, uint64_t *ret) {
 /* Decode signed LEB128 data. The Algorithm is taken from Appendix C
  * of the DWARF 4 spec. Return the number of bytes read */
 static inline uint64_t
-dwarf_read_leb128(const char *addr, int64_t *ret) {
+dwarf_read_leb128_slow(const char *addr, int64_t *ret) {
     size_t shift = 0, count = 0;
     uint64_t result = 0;
     uint8_t byte;
@@ -462,9 +466,86 @@ dwarf_read_leb128(const char *addr, int64_t *ret) {
 
     /* The number of bits in a signed integer. */
     if (shift < 8 * sizeof(result) && byte & 0x40)
-        result |= (-1U << shift);
+        result |= (~0ULL << shift);
 
     *ret = result;
     return count;
 }
+
+/* Word at a time LEB128 decoding.
+ *
+ * Up to 8 encoded bytes are loaded at once, the terminating byte is the
+ * lowest one with its continuation bit clear, and the 7-bit groups below
+ * it are packed together with three mask-and-shift steps (or a single
+ * pext when the compiler is allowed BMI2).
+ *
+ * A word load may read bytes past the end of the datum and thus past the
+ * end of a section, so it is only done when all 8 bytes are on the same
+ * page as the first one. Otherwise, and for data longer than 8 bytes
+ * (more than 56 bits of value), the byte loop above is used */
+
+#define DWARF_LEB_PAGE 4096
+#define DWARF_LEB_MSB  0x8080808080808080ULL
+
+/* Returns the number of bytes (1-8) in the datum at the
+ * start of 'addr', 0 when the slow path has to be taken */
+static inline size_t
+dwarf_leb128_word(const uint8_t *addr, uint64_t *word) {
+    if (((uintptr_t)addr & (DWARF_LEB_PAGE - 1)) > DWARF_LEB_PAGE - sizeof(uint64_t)) return 0;
+
+    uint64_t w = get_unaligned(addr, uint64_t);
+    uint64_t stop = ~w & DWARF_LEB_MSB;
+    if (!stop) return 0;
+
+    size_t len = __builtin_ctzll(stop) / 8 + 1;
+    if (len < sizeof(uint64_t)) w &= (1ULL << (len * 8)) - 1;
+
+#ifdef __BMI2__
+    *word = __builtin_ia32_pext_di(w, 0x7F7F7F7F7F7F7F7FULL);
+#else
+    w &= 0x7F7F7F7F7F7F7F7FULL;
+    w = ((w & 0x7F007F007F007F00ULL) >> 1) | (w & 0x007F007F007F007FULL);
+    w = ((w & 0x3FFF00003FFF0000ULL) >> 2) | (w & 0x00003FFF00003FFFULL);
+    w = ((w & 0x0FFFFFFF00000000ULL) >> 4) | (w & 0x000000000FFFFFFFULL);
+    *word = w;
+#endif
+    return len;
+}
+
+/* Decode an unsigned LEB128 encoded datum. Return the number of bytes read */
+static inline uint64_t
+dwarf_read_uleb128(const uint8_t *addr, uint64_t *ret) {
+    /* Single byte values (tags, attribute forms, small
+     * abbreviation codes) are by far the most common */
+    if (!(*addr & 0x80)) {
+        *ret = *addr;
+        return 1;
+    }
+
+    size_t len = dwarf_leb128_word(addr, ret);
+    return len ? len : dwarf_read_uleb128_slow(addr, ret);
+}
+
+/* Decode signed LEB128 data. Return the number of bytes read */
+static inline uint64_t
+dwarf_read_leb128(const char *addr, int64_t *ret) {
+    const uint8_t *ptr = (const uint8_t *)addr;
+
+    if (!(*ptr & 0x80)) {
+        /* Sign-extend from bit 6 */
+        *ret = (int64_t)((uint64_t)*ptr << 57) >> 57;
+        return 1;
+    }
+
+    uint64_t result;
+    size_t len = dwarf_leb128_word(ptr, &result);
+    if (!len) return dwarf_read_leb128_slow(addr, ret);
+
+    /* At most 56 bits were decoded, so the shift never overflows */
+    size_t bits = len * 7;
+    if (result & (1ULL << (bits - 1))) result |= ~0ULL << bits;
+
+    *ret = (int64_t)result;
+    return len;
+}
 #endif
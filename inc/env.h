@@ -54,8 +54,23 @@ struct Env {
     enum EnvType env_type;   /* Indicates special system environments */
     unsigned env_status;     /* Status of the environment */
     uint32_t env_runs;       /* Number of times environment has run */
+    int env_node;            /* NUMA node the environment's memory is placed on */
 
     uint8_t *binary; /* Pointer to process ELF image in kernel memory */
+    uint8_t *image;  /* Relocated copy of a position independent binary */
+    uint8_t *stack;  /* Stack of a kernel space program */
+};
+
+/* Compact per-env record, mirrored read-only at UENVSTATS.
+ * es_seq is odd while the kernel is updating the record, so readers
+ * retry if it was odd or has changed while they were copying it */
+struct EnvStat {
+    uint32_t es_seq;
+    envid_t es_id;
+    uint32_t es_status;
+    uint32_t es_runs;
+    uint64_t es_cputime; /* TSC ticks spent running */
+    uint64_t es_started; /* TSC when the env was last run, 0 if not running */
 };
 
 #endif /* !JOS_INC_ENV_H */
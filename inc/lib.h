@@ -16,6 +16,7 @@
 #include <inc/env.h>
 #include <inc/memlayout.h>
 #include <inc/trap.h>
+#include <inc/vsyscall.h>
 
 #ifdef SANITIZE_USER_SHADOW_BASE
 /* asan unpoison routine used for whitelisting regions. */
@@ -34,11 +35,32 @@ void umain(int argc, char **argv);
 /* libmain.c or entry.S */
 extern const char *binaryname;
 extern const volatile struct Env *thisenv;
+#ifdef JOS_PROG
+/* Programs are position independent and can't refer to absolute
+ * symbols from entry.S, the kernel pages are used at their fixed addresses */
+#define envs     ((const volatile struct Env *)UENVS)
+#define envstats ((const volatile struct EnvStat *)UENVSTATS)
+#define vsys     ((const volatile uint64_t *)UVSYS)
+#else
 extern const volatile struct Env envs[NENV];
+extern const volatile struct EnvStat envstats[NENV];
+extern const volatile uint64_t vsys[NVSYSCALLS];
+#endif
+
+/* envstat.c */
+void envstat_read(size_t envx, struct EnvStat *stat);
+
+/* vsyscall.c */
+envid_t vsys_getenvid(void);
+uint64_t vsys_clock_ns(void);
+int vsys_gettime(void);
 
 #ifdef JOS_PROG
 extern void (*volatile sys_exit)(void);
 extern void (*volatile sys_yield)(void);
+extern void (*volatile sys_sleep)(uint64_t ns);
+extern void *(*volatile sys_fmap)(const char *path, size_t *size);
+extern int (*volatile sys_funmap)(void *va);
 #endif
 
 #ifndef debug
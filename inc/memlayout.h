@@ -141,9 +141,11 @@
 #define UVPDP      (UVPD + (UVPT_INDEX << PD_SHIFT))
 #define UVPML4     (UVPDP + (UVPT_INDEX << PT_SHIFT))
 
-/* Read-only copies of the global env structures */
+/* Read-only copies of the global env structures,
+ * envs[] in the first half and per-env EnvStat records in the second */
 #define UENVS_SIZE HUGE_PAGE_SIZE
 #define UENVS      (MAX_USER_READABLE - UENVS_SIZE)
+#define UENVSTATS  (UENVS + UENVS_SIZE / 2)
 
 /* Virtual syscall page */
 #define UVSYS_SIZE PAGE_SIZE
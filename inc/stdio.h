@@ -1,6 +1,7 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 #include <stddef.h>
 
@@ -10,18 +11,60 @@
 
 /* lib/stdio.c */
 void cputchar(int c);
+void cputs(const char *str, size_t len);
 int getchar(void);
+int getchar_nowait(void);
 int iscons(int fd);
 
+/* Format string parsed ahead of time by fmt_compile(): a run of literal
+ * text followed by a conversion per spec, the last spec has conv 0 */
+#define FMT_DESC_MAX_SPECS 12
+
+struct FmtSpec {
+    uint16_t text;    /* Offset of the literal text in the format */
+    uint16_t textlen;
+    int16_t width;    /* -1 if not given */
+    int16_t precision;
+    char conv;        /* Conversion character */
+    char padc;
+    uint8_t lflag;    /* Number of 'l' modifiers, up to 2 */
+    uint8_t altflag : 1;
+    uint8_t zflag : 1;
+};
+
+enum FmtDescState {
+    FMT_DESC_EMPTY,
+    FMT_DESC_READY,
+    FMT_DESC_FALLBACK, /* Can't be parsed ahead, use vprintfmt() */
+};
+
+struct FmtDesc {
+    const char *fmt;
+    uint8_t state;
+    uint8_t nspecs;
+    struct FmtSpec specs[FMT_DESC_MAX_SPECS];
+};
+
 /* lib/printfmt.c */
 void printfmt(void (*putch)(int, void *), void *putdat, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
 void vprintfmt(void (*putch)(int, void *), void *putdat, const char *fmt, va_list) __attribute__((format(printf, 3, 0)));
 int snprintf(char *str, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
 int vsnprintf(char *str, size_t size, const char *fmt, va_list) __attribute__((format(printf, 3, 0)));
+void fmt_compile(struct FmtDesc *desc, const char *fmt);
+void vprintfmt_desc(void (*putch)(int, void *), void *putdat, struct FmtDesc *desc, const char *fmt, va_list) __attribute__((format(printf, 4, 0)));
 
 /* lib/printf.c */
 int cprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 int vcprintf(const char *fmt, va_list) __attribute__((format(printf, 1, 0)));
+int cprintf_desc(struct FmtDesc *desc, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* cprintf() for fixed formats on hot paths: the format is parsed
+ * on the first call and the result kept for the call site */
+#define cprintf_fast(...)                               \
+    ({                                                  \
+        static struct FmtDesc cprintf_fast_desc_;       \
+        cprintf_desc(&cprintf_fast_desc_, __VA_ARGS__); \
+    })
 
 /* lib/readline.c */
 char *readline(const char *prompt);
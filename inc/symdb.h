@@ -0,0 +1,65 @@
+#ifndef JOS_INC_SYMDB_H
+#define JOS_INC_SYMDB_H
+
+/* Kernel symbolization database.
+ *
+ * Built from the linked kernel by the host tool kern/mksymdb.c, appended
+ * to the kernel ELF as section SYMDB_SECTION and handed to the kernel by
+ * the loader as LOADER_PARAMS.SymdbStart/SymdbEnd. All offsets are in
+ * bytes from the start of the header, all tables are 8 byte aligned.
+ *
+ * This header is shared with the host tool, which defines SYMDB_HOST
+ * and brings its own fixed width integer types */
+
+#ifndef SYMDB_HOST
+#include <inc/types.h>
+#endif
+
+#define SYMDB_SECTION ".symdb"
+#define SYMDB_MAGIC   0x4D59534AU /* "JSYM" */
+#define SYMDB_VERSION 1
+
+struct SymdbHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t total_size;
+    /* Functions sorted by address */
+    uint32_t nfuncs;
+    uint32_t funcs_off;
+    /* Line table rows sorted by address */
+    uint32_t nlines;
+    uint32_t lines_off;
+    /* Name hash: 'nbuckets' (a power of two) heads and 'nfuncs' chain links,
+     * both holding function index + 1, 0 terminates a chain */
+    uint32_t nbuckets;
+    uint32_t buckets_off;
+    uint32_t chain_off;
+    /* NUL-terminated strings, offset 0 is the empty string */
+    uint32_t strings_off;
+    uint32_t strings_size;
+};
+
+struct SymdbFunc {
+    uint64_t addr;
+    uint32_t size;
+    uint32_t name;
+};
+
+/* A row covers addresses up to the next row,
+ * rows with line 0 mark the end of a sequence */
+struct SymdbLine {
+    uint64_t addr;
+    uint32_t line;
+    uint32_t file;
+};
+
+/* FNV-1a, used for the name hash */
+static inline uint32_t
+symdb_hash(const char *name) {
+    uint32_t hash = 2166136261U;
+    while (*name) hash = (hash ^ (uint8_t)*name++) * 16777619U;
+    return hash;
+}
+
+#endif /* !JOS_INC_SYMDB_H */
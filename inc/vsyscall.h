@@ -0,0 +1,22 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_INC_VSYSCALL_H
+#define JOS_INC_VSYSCALL_H
+
+/* The virtual syscall page at UVSYS is an array of 64-bit words
+ * published by the kernel, indexed by these values.
+ * Monotonic time in nanoseconds since boot is
+ *   ((tsc - vsys[VSYS_tsc_base]) * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift] */
+enum VsyscallNum {
+    VSYS_envid,        /* Id of the env running on this CPU */
+    VSYS_tsc_base,     /* TSC value at boot */
+    VSYS_tsc_mult,     /* TSC ticks to nanoseconds multiplier */
+    VSYS_tsc_shift,    /* ... and shift */
+    VSYS_tsc_hz,       /* TSC frequency */
+    VSYS_boot_time,    /* Wall clock seconds since the epoch at boot */
+    VSYS_env_switches, /* Number of times any env was run */
+    VSYS_sched_halts,  /* Number of times scheduler found nothing to run */
+    NVSYSCALLS
+};
+
+#endif /* !JOS_INC_VSYSCALL_H */
@@ -253,6 +253,20 @@ read_tsc(void) {
     return (uint64_t)lo | ((uint64_t)hi << 32);
 }
 
+/* Non-temporal store, bypasses the caches */
+static inline void __attribute__((always_inline))
+movnti(uint64_t *addr, uint64_t val) {
+    asm volatile("movnti %1, %0"
+                 : "=m"(*addr)
+                 : "r"(val));
+}
+
+static inline void __attribute__((always_inline))
+sfence(void) {
+    asm volatile("sfence" ::
+                         : "memory");
+}
+
 static inline uint32_t __attribute__((always_inline))
 xchg(volatile uint32_t *addr, uint32_t newval) {
     uint32_t result = __atomic_exchange_n(addr, newval, __ATOMIC_ACQ_REL);
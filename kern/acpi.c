@@ -0,0 +1,75 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/uefi.h>
+
+#include <kern/acpi.h>
+#include <kern/pmap.h>
+#include <kern/traceopt.h>
+
+/* Root table, either the XSDT with 64-bit
+ * entries or the RSDT with 32-bit ones */
+static const struct AcpiSdtHeader *acpi_root;
+static size_t acpi_entry_size;
+
+static bool
+acpi_checksum_ok(const void *table, size_t len) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) sum += ((const uint8_t *)table)[i];
+    return !sum;
+}
+
+/* Tables can only be read if they lie in the
+ * directly mapped part of physical memory */
+static const void *
+acpi_map(physaddr_t pa, size_t len) {
+    if (!pa || pa + len > BOOT_MEM_SIZE) return NULL;
+    return KADDR(pa);
+}
+
+static const struct AcpiSdtHeader *
+acpi_map_table(physaddr_t pa) {
+    const struct AcpiSdtHeader *h = acpi_map(pa, sizeof(*h));
+    if (!h || !acpi_map(pa, h->length) || !acpi_checksum_ok(h, h->length)) return NULL;
+    return h;
+}
+
+void
+acpi_init(void) {
+    const struct AcpiRsdp *rsdp = acpi_map(uefi_lp->ACPIRoot, sizeof(*rsdp));
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) || !acpi_checksum_ok(rsdp, 20)) {
+        cprintf("ACPI: no usable RSDP\n");
+        return;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && acpi_checksum_ok(rsdp, rsdp->length)) {
+        acpi_root = acpi_map_table(rsdp->xsdt_address);
+        acpi_entry_size = sizeof(uint64_t);
+    }
+    if (!acpi_root) {
+        acpi_root = acpi_map_table(rsdp->rsdt_address);
+        acpi_entry_size = sizeof(uint32_t);
+    }
+
+    if (!acpi_root) cprintf("ACPI: root table is not accessible\n");
+}
+
+/* Find table with 'signature', NULL if there is none */
+const void *
+acpi_find_table(const char *signature) {
+    if (!acpi_root) return NULL;
+
+    const uint8_t *entries = (const uint8_t *)(acpi_root + 1);
+    size_t count = (acpi_root->length - sizeof(*acpi_root)) / acpi_entry_size;
+
+    for (size_t i = 0; i < count; i++) {
+        physaddr_t pa = 0;
+        memcpy(&pa, entries + i * acpi_entry_size, acpi_entry_size);
+
+        const struct AcpiSdtHeader *h = acpi_map_table(pa);
+        if (h && !memcmp(h->signature, signature, 4)) return h;
+    }
+
+    return NULL;
+}
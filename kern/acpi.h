@@ -0,0 +1,94 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_ACPI_H
+#define JOS_KERN_ACPI_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct AcpiRsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    /* Fields below are only valid with revision >= 2 */
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct AcpiSdtHeader {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+/* System Resource Affinity Table */
+struct AcpiSrat {
+    struct AcpiSdtHeader h;
+    uint32_t reserved1;
+    uint64_t reserved2;
+    uint8_t entries[];
+} __attribute__((packed));
+
+#define SRAT_CPU_AFFINITY    0
+#define SRAT_MEMORY_AFFINITY 1
+#define SRAT_X2APIC_AFFINITY 2
+
+#define SRAT_ENABLED 0x1
+
+struct AcpiSratCpu {
+    uint8_t type;
+    uint8_t length;
+    uint8_t proximity_lo;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_hi[3];
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+struct AcpiSratMemory {
+    uint8_t type;
+    uint8_t length;
+    uint32_t proximity;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t size;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed));
+
+struct AcpiSratX2apic {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved1;
+    uint32_t proximity;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed));
+
+/* System Locality Information Table */
+struct AcpiSlit {
+    struct AcpiSdtHeader h;
+    uint64_t nlocalities;
+    uint8_t distance[]; /* nlocalities x nlocalities matrix */
+} __attribute__((packed));
+
+void acpi_init(void);
+const void *acpi_find_table(const char *signature);
+
+#endif /* !JOS_KERN_ACPI_H */
@@ -3,12 +3,17 @@
 #include <inc/assert.h>
 #include <inc/kbdreg.h>
 #include <inc/memlayout.h>
+#include <inc/stdarg.h>
+#include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/trap.h>
 #include <inc/uefi.h>
 #include <inc/x86.h>
 
 #include <kern/console.h>
+#include <kern/font.h>
+#include <kern/picirq.h>
+#include <kern/pmap.h>
 
 #define COM1 0x3F8
 
@@ -20,6 +25,10 @@
 #define COM_IER_RDI   0x01 /*     Enable receiver data interrupt */
 #define COM_IIR       2    /* IN:  Interrupt ID Register */
 #define COM_FCR       2    /* OUT: FIFO Control Register */
+#define COM_FCR_FIFO  0x01 /*     Enable FIFOs */
+#define COM_FCR_RXCLR 0x02 /*     Clear receive FIFO */
+#define COM_FCR_TXCLR 0x04 /*     Clear transmit FIFO */
+#define COM_FCR_TRG14 0xC0 /*     Receive interrupt at 14 bytes */
 #define COM_LCR       3    /* OUT: Line Control Register */
 #define COM_LCR_DLAB  0x80 /*     Divisor latch access bit */
 #define COM_LCR_WLEN8 0x03 /*     Wordlength: 8 bits */
@@ -32,8 +41,53 @@
 #define COM_LSR_TXRDY 0x20 /*     Transmit buffer avail */
 #define COM_LSR_TSRE  0x40 /*     Transmitter off */
 
+#define COM_TX_FIFO 16 /* Bytes the 16550 transmit FIFO holds */
+
+/* Software flow control characters */
+#define XON  0x11
+#define XOFF 0x13
+
 #define TABW 5
 
+/* Text grid limits, enough for a 4K display with 8x8 glyphs.
+ * Larger displays only use the top left part of the screen */
+#define CRT_MAX_COLS 480
+#define CRT_MAX_ROWS 270
+
+/* Glyphs are scaled up so that the grid is about this wide */
+#define CRT_WANT_COLS 100
+
+#define CRT_FG 0xFFFFFFFF
+#define CRT_BG 0x00000000
+
+/* Screen is split into tiles of FB_TILE_COLS x FB_TILE_ROWS cells.
+ * Damage is tracked per tile, one bit per tile column of a tile row */
+#define FB_TILE_COLS 16
+#define FB_TILE_ROWS 8
+#define FB_TILES_X   ((CRT_MAX_COLS + FB_TILE_COLS - 1) / FB_TILE_COLS)
+#define FB_TILES_Y   ((CRT_MAX_ROWS + FB_TILE_ROWS - 1) / FB_TILE_ROWS)
+static_assert(FB_TILES_X < 32, "Tile row does not fit crt_tile_dirty");
+
+/* Pane 0 is the console itself, it covers the whole screen.
+ * Other panes are stacked on top of it in slot order */
+#define MAX_PANES      8
+#define PANE_MAX_CELLS (64 * 128)
+
+struct Pane {
+    bool used;
+    bool damaged;
+    /* Top left corner and size on the screen, in cells */
+    uint32_t row;
+    uint32_t col;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t pos;
+    uint8_t *text;
+    /* Damaged column span of each row is [dirty_lo, dirty_hi) */
+    uint16_t dirty_lo[CRT_MAX_ROWS];
+    uint16_t dirty_hi[CRT_MAX_ROWS];
+};
+
 static bool graphics_exists = false;
 static uint32_t uefi_vres;
 static uint32_t uefi_hres;
@@ -41,217 +95,351 @@ static uint32_t uefi_stride;
 static uint32_t crt_rows;
 static uint32_t crt_cols;
 static uint32_t crt_size;
-static uint16_t crt_pos;
+static uint32_t crt_tiles_y;
+/* Pre-rasterized glyphs of the console font, crt_glyph_w x crt_glyph_h pixels */
+static const struct GlyphAtlas *crt_atlas;
+static uint32_t crt_glyph_w;
+static uint32_t crt_glyph_h;
+/* Device framebuffer. It is only ever written to,
+ * reads from write-combining memory are very slow */
 static uint32_t *crt_buf = (uint32_t *)FRAMEBUFFER;
 
+/* Panes are composed into crt_back in normal cacheable memory,
+ * crt_front holds what is currently displayed. crt_owner is
+ * the slot of the topmost pane covering each cell */
+static uint8_t crt_back[CRT_MAX_ROWS * CRT_MAX_COLS];
+static uint8_t crt_front[CRT_MAX_ROWS * CRT_MAX_COLS];
+static uint8_t crt_owner[CRT_MAX_ROWS * CRT_MAX_COLS];
+static uint32_t crt_tile_dirty[FB_TILES_Y];
+
+static struct Pane panes[MAX_PANES];
+static uint8_t cons_text[CRT_MAX_ROWS * CRT_MAX_COLS];
+static uint8_t pane_text[MAX_PANES - 1][PANE_MAX_CELLS];
+#define cons_pane (&panes[0])
+
+static struct FbStats fb_stats;
+
 static bool serial_exists;
 
+/* Set by cons_irq_init() once IRQ1/IRQ4 are delivered through the IDT */
+static bool cons_irq;
+
+/* Set by panic(); the monitor then runs with interrupts disabled */
+extern const char *panicstr;
+
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
 
 /* Text-mode framebuffer display output */
 
-static char font8x8_basic[128][8] = {
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0000 (nul) */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0001 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0002 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0003 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0004 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0005 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0006 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0007 */
-        {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, /* U+0008 XXX CHANGED to clear any symbol */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0009 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+000A */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+000B */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+000C */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+000D */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+000E */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+000F */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0010 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0011 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0012 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0013 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0014 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0015 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0016 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0017 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0018 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0019 */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+001A */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+001B */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+001C */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+001D */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+001E */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+001F */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0020 (space) */
-        {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00}, /* U+0021 (!) */
-        {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0022 (") */
-        {0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00}, /* U+0023 (#) */
-        {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00}, /* U+0024 ($) */
-        {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00}, /* U+0025 (%) */
-        {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00}, /* U+0026 (&) */
-        {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0027 (') */
-        {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00}, /* U+0028 (() */
-        {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00}, /* U+0029 ()) */
-        {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00}, /* U+002A (*) */
-        {0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00}, /* U+002B (+) */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06}, /* U+002C (,) */
-        {0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00}, /* U+002D (-) */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00}, /* U+002E (.) */
-        {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00}, /* U+002F (/) */
-        {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00}, /* U+0030 (0) */
-        {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00}, /* U+0031 (1) */
-        {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00}, /* U+0032 (2) */
-        {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00}, /* U+0033 (3) */
-        {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00}, /* U+0034 (4) */
-        {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00}, /* U+0035 (5) */
-        {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00}, /* U+0036 (6) */
-        {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00}, /* U+0037 (7) */
-        {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00}, /* U+0038 (8) */
-        {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00}, /* U+0039 (9) */
-        {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00}, /* U+003A (:) */
-        {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06}, /* U+003B (//) */
-        {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00}, /* U+003C (<) */
-        {0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00}, /* U+003D (=) */
-        {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00}, /* U+003E (>) */
-        {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00}, /* U+003F (?) */
-        {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00}, /* U+0040 (@) */
-        {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00}, /* U+0041 (A) */
-        {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00}, /* U+0042 (B) */
-        {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00}, /* U+0043 (C) */
-        {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00}, /* U+0044 (D) */
-        {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00}, /* U+0045 (E) */
-        {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00}, /* U+0046 (F) */
-        {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00}, /* U+0047 (G) */
-        {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00}, /* U+0048 (H) */
-        {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, /* U+0049 (I) */
-        {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00}, /* U+004A (J) */
-        {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00}, /* U+004B (K) */
-        {0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00}, /* U+004C (L) */
-        {0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00}, /* U+004D (M) */
-        {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00}, /* U+004E (N) */
-        {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00}, /* U+004F (O) */
-        {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00}, /* U+0050 (P) */
-        {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00}, /* U+0051 (Q) */
-        {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00}, /* U+0052 (R) */
-        {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00}, /* U+0053 (S) */
-        {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, /* U+0054 (T) */
-        {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00}, /* U+0055 (U) */
-        {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00}, /* U+0056 (V) */
-        {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00}, /* U+0057 (W) */
-        {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00}, /* U+0058 (X) */
-        {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00}, /* U+0059 (Y) */
-        {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00}, /* U+005A (Z) */
-        {0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00}, /* U+005B ([) */
-        {0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00}, /* U+005C (\) */
-        {0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00}, /* U+005D (]) */
-        {0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00}, /* U+005E (^) */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF}, /* U+005F (_) */
-        {0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+0060 (`) */
-        {0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00}, /* U+0061 (a) */
-        {0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00}, /* U+0062 (b) */
-        {0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00}, /* U+0063 (c) */
-        {0x38, 0x30, 0x30, 0x3e, 0x33, 0x33, 0x6E, 0x00}, /* U+0064 (d) */
-        {0x00, 0x00, 0x1E, 0x33, 0x3f, 0x03, 0x1E, 0x00}, /* U+0065 (e) */
-        {0x1C, 0x36, 0x06, 0x0f, 0x06, 0x06, 0x0F, 0x00}, /* U+0066 (f) */
-        {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F}, /* U+0067 (g) */
-        {0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00}, /* U+0068 (h) */
-        {0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, /* U+0069 (i) */
-        {0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E}, /* U+006A (j) */
-        {0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00}, /* U+006B (k) */
-        {0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, /* U+006C (l) */
-        {0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00}, /* U+006D (m) */
-        {0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00}, /* U+006E (n) */
-        {0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00}, /* U+006F (o) */
-        {0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F}, /* U+0070 (p) */
-        {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78}, /* U+0071 (q) */
-        {0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00}, /* U+0072 (r) */
-        {0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00}, /* U+0073 (s) */
-        {0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00}, /* U+0074 (t) */
-        {0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00}, /* U+0075 (u) */
-        {0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00}, /* U+0076 (v) */
-        {0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00}, /* U+0077 (w) */
-        {0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00}, /* U+0078 (x) */
-        {0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F}, /* U+0079 (y) */
-        {0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00}, /* U+007A (z) */
-        {0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00}, /* U+007B ({) */
-        {0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00}, /* U+007C (|) */
-        {0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00}, /* U+007D (}) */
-        {0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+007E (~) */
-        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* U+007F */
-};
+static void
+pane_damage(struct Pane *pane, uint32_t row, uint32_t lo, uint32_t hi) {
+    if (pane->dirty_lo[row] == pane->dirty_hi[row]) {
+        pane->dirty_lo[row] = lo;
+        pane->dirty_hi[row] = hi;
+    } else {
+        pane->dirty_lo[row] = MIN(pane->dirty_lo[row], lo);
+        pane->dirty_hi[row] = MAX(pane->dirty_hi[row], hi);
+    }
+    pane->damaged = 1;
+}
 
-void
-draw_char(uint32_t *buffer, uint32_t x, uint32_t y, uint32_t color, uint8_t charcode) {
-    char *chr = font8x8_basic[(unsigned)charcode];
-    uint32_t *buf = buffer + uefi_stride * SYMBOL_SIZE * y + SYMBOL_SIZE * x;
+static void
+pane_damage_all(struct Pane *pane) {
+    for (uint32_t row = 0; row < pane->rows; row++)
+        pane_damage(pane, row, 0, pane->cols);
+}
+
+static void
+pane_setc(struct Pane *pane, uint32_t pos, uint8_t c) {
+    pane->text[pos] = c;
+    pane_damage(pane, pos / pane->cols, pos % pane->cols, pos % pane->cols + 1);
+}
+
+/* Mark tiles covering columns [lo, hi) of screen row 'row' */
+static void
+fb_damage_tiles(uint32_t row, uint32_t lo, uint32_t hi) {
+    uint32_t first = lo / FB_TILE_COLS, last = (hi - 1) / FB_TILE_COLS;
+    crt_tile_dirty[row / FB_TILE_ROWS] |= ((2U << last) - 1) & ~((1U << first) - 1);
+}
+
+/* Recompute which pane is visible in every cell
+ * and redraw all of them */
+static void
+fb_restack(void) {
+    for (uint32_t i = 0; i < MAX_PANES; i++) {
+        struct Pane *pane = &panes[i];
+        if (!pane->used) continue;
+
+        for (uint32_t row = 0; row < pane->rows; row++)
+            memset(crt_owner + (pane->row + row) * crt_cols + pane->col, i, pane->cols);
+        pane_damage_all(pane);
+    }
+}
+
+/* Copy damaged cells of every pane into the back buffer,
+ * clipped by the panes stacked above it */
+static void
+fb_compose(void) {
+    for (uint32_t i = 0; i < MAX_PANES; i++) {
+        struct Pane *pane = &panes[i];
+        if (!pane->used || !pane->damaged) continue;
+        pane->damaged = 0;
+
+        for (uint32_t row = 0; row < pane->rows; row++) {
+            uint32_t lo = pane->dirty_lo[row], hi = pane->dirty_hi[row];
+            if (lo == hi) continue;
+            pane->dirty_lo[row] = pane->dirty_hi[row] = 0;
+
+            uint32_t base = (pane->row + row) * crt_cols + pane->col;
+            const uint8_t *text = pane->text + row * pane->cols;
+            for (uint32_t col = lo; col < hi; col++)
+                if (crt_owner[base + col] == i) crt_back[base + col] = text[col];
+            fb_damage_tiles(pane->row + row, pane->col + lo, pane->col + hi);
+        }
+    }
+}
+
+/* Render columns [lo, hi) of text row 'row' straight into the device
+ * framebuffer, one scanline at a time, by copying rows of atlas tiles
+ * with non-temporal stores */
+static void
+fb_render_span(uint32_t row, uint32_t lo, uint32_t hi) {
+    const uint8_t *text = crt_back + row * crt_cols;
+
+    for (size_t line = 0; line < crt_glyph_h; line++) {
+        uint32_t *dst = crt_buf + uefi_stride * (crt_glyph_h * row + line) + crt_glyph_w * lo;
 
-    for (size_t heigth = 0; heigth < 8; heigth++) {
-        for (size_t width = 0; width < 8; width++) {
-            buf[uefi_stride * heigth + width] = color * ((chr[heigth] >> width) & 1);
+        for (size_t col = lo; col < hi; col++, dst += crt_glyph_w) {
+            const uint64_t *src = (const uint64_t *)(atlas_tile(crt_atlas, text[col]) + line * crt_glyph_w);
+
+            for (size_t px = 0; px < crt_glyph_w / 2; px++)
+                movnti((uint64_t *)dst + px, src[px]);
         }
     }
 }
 
+/* Render damaged tiles of tile rows [first, last).
+ * Adjacent damaged tiles are merged into a single span and cells
+ * that did not change since they were last drawn are skipped.
+ * Tile rows are independent, so disjoint ranges can be flushed
+ * from different CPUs at the same time */
+void
+fb_flush_tiles(uint32_t first, uint32_t last) {
+    uint64_t ntiles = 0, ncells = 0;
+
+    for (uint32_t ty = first; ty < MIN(last, crt_tiles_y); ty++) {
+        uint32_t dirty = __atomic_exchange_n(&crt_tile_dirty[ty], 0, __ATOMIC_ACQUIRE);
+
+        while (dirty) {
+            uint32_t tx_lo = __builtin_ctz(dirty);
+            uint32_t tx_hi = tx_lo + __builtin_ctz(~(dirty >> tx_lo));
+            dirty &= ~(((2U << (tx_hi - 1)) - 1) & ~((1U << tx_lo) - 1));
+            ntiles += tx_hi - tx_lo;
+
+            uint32_t row_hi = MIN((ty + 1) * FB_TILE_ROWS, crt_rows);
+            for (uint32_t row = ty * FB_TILE_ROWS; row < row_hi; row++) {
+                uint32_t lo = tx_lo * FB_TILE_COLS;
+                uint32_t hi = MIN(tx_hi * FB_TILE_COLS, crt_cols);
+
+                uint8_t *back = crt_back + row * crt_cols;
+                uint8_t *front = crt_front + row * crt_cols;
+                while (lo < hi && back[lo] == front[lo]) lo++;
+                while (lo < hi && back[hi - 1] == front[hi - 1]) hi--;
+                if (lo == hi) continue;
+
+                fb_render_span(row, lo, hi);
+                memcpy(front + lo, back + lo, hi - lo);
+                ncells += hi - lo;
+            }
+        }
+    }
+
+    /* Make streaming stores globally visible */
+    if (ncells) sfence();
+
+    __atomic_add_fetch(&fb_stats.tiles, ntiles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&fb_stats.cells, ncells, __ATOMIC_RELAXED);
+}
+
+/* Push damaged parts of all panes to the screen */
+void
+fb_flush(void) {
+    if (!graphics_exists) return;
+
+    fb_compose();
+    fb_flush_tiles(0, crt_tiles_y);
+    fb_stats.flushes++;
+}
+
+const struct FbStats *
+fb_get_stats(void) {
+    return &fb_stats;
+}
+
+/* Size of the screen in cells, 0x0 without a framebuffer */
+void
+fb_size(uint32_t *rows, uint32_t *cols) {
+    *rows = graphics_exists ? crt_rows : 0;
+    *cols = graphics_exists ? crt_cols : 0;
+}
+
+/* Clear the device framebuffer without reading it back */
+static void
+fb_clear(size_t size) {
+    uint64_t *dst = (uint64_t *)crt_buf;
+    for (size_t i = 0; i < size / sizeof(*dst); i++)
+        movnti(dst + i, (uint64_t)CRT_BG << 32 | CRT_BG);
+    sfence();
+}
+
 void
 fb_init(void) {
     LOADER_PARAMS *lp = (LOADER_PARAMS *)uefi_lp;
     uefi_vres = lp->VerticalResolution;
     uefi_hres = lp->HorizontalResolution;
     uefi_stride = lp->PixelsPerScanLine;
-    crt_rows = uefi_vres / SYMBOL_SIZE;
-    crt_cols = uefi_hres / SYMBOL_SIZE;
+
+    /* Prefer a font linked into the kernel, the built-in
+     * one only covers ASCII at 8x8 */
+    const struct Font *font = font_embedded();
+    if (!font) font = &font8x8;
+
+    uint32_t scale = MAX(uefi_hres / (font->width * CRT_WANT_COLS), 1);
+    while (scale > 1 && !atlas_fits(font, scale)) scale--;
+    crt_atlas = atlas_get(font, scale, CRT_FG, CRT_BG);
+    if (!crt_atlas) {
+        font = &font8x8;
+        crt_atlas = atlas_get(font, 1, CRT_FG, CRT_BG);
+    }
+    assert(crt_atlas);
+    crt_glyph_w = crt_atlas->width;
+    crt_glyph_h = crt_atlas->height;
+
+    crt_rows = MIN(uefi_vres / crt_glyph_h, CRT_MAX_ROWS);
+    crt_cols = MIN(uefi_hres / crt_glyph_w, CRT_MAX_COLS);
     crt_size = crt_rows * crt_cols;
-    crt_pos = crt_cols;
+    crt_tiles_y = (crt_rows + FB_TILE_ROWS - 1) / FB_TILE_ROWS;
 
     /* Clear screen */
-    memset(crt_buf, 0, lp->FrameBufferSize);
+    fb_clear(lp->FrameBufferSize);
+    memset(crt_back, ' ', crt_size);
+    memset(crt_front, ' ', crt_size);
+
+    cons_pane->used = 1;
+    cons_pane->rows = crt_rows;
+    cons_pane->cols = crt_cols;
+    cons_pane->pos = crt_cols;
+    cons_pane->text = cons_text;
+    memset(cons_text, ' ', crt_size);
+    fb_restack();
 
     graphics_exists = true;
 }
 
-static void
-fb_putc(int c) {
-    if (!graphics_exists) return;
+/* Create a pane over the screen rectangle, clipped to the screen.
+ * It is put on top of all existing panes */
+struct Pane *
+pane_create(uint32_t row, uint32_t col, uint32_t rows, uint32_t cols) {
+    if (!graphics_exists || row >= crt_rows || col >= crt_cols) return NULL;
+
+    rows = MIN(rows, crt_rows - row);
+    cols = MIN(cols, crt_cols - col);
+    if (!rows || !cols || rows * cols > PANE_MAX_CELLS) return NULL;
+
+    for (uint32_t i = 1; i < MAX_PANES; i++) {
+        struct Pane *pane = &panes[i];
+        if (pane->used) continue;
+
+        memset(pane, 0, sizeof(*pane));
+        pane->used = 1;
+        pane->row = row;
+        pane->col = col;
+        pane->rows = rows;
+        pane->cols = cols;
+        pane->text = pane_text[i - 1];
+        memset(pane->text, ' ', rows * cols);
+        fb_restack();
+        return pane;
+    }
+
+    return NULL;
+}
+
+void
+pane_destroy(struct Pane *pane) {
+    assert(pane != cons_pane);
+    pane->used = 0;
+    fb_restack();
+}
+
+void
+pane_clear(struct Pane *pane) {
+    memset(pane->text, ' ', pane->rows * pane->cols);
+    pane->pos = 0;
+    pane_damage_all(pane);
+}
+
+void
+pane_putc(struct Pane *pane, int c) {
+    uint32_t size = pane->rows * pane->cols;
 
     /* If no attribute given, then use black on white */
     if (!(c & ~0xFF)) c |= 0x0700;
 
     switch (c & 0xFF) {
     case '\b':
-        if (crt_pos > 0) {
-            crt_pos--;
-            draw_char(crt_buf, crt_pos % crt_cols, crt_pos / crt_cols, 0x0, 0x8);
+        if (pane->pos > 0) {
+            pane->pos--;
+            pane_setc(pane, pane->pos, ' ');
         }
         break;
     case '\n':
-        crt_pos += crt_cols;
+        pane->pos += pane->cols;
         /* fallthrough */
     case '\r':
-        crt_pos -= (crt_pos % crt_cols);
+        pane->pos -= (pane->pos % pane->cols);
         break;
     case '\t':
         for (size_t i = 0; i < TABW; i++)
-            fb_putc(' ');
+            pane_putc(pane, ' ');
         break;
     default:
         /* write the character */
-        draw_char(crt_buf, crt_pos % crt_cols, crt_pos / crt_cols, 0xFFFFFFFF, (uint8_t)c);
-        crt_pos++;
+        pane_setc(pane, pane->pos, (uint8_t)c);
+        pane->pos++;
     }
 
-    /* Scoll up when we have reached the bottom of screen */
-    if (crt_pos >= crt_size) {
-        memmove(crt_buf, crt_buf + uefi_stride * SYMBOL_SIZE,
-                uefi_stride * (uefi_vres - SYMBOL_SIZE) * sizeof(uint32_t));
-
-        size_t i = (uefi_vres - (uefi_vres % SYMBOL_SIZE) - SYMBOL_SIZE);
-        memset(crt_buf + i * uefi_stride, 0, uefi_stride * (uefi_vres - i) * sizeof(uint32_t));
-        crt_pos -= crt_cols;
+    /* Scoll up when we have reached the bottom of the pane.
+     * Only the text grid is moved, fb_flush() redraws
+     * the cells that actually changed */
+    if (pane->pos >= size) {
+        memmove(pane->text, pane->text + pane->cols, size - pane->cols);
+        memset(pane->text + size - pane->cols, ' ', pane->cols);
+        pane_damage_all(pane);
+        pane->pos -= pane->cols;
     }
 }
 
+static void
+pane_putch(int c, void *pane) {
+    pane_putc(pane, c);
+}
+
+/* Text is shown on the screen by the next fb_flush() */
+void
+pane_printf(struct Pane *pane, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintfmt(pane_putch, pane, fmt, ap);
+    va_end(ap);
+}
+
+static void
+fb_putc(int c) {
+    if (graphics_exists) pane_putc(cons_pane, c);
+}
+
 /* Serial I/O code */
 
 
@@ -277,19 +465,45 @@ serial_intr(void) {
 }
 
 static void
-serial_putc(int c) {
+serial_wait_tx(void) {
     for (size_t i = 0; i < 12800; i++) {
         if (inb(COM1 + COM_LSR) & COM_LSR_TXRDY) break;
         delay();
     }
+}
 
+static void
+serial_putc(int c) {
+    serial_wait_tx();
     outb(COM1 + COM_TX, c);
 }
 
+/* Transmit buffer empty means the whole FIFO is free,
+ * so it is refilled a FIFO worth of bytes at a time */
+static void
+serial_write(const char *str, size_t len) {
+    while (len) {
+        serial_wait_tx();
+        for (size_t n = MIN(len, COM_TX_FIFO); n; n--, len--)
+            outb(COM1 + COM_TX, *str++ & 0x7F);
+    }
+}
+
+/* Ask the other side to stop or resume sending, both with
+ * RTS for hardware flow control and XOFF/XON for software one */
+static void
+serial_throttle(bool stop) {
+    if (!serial_exists) return;
+
+    outb(COM1 + COM_MCR, COM_MCR_OUT2 | COM_MCR_DTR | (stop ? 0 : COM_MCR_RTS));
+    serial_putc(stop ? XOFF : XON);
+}
+
 static void
 serial_init(void) {
-    /* Turn off the FIFO */
-    outb(COM1 + COM_FCR, 0);
+    /* Turn on and reset the FIFOs, so that a whole burst of
+     * pasted input is taken with a single interrupt */
+    outb(COM1 + COM_FCR, COM_FCR_FIFO | COM_FCR_RXCLR | COM_FCR_TXCLR | COM_FCR_TRG14);
 
     /* Set speed; requires DLAB latch */
     outb(COM1 + COM_LCR, COM_LCR_DLAB);
@@ -299,8 +513,8 @@ serial_init(void) {
     /* 8 data bits, 1 stop bit, parity off; turn off DLAB latch */
     outb(COM1 + COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
-    /* No modem controls */
-    outb(COM1 + COM_MCR, 0);
+    /* Ready to receive. OUT2 gates the interrupt line to the PIC */
+    outb(COM1 + COM_MCR, COM_MCR_OUT2 | COM_MCR_DTR | COM_MCR_RTS);
     /* Enable RCV interrupts */
     outb(COM1 + COM_IER, COM_IER_RDI);
 
@@ -487,14 +701,26 @@ kbd_init(void) {
  * whenever the corresponding interrupt occurs.
  */
 
-#define CONSBUFSIZE 512
+#define CONSBUFSIZE 4096
+
+/* Serial input is throttled when the buffer fills up past
+ * CONS_HIWAT and resumed once it is drained below CONS_LOWAT */
+#define CONS_HIWAT (CONSBUFSIZE * 3 / 4)
+#define CONS_LOWAT (CONSBUFSIZE / 4)
 
 static struct {
     uint8_t buf[CONSBUFSIZE];
     uint32_t rpos;
     uint32_t wpos;
+    bool throttled;
+    uint64_t dropped;
 } cons;
 
+static uint32_t
+cons_pending(void) {
+    return (cons.wpos - cons.rpos) % CONSBUFSIZE;
+}
+
 /* called by device interrupt routines to feed input characters
  * into the circular console input buffer */
 static void
@@ -503,9 +729,34 @@ cons_intr(int (*proc)(void)) {
 
     while ((ch = (*proc)()) != -1) {
         if (!ch) continue;
+
+        /* Device has to be drained anyway, so characters
+         * that do not fit are counted and thrown away */
+        if ((cons.wpos + 1) % CONSBUFSIZE == cons.rpos) {
+            cons.dropped++;
+            continue;
+        }
+
         cons.buf[cons.wpos++] = ch;
         if (cons.wpos == CONSBUFSIZE) cons.wpos = 0;
     }
+
+    if (!cons.throttled && cons_pending() >= CONS_HIWAT) {
+        cons.throttled = 1;
+        serial_throttle(1);
+    }
+}
+
+static bool
+cons_input_ready(void) {
+    return cons_pending() != 0;
+}
+
+/* Input can only be waited for with hlt when it is interrupt-driven
+ * and interrupts may be enabled, which is not the case after a panic */
+static bool
+cons_polled(void) {
+    return !cons_irq || panicstr;
 }
 
 /* Return the next input character from the console, or 0 if none waiting */
@@ -514,14 +765,21 @@ cons_getc(void) {
 
     /* Poll for any pending input characters,
      * so that this function works even when interrupts are disabled
-     * (e.g., when called from the kernel monitor) */
-    serial_intr();
-    kbd_intr();
+     * (e.g., when called from the kernel monitor after a panic) */
+    if (cons_polled()) {
+        serial_intr();
+        kbd_intr();
+    }
 
     /* Grab the next character from the input buffer */
     if (cons.rpos != cons.wpos) {
         uint8_t ch = cons.buf[cons.rpos++];
         cons.rpos %= CONSBUFSIZE;
+
+        if (cons.throttled && cons_pending() <= CONS_LOWAT) {
+            cons.throttled = 0;
+            serial_throttle(0);
+        }
         return ch;
     }
     return 0;
@@ -549,6 +807,40 @@ cons_init(void) {
         cprintf("Serial port does not exist!\n");
 }
 
+/* Switch console input from polling to IRQ1/IRQ4.
+ * Must be called after trap_init() and pic_init() */
+void
+cons_irq_init(void) {
+    /* Drain the controllers so that they raise the next interrupt */
+    kbd_intr();
+    serial_intr();
+
+    uint16_t mask = irq_mask_8259A & ~(1 << IRQ_KBD);
+    if (serial_exists) mask &= ~(1 << IRQ_SERIAL);
+    irq_setmask_8259A(mask);
+
+    cons_irq = true;
+}
+
+/* Sleep until the next interrupt arrives */
+static void
+cons_wait(void) {
+    if (cons_polled()) return;
+
+    /* Zero pages in advance until input arrives */
+    page_zero_idle(cons_input_ready);
+    if (cons_input_ready()) return;
+
+    uint64_t rflags = read_rflags();
+
+    /* sti takes effect only after the following instruction,
+     * so an interrupt that arrived after the input buffer was found
+     * empty is delivered once hlt is entered, and wakes it up */
+    asm volatile("sti\n\thlt" ::: "memory");
+
+    write_rflags(rflags);
+}
+
 /* `High'-level console I/O.  Used by readline and cprintf. */
 
 void
@@ -556,16 +848,39 @@ cputchar(int c) {
     cons_putc(c);
 }
 
+/* Output a batch of characters, the serial line is fed
+ * a FIFO worth at a time instead of waiting for each byte */
+void
+cputs(const char *str, size_t len) {
+    serial_write(str, len);
+
+    for (size_t i = 0; i < len; i++) {
+        lpt_putc(str[i] & 0x7F);
+        fb_putc(str[i] & 0x7F);
+    }
+
+    fb_flush();
+}
+
 int
 getchar(void) {
     int ch;
 
+    /* Show everything echoed so far before blocking */
+    fb_flush();
+
     while (!(ch = cons_getc()))
-        /* nothing */;
+        cons_wait();
 
     return ch;
 }
 
+/* Return the next input character, or 0 if none is waiting */
+int
+getchar_nowait(void) {
+    return cons_getc();
+}
+
 int
 iscons(int fdnum) {
     /* Used by readline */
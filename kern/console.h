@@ -11,10 +11,30 @@
 #define CRT_ROWS    25
 #define CRT_COLS    80
 #define CRT_SIZE    (CRT_ROWS * CRT_COLS)
-#define SYMBOL_SIZE 8
 
 void cons_init(void);
+void cons_irq_init(void);
 void fb_init(void);
+void fb_flush(void);
+void fb_flush_tiles(uint32_t first, uint32_t last);
+void fb_size(uint32_t *rows, uint32_t *cols);
+
+struct FbStats {
+    uint64_t flushes; /* Calls to fb_flush() */
+    uint64_t tiles;   /* Damaged tiles looked at */
+    uint64_t cells;   /* Cells actually drawn */
+};
+
+const struct FbStats *fb_get_stats(void);
+
+/* Rectangular region of the screen with its own text grid */
+struct Pane;
+
+struct Pane *pane_create(uint32_t row, uint32_t col, uint32_t rows, uint32_t cols);
+void pane_destroy(struct Pane *pane);
+void pane_clear(struct Pane *pane);
+void pane_putc(struct Pane *pane, int c);
+void pane_printf(struct Pane *pane, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 int cons_getc(void);
 
 /* IRQ1 */
@@ -9,12 +9,22 @@
 
 #define NCPU 1
 
+/* Cache line size, per-CPU data is aligned to it
+ * so that CPUs never share a line */
+#define CPU_CACHE_LINE 64
+
 /* Used by x86 to find stack for interrupt */
 extern struct Taskstate cpu_ts;
 
 extern char in_intr;
 extern bool in_clk_intr;
 
+/* Index of the executing CPU, only the boot CPU is started for now */
+static inline int
+cpunum(void) {
+    return 0;
+}
+
 static inline bool
 in_interrupt(void) {
     return !!in_intr;
@@ -4,6 +4,9 @@
 #include <inc/string.h>
 #include <inc/types.h>
 #include <inc/stdio.h>
+#include <inc/symdb.h>
+
+#include <kern/kmalloc.h>
 
 struct Slice {
     const void *mem;
@@ -271,6 +274,362 @@ dwarf_read_abbrev_entry(const void *entry, unsigned form, void *buf, int bufsize
     return bytes;
 }
 
+/* Abbreviation codes are small consecutive numbers in practice,
+ * so the entries of a unit are indexed by code once per walk
+ * instead of searching the table for every DIE */
+#define DWARF_ABBREV_INDEX 128
+
+struct Dwarf_Abbrevs {
+    const uint8_t *table;
+    const uint8_t *entry[DWARF_ABBREV_INDEX];
+};
+
+static void
+dwarf_index_abbrevs(const struct Dwarf_Addrs *addrs, const uint8_t *table, struct Dwarf_Abbrevs *abbrevs) {
+    uint64_t code = 0, tag = 0, name = 0, form = 0;
+
+    memset(abbrevs, 0, sizeof(*abbrevs));
+    abbrevs->table = table;
+
+    while (table < addrs->abbrev_end) {
+        const uint8_t *entry = table;
+        table += dwarf_read_uleb128(table, &code);
+        if (!code) break;
+        if (code < DWARF_ABBREV_INDEX) abbrevs->entry[code] = entry;
+
+        table += dwarf_read_uleb128(table, &tag);
+        table += sizeof(Dwarf_Small);
+        do {
+            table += dwarf_read_uleb128(table, &name);
+            table += dwarf_read_uleb128(table, &form);
+        } while (name || form);
+    }
+}
+
+/* Find abbreviation 'code'. Stores its tag and children flag and
+ * returns its attribute specifications, NULL if there is none */
+static const uint8_t *
+dwarf_find_abbrev(const struct Dwarf_Addrs *addrs, const struct Dwarf_Abbrevs *abbrevs, uint64_t code, uint64_t *tag, bool *children) {
+    uint64_t table_code = 0, name = 0, form = 0;
+    const uint8_t *table = abbrevs->table;
+
+    if (code < DWARF_ABBREV_INDEX) {
+        if (!abbrevs->entry[code]) return NULL;
+        table = abbrevs->entry[code];
+    }
+
+    while (table < addrs->abbrev_end) {
+        table += dwarf_read_uleb128(table, &table_code);
+        if (!table_code) break;
+        table += dwarf_read_uleb128(table, tag);
+        *children = get_unaligned(table, Dwarf_Small) == DW_CHILDREN_yes;
+        table += sizeof(Dwarf_Small);
+        if (table_code == code) return table;
+
+        /* Skip attributes */
+        do {
+            table += dwarf_read_uleb128(table, &name);
+            table += dwarf_read_uleb128(table, &form);
+        } while (name || form);
+    }
+
+    return NULL;
+}
+
+/* Read a DW_AT_sibling reference into a pointer, 'cu' is the start of the
+ * compilation unit header. Returns number of bytes read */
+static int
+dwarf_read_sibling(const struct Dwarf_Addrs *addrs, const uint8_t *cu, const uint8_t *entry,
+                   unsigned form, size_t address_size, const uint8_t **sibling) {
+    uint64_t ref = 0;
+    int bytes = dwarf_read_abbrev_entry(entry, form, &ref, sizeof(ref), address_size);
+
+    if (form == DW_FORM_ref_addr)
+        *sibling = addrs->info_begin + ref;
+    else if (form == DW_FORM_ref1 || form == DW_FORM_ref2 || form == DW_FORM_ref4 ||
+             form == DW_FORM_ref8 || form == DW_FORM_ref_udata)
+        *sibling = cu + ref;
+
+    return bytes;
+}
+
+/* Skip attributes of a DIE described by 'abbrev', storing
+ * its sibling if it has one. Returns the start of the next DIE */
+static const uint8_t *
+dwarf_skip_attrs(const struct Dwarf_Addrs *addrs, const uint8_t *cu, const uint8_t *abbrev,
+                 const uint8_t *entry, size_t address_size, const uint8_t **sibling) {
+    uint64_t name = 0, form = 0;
+
+    do {
+        abbrev += dwarf_read_uleb128(abbrev, &name);
+        abbrev += dwarf_read_uleb128(abbrev, &form);
+        if (name == DW_AT_sibling)
+            entry += dwarf_read_sibling(addrs, cu, entry, form, address_size, sibling);
+        else
+            entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
+    } while (name || form);
+
+    return entry;
+}
+
+/* Skip the whole subtree of a DIE. 'entry' points right past its attributes,
+ * 'sibling' is its DW_AT_sibling or NULL. Nested DIEs are only decoded
+ * when there is no sibling reference to jump over them */
+static const uint8_t *
+dwarf_skip_children(const struct Dwarf_Addrs *addrs, const uint8_t *cu, const struct Dwarf_Abbrevs *abbrevs,
+                    const uint8_t *entry, const uint8_t *end, size_t address_size, const uint8_t *sibling) {
+    if (sibling > entry && sibling <= end) return sibling;
+
+    for (int depth = 1; depth && entry < end;) {
+        uint64_t code = 0, tag = 0;
+        bool children = 0;
+
+        entry += dwarf_read_uleb128(entry, &code);
+        if (!code) {
+            depth--;
+            continue;
+        }
+
+        const uint8_t *abbrev = dwarf_find_abbrev(addrs, abbrevs, code, &tag, &children);
+        if (!abbrev) return end;
+
+        const uint8_t *next = NULL;
+        entry = dwarf_skip_attrs(addrs, cu, abbrev, entry, address_size, &next);
+        if (children) {
+            if (next > entry && next <= end)
+                entry = next;
+            else
+                depth++;
+        }
+    }
+
+    return entry;
+}
+
+/* Name index over .debug_pubnames, built with kmalloc on first use.
+ * All names are in one hash table and every set has a Bloom filter
+ * of its own, so a name that is not there is rejected without
+ * scanning the section */
+
+#define PUBNAMES_BLOOM_BITS_PER_NAME 8
+#define PUBNAMES_BLOOM_HASHES        3
+
+struct PubnamesEntry {
+    const char *name;
+    uint32_t hash;
+    uint32_t set;
+    Dwarf_Off die; /* DIE offset within the unit */
+};
+
+struct PubnamesSet {
+    Dwarf_Off cu_offset;
+    uint64_t *bloom;
+    uint32_t bloom_mask; /* Number of bits - 1 */
+};
+
+static struct {
+    const uint8_t *section;
+    bool failed;
+    size_t nsets;
+    size_t nentries;
+    size_t nbuckets;
+    struct PubnamesSet *sets;
+    struct PubnamesEntry *entries;
+    uint32_t *buckets; /* Entry index + 1, 0 is the end of a chain */
+    uint32_t *chain;
+    uint64_t *bloom;
+} pubnames_index;
+
+/* Bit 'i' of the Bloom filter probes for 'hash', double hashing */
+static uint32_t
+pubnames_bloom_bit(uint32_t hash, int i) {
+    return hash + i * (((hash >> 16) | (hash << 16)) | 1);
+}
+
+static void
+pubnames_bloom_add(struct PubnamesSet *set, uint32_t hash) {
+    for (int i = 0; i < PUBNAMES_BLOOM_HASHES; i++) {
+        uint32_t bit = pubnames_bloom_bit(hash, i) & set->bloom_mask;
+        set->bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static bool
+pubnames_bloom_test(const struct PubnamesSet *set, uint32_t hash) {
+    for (int i = 0; i < PUBNAMES_BLOOM_HASHES; i++) {
+        uint32_t bit = pubnames_bloom_bit(hash, i) & set->bloom_mask;
+        if (!(set->bloom[bit / 64] & (1ULL << (bit % 64)))) return 0;
+    }
+    return 1;
+}
+
+/* Filter size in bits for a set of 'count' names, a power of two */
+static uint32_t
+pubnames_bloom_size(size_t count) {
+    uint32_t bits = 64;
+    while (bits < count * PUBNAMES_BLOOM_BITS_PER_NAME) bits *= 2;
+    return bits;
+}
+
+/* Parse the header of the pubnames set at 'set'. Stores the end of the set
+ * and the offset of its unit, returns the first name entry, NULL on error */
+static const uint8_t *
+pubnames_set_header(const uint8_t *set, const uint8_t **set_end, Dwarf_Off *cu_offset) {
+    uint64_t len = 0;
+    uint32_t count = dwarf_entry_len(set, &len);
+    if (!count) return NULL;
+    set += count;
+    *set_end = set + len;
+
+    assert(get_unaligned(set, Dwarf_Half) == 2);
+    set += sizeof(Dwarf_Half);
+    *cu_offset = get_unaligned(set, uint32_t);
+    set += sizeof(uint32_t);
+    count = dwarf_entry_len(set, &len);
+    return set + count;
+}
+
+/* Read the name entry at 'ptr', returns the next one or NULL past the last */
+static const uint8_t *
+pubnames_next(const uint8_t *ptr, const uint8_t *set_end, Dwarf_Off *die, const char **name) {
+    if (ptr >= set_end) return NULL;
+    *die = get_unaligned(ptr, uint32_t);
+    if (!*die) return NULL;
+    ptr += sizeof(uint32_t);
+    *name = (const char *)ptr;
+    return ptr + strlen(*name) + 1;
+}
+
+static void
+pubnames_index_free(void) {
+    kfree(pubnames_index.sets);
+    kfree(pubnames_index.entries);
+    kfree(pubnames_index.buckets);
+    kfree(pubnames_index.chain);
+    kfree(pubnames_index.bloom);
+    pubnames_index.sets = NULL;
+    pubnames_index.entries = NULL;
+    pubnames_index.buckets = NULL;
+    pubnames_index.chain = NULL;
+    pubnames_index.bloom = NULL;
+}
+
+/* Returns whether the index for 'addrs' is available */
+static bool
+pubnames_index_get(const struct Dwarf_Addrs *addrs) {
+    if (pubnames_index.section == addrs->pubnames_begin) return !pubnames_index.failed;
+    /* Only the kernel's own debug info is indexed */
+    if (pubnames_index.section) return 0;
+
+    pubnames_index.section = addrs->pubnames_begin;
+    pubnames_index.failed = 1;
+
+    const uint8_t *set, *set_end, *ptr;
+    Dwarf_Off cu_offset, die;
+    const char *name;
+
+    /* Size everything first */
+    size_t nsets = 0, nentries = 0, bloom_words = 0;
+    for (set = addrs->pubnames_begin; set < addrs->pubnames_end; set = set_end) {
+        if (!(ptr = pubnames_set_header(set, &set_end, &cu_offset))) return 0;
+
+        size_t count = 0;
+        while ((ptr = pubnames_next(ptr, set_end, &die, &name))) count++;
+
+        nsets++;
+        nentries += count;
+        bloom_words += pubnames_bloom_size(count) / 64;
+    }
+    if (!nentries) return 0;
+
+    size_t nbuckets = 1;
+    while (nbuckets < nentries) nbuckets *= 2;
+
+    pubnames_index.sets = kzalloc(nsets * sizeof(*pubnames_index.sets));
+    pubnames_index.entries = kzalloc(nentries * sizeof(*pubnames_index.entries));
+    pubnames_index.buckets = kzalloc(nbuckets * sizeof(*pubnames_index.buckets));
+    pubnames_index.chain = kzalloc(nentries * sizeof(*pubnames_index.chain));
+    pubnames_index.bloom = kzalloc(bloom_words * sizeof(*pubnames_index.bloom));
+    if (!pubnames_index.sets || !pubnames_index.entries || !pubnames_index.buckets ||
+        !pubnames_index.chain || !pubnames_index.bloom) {
+        pubnames_index_free();
+        return 0;
+    }
+
+    size_t nset = 0, nentry = 0;
+    uint64_t *bloom = pubnames_index.bloom;
+    for (set = addrs->pubnames_begin; set < addrs->pubnames_end; set = set_end, nset++) {
+        struct PubnamesSet *pset = &pubnames_index.sets[nset];
+        const uint8_t *first = pubnames_set_header(set, &set_end, &pset->cu_offset);
+
+        size_t count = 0;
+        for (ptr = first; (ptr = pubnames_next(ptr, set_end, &die, &name));) count++;
+        uint32_t bits = pubnames_bloom_size(count);
+        pset->bloom = bloom;
+        pset->bloom_mask = bits - 1;
+        bloom += bits / 64;
+
+        for (ptr = first; (ptr = pubnames_next(ptr, set_end, &die, &name));) {
+            struct PubnamesEntry *ent = &pubnames_index.entries[nentry++];
+            ent->name = name;
+            ent->hash = symdb_hash(name);
+            ent->set = nset;
+            ent->die = die;
+            pubnames_bloom_add(pset, ent->hash);
+        }
+    }
+
+    /* Insert in reverse, so that chains keep section order */
+    for (size_t i = nentries; i-- > 0;) {
+        uint32_t bucket = pubnames_index.entries[i].hash & (nbuckets - 1);
+        pubnames_index.chain[i] = pubnames_index.buckets[bucket];
+        pubnames_index.buckets[bucket] = i + 1;
+    }
+
+    pubnames_index.nsets = nsets;
+    pubnames_index.nentries = nentries;
+    pubnames_index.nbuckets = nbuckets;
+    pubnames_index.failed = 0;
+    return 1;
+}
+
+/* Whether a 'fname' match in the compilation unit at 'cu_offset' is ruled out
+ * by .debug_pubnames. Units without a name set are never ruled out */
+static bool
+dwarf_pubnames_excludes(const struct Dwarf_Addrs *addrs, Dwarf_Off cu_offset, const char *fname) {
+    const uint8_t *set, *set_end, *ptr;
+    Dwarf_Off offset, die;
+    const char *name;
+
+    if (pubnames_index_get(addrs)) {
+        for (uint32_t i = 0; i < pubnames_index.nsets; i++) {
+            const struct PubnamesSet *pset = &pubnames_index.sets[i];
+            if (pset->cu_offset != cu_offset) continue;
+
+            uint32_t hash = symdb_hash(fname);
+            if (!pubnames_bloom_test(pset, hash)) return 1;
+
+            for (uint32_t j = pubnames_index.buckets[hash & (pubnames_index.nbuckets - 1)]; j; j = pubnames_index.chain[j - 1]) {
+                const struct PubnamesEntry *ent = &pubnames_index.entries[j - 1];
+                if (ent->set == i && ent->hash == hash && !strcmp(ent->name, fname)) return 0;
+            }
+            return 1;
+        }
+        return 0;
+    }
+
+    for (set = addrs->pubnames_begin; set < addrs->pubnames_end; set = set_end) {
+        if (!(ptr = pubnames_set_header(set, &set_end, &offset))) return 0;
+        if (offset != cu_offset) continue;
+
+        while ((ptr = pubnames_next(ptr, set_end, &die, &name)))
+            if (!strcmp(fname, name)) return 0;
+        return 1;
+    }
+
+    return 0;
+}
+
 /* Find a compilation unit, which contains given address from .debug_info section */
 static int
 info_by_address_debug_info(const struct Dwarf_Addrs *addrs, uintptr_t p, Dwarf_Off *store) {
@@ -405,11 +764,12 @@ function_by_info(const struct Dwarf_Addrs *addrs, uintptr_t p, Dwarf_Off cu_offs
     uint64_t len = 0;
     uint32_t count;
 
-    const void *entry = addrs->info_begin + cu_offset;
+    const uint8_t *cu = addrs->info_begin + cu_offset;
+    const uint8_t *entry = cu;
     entry += count = dwarf_entry_len(entry, &len);
     if (!count) return -E_BAD_DWARF;
 
-    const void *entry_end = entry + len;
+    const uint8_t *entry_end = entry + len;
 
     /* Parse compilation unit header */
     Dwarf_Half version = get_unaligned(entry, Dwarf_Half);
@@ -423,31 +783,22 @@ function_by_info(const struct Dwarf_Addrs *addrs, uintptr_t p, Dwarf_Off cu_offs
 
     /* Parse abbrev and info sections */
     uint64_t abbrev_code = 0;
-    uint64_t table_abbrev_code = 0;
-    const uint8_t *abbrev_entry = addrs->abbrev_begin + abbrev_offset;
+    struct Dwarf_Abbrevs abbrevs;
+    dwarf_index_abbrevs(addrs, addrs->abbrev_begin + abbrev_offset, &abbrevs);
 
     while (entry < entry_end) {
         /* Read info abbreviation code */
         entry += dwarf_read_uleb128(entry, &abbrev_code);
         if (!abbrev_code) continue;
 
-        const uint8_t *curr_abbrev_entry = abbrev_entry;
         uint64_t name = 0, form = 0, tag = 0;
+        bool children = 0;
+        const uint8_t *sibling = NULL;
 
         /* Find abbreviation in abbrev section */
-        /* UNSAFE Needs to be replaced */
-        while (curr_abbrev_entry < addrs->abbrev_end) {
-            curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &table_abbrev_code);
-            curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &tag);
-            curr_abbrev_entry += sizeof(Dwarf_Small);
-            if (table_abbrev_code == abbrev_code) break;
-
-            /* Skip attributes */
-            do {
-                curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &name);
-                curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &form);
-            } while (name != 0 || form != 0);
-        }
+        const uint8_t *curr_abbrev_entry = dwarf_find_abbrev(addrs, &abbrevs, abbrev_code, &tag, &children);
+        if (!curr_abbrev_entry) return -E_BAD_DWARF;
+
         /* Parse subprogram DIE */
         if (tag == DW_TAG_subprogram) {
             uintptr_t low_pc = 0, high_pc = 0;
@@ -461,6 +812,8 @@ function_by_info(const struct Dwarf_Addrs *addrs, uintptr_t p, Dwarf_Off cu_offs
                 } else if (name == DW_AT_high_pc) {
                     entry += dwarf_read_abbrev_entry(entry, form, &high_pc, sizeof(high_pc), address_size);
                     if (form != DW_FORM_addr) high_pc += low_pc;
+                } else if (name == DW_AT_sibling) {
+                    entry += dwarf_read_sibling(addrs, cu, entry, form, address_size, &sibling);
                 } else {
                     if (name == DW_AT_name) {
                         fn_name_entry = entry;
@@ -475,148 +828,136 @@ function_by_info(const struct Dwarf_Addrs *addrs, uintptr_t p, Dwarf_Off cu_offs
                 *offset = low_pc;
                 if (name_form == DW_FORM_strp) {
                     uintptr_t str_offset = 0;
-                    entry += dwarf_read_abbrev_entry(fn_name_entry, name_form, &str_offset, sizeof(uintptr_t), address_size);
-                    (void)entry;
+                    dwarf_read_abbrev_entry(fn_name_entry, name_form, &str_offset, sizeof(uintptr_t), address_size);
                     if (buf) put_unaligned((const uint8_t *)addrs->str_begin + str_offset, buf);
                 } else {
-                    entry += dwarf_read_abbrev_entry(fn_name_entry, name_form, buf, sizeof(uint8_t *), address_size);
-                    (void)entry;
+                    dwarf_read_abbrev_entry(fn_name_entry, name_form, buf, sizeof(uint8_t *), address_size);
                 }
                 return 0;
             }
         } else {
             /* Skip if not a subprogram */
-            do {
-                curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &name);
-                curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &form);
-                entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
-            } while (name || form);
+            entry = dwarf_skip_attrs(addrs, cu, curr_abbrev_entry, entry, address_size, &sibling);
         }
+
+        /* Subprograms do not nest in C, so nothing but the unit
+         * itself can have a subprogram among its children */
+        if (children && tag != DW_TAG_compile_unit)
+            entry = dwarf_skip_children(addrs, cu, &abbrevs, entry, entry_end, address_size, sibling);
     }
     return -E_NO_ENT;
 }
 
+/* Read low_pc of the subprogram DIE at 'func_offset' in the unit at 'cu_offset',
+ * 0 is stored if it is some other DIE or a declaration */
+static int
+pubnames_die_address(const struct Dwarf_Addrs *addrs, Dwarf_Off cu_offset, Dwarf_Off func_offset, uintptr_t *store) {
+    uint32_t count = 0;
+    uint64_t len = 0;
+
+    /* Parse compilation unit header */
+    const uint8_t *entry = addrs->info_begin + cu_offset;
+    const uint8_t *func_entry = entry + func_offset;
+    entry += count = dwarf_entry_len(entry, &len);
+    if (!count) return -E_BAD_DWARF;
+
+    Dwarf_Half version = get_unaligned(entry, Dwarf_Half);
+    assert(version == 4 || version == 2);
+    entry += sizeof(Dwarf_Half);
+    Dwarf_Off abbrev_offset = get_unaligned(entry, uint32_t);
+    entry += sizeof(uint32_t);
+    Dwarf_Small address_size = get_unaligned(entry, Dwarf_Small);
+    assert(address_size == sizeof(uintptr_t));
+
+    entry = func_entry;
+    uint64_t abbrev_code = 0, name = 0, form = 0, tag = 0;
+    bool children = 0;
+    entry += dwarf_read_uleb128(entry, &abbrev_code);
+
+    struct Dwarf_Abbrevs abbrevs;
+    dwarf_index_abbrevs(addrs, addrs->abbrev_begin + abbrev_offset, &abbrevs);
+    const uint8_t *abbrev_entry = dwarf_find_abbrev(addrs, &abbrevs, abbrev_code, &tag, &children);
+    if (!abbrev_entry) return -E_BAD_DWARF;
+
+    *store = 0;
+    if (tag != DW_TAG_subprogram) return 0;
+
+    /* Declarations have no DW_AT_low_pc and leave 0 */
+    do {
+        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &name);
+        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &form);
+        if (name == DW_AT_low_pc) {
+            dwarf_read_abbrev_entry(entry, form, store, sizeof(*store), address_size);
+            break;
+        }
+        entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
+    } while (name || form);
+
+    return 0;
+}
+
 int
 address_by_fname(const struct Dwarf_Addrs *addrs, const char *fname, uintptr_t *offset) {
     const int flen = strlen(fname);
     if (!flen) return -E_INVAL;
 
-    const uint8_t *pubnames_entry = addrs->pubnames_begin;
-    uint32_t count = 0;
-    uint64_t len = 0;
-    Dwarf_Off cu_offset = 0, func_offset = 0;
+    uintptr_t low_pc = 0;
+    int res;
 
-    /* parse pubnames section */
-    while (pubnames_entry < addrs->pubnames_end) {
-        count = dwarf_entry_len(pubnames_entry, &len);
-        if (!count) return -E_BAD_DWARF;
-        pubnames_entry += count;
+    /* Names that are not there, as for most of the globals
+     * bind_functions() tries, end at an empty bucket */
+    if (pubnames_index_get(addrs)) {
+        uint32_t hash = symdb_hash(fname);
+        for (uint32_t i = pubnames_index.buckets[hash & (pubnames_index.nbuckets - 1)]; i; i = pubnames_index.chain[i - 1]) {
+            const struct PubnamesEntry *ent = &pubnames_index.entries[i - 1];
+            if (ent->hash != hash || strcmp(ent->name, fname)) continue;
 
-        const uint8_t *pubnames_entry_end = pubnames_entry + len;
-        Dwarf_Half version = get_unaligned(pubnames_entry, Dwarf_Half);
+            res = pubnames_die_address(addrs, pubnames_index.sets[ent->set].cu_offset, ent->die, &low_pc);
+            if (res < 0) return res;
+            if (low_pc) {
+                *offset = low_pc;
+                return 0;
+            }
+        }
+        return -E_NO_ENT;
+    }
 
-        assert(version == 2);
-        pubnames_entry += sizeof(Dwarf_Half);
-        cu_offset = get_unaligned(pubnames_entry, uint32_t);
-        pubnames_entry += sizeof(uint32_t);
-        count = dwarf_entry_len(pubnames_entry, &len);
-        pubnames_entry += count;
-
-        while (pubnames_entry < pubnames_entry_end) {
-            func_offset = get_unaligned(pubnames_entry, uint32_t);
-            pubnames_entry += sizeof(uint32_t);
-
-            if (!func_offset) break;
-
-            if (!strcmp(fname, (const char *)pubnames_entry)) {
-                /* Parse compilation unit header */
-                const uint8_t *entry = addrs->info_begin + cu_offset;
-                const uint8_t *func_entry = entry + func_offset;
-                entry += count = dwarf_entry_len(entry, &len);
-                if (!count) return -E_BAD_DWARF;
-
-                Dwarf_Half version = get_unaligned(entry, Dwarf_Half);
-                assert(version == 4 || version == 2);
-                entry += sizeof(Dwarf_Half);
-                Dwarf_Off abbrev_offset = get_unaligned(entry, uint32_t);
-                entry += sizeof(uint32_t);
-                const uint8_t *abbrev_entry = addrs->abbrev_begin + abbrev_offset;
-                Dwarf_Small address_size = get_unaligned(entry, Dwarf_Small);
-                assert(address_size == sizeof(uintptr_t));
-
-                entry = func_entry;
-                uint64_t abbrev_code = 0, table_abbrev_code = 0;
-                entry += dwarf_read_uleb128(entry, &abbrev_code);
-                uint64_t name = 0, form = 0, tag = 0;
-
-                /* Find abbreviation in abbrev section */
-                /* UNSAFE Needs to be replaced */
-                while (abbrev_entry < addrs->abbrev_end) {
-                    abbrev_entry += dwarf_read_uleb128(abbrev_entry, &table_abbrev_code);
-                    abbrev_entry += dwarf_read_uleb128(abbrev_entry, &tag);
-                    abbrev_entry += sizeof(Dwarf_Small);
-                    if (table_abbrev_code == abbrev_code) break;
-
-                    /* skip attributes */
-                    do {
-                        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &name);
-                        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &form);
-                    } while (name || form);
-                }
-                /* Find low_pc */
-                if (tag == DW_TAG_subprogram) {
-                    /* At this point entry points to the beginning of function's DIE attributes
-                     * and abbrev_entry points to abbreviation table entry corresponding to this DIE.
-                     * Abbreviation table entry consists of pairs of unsigned LEB128 numbers, the first
-                     * encodes name of attribute and the second encodes its form. Attribute entry ends
-                     * with a pair where both name and form equal zero.
-                     * Address of a function is encoded in attribute with name DW_AT_low_pc.
-                     * To find it, we need to scan both abbreviation table and attribute values.
-                     * You can read unsigned LEB128 number using dwarf_read_uleb128 function.
-                     * Attribute value can be obtained using dwarf_read_abbrev_entry function. */
-                    // LAB 3: Your code here:
-                    uintptr_t low_pc = 0;
-
-                    do {
-                        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &name);
-                        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &form);
-
-                        if (name == DW_AT_low_pc) {
-                            entry += dwarf_read_abbrev_entry(entry, form, &low_pc, sizeof(low_pc), address_size);
-                            // if (low_pc == 0)
-                            break;
-                        } else {
-                            entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
-                        }
+    /* parse pubnames section */
+    const uint8_t *set, *set_end, *ptr;
+    Dwarf_Off cu_offset, func_offset;
+    const char *name;
 
-                    } while (name || form);
+    for (set = addrs->pubnames_begin; set < addrs->pubnames_end; set = set_end) {
+        if (!(ptr = pubnames_set_header(set, &set_end, &cu_offset))) return -E_BAD_DWARF;
 
+        while ((ptr = pubnames_next(ptr, set_end, &func_offset, &name))) {
+            if (strcmp(fname, name)) continue;
 
-                    if (low_pc) {
-                        *offset = low_pc;
-                        return 0;
-                    }
-                } else {
-                    /* Skip if not a subprogram or label */
-                    do {
-                        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &name);
-                        abbrev_entry += dwarf_read_uleb128(abbrev_entry, &form);
-                        entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
-                    } while (name || form);
-                }
+            res = pubnames_die_address(addrs, cu_offset, func_offset, &low_pc);
+            if (res < 0) return res;
+            if (low_pc) {
+                *offset = low_pc;
+                return 0;
             }
-            pubnames_entry += strlen((const char *)pubnames_entry) + 1;
         }
     }
     return -E_NO_ENT;
 }
 
+/* Tags whose children may include subprograms or labels */
+static bool
+dwarf_tag_has_code(uint64_t tag) {
+    return tag == DW_TAG_compile_unit || tag == DW_TAG_subprogram ||
+           tag == DW_TAG_lexical_block || tag == DW_TAG_namespace;
+}
+
 int
 naive_address_by_fname(const struct Dwarf_Addrs *addrs, const char *fname, uintptr_t *offset) {
     const int flen = strlen(fname);
     if (!flen) return -E_INVAL;
 
     for (const uint8_t *entry = addrs->info_begin; (const unsigned char *)entry < addrs->info_end;) {
+        const uint8_t *cu = entry;
         uint64_t len = 0;
         uint32_t count = dwarf_entry_len(entry, &len);
         entry += count;
@@ -634,9 +975,15 @@ naive_address_by_fname(const struct Dwarf_Addrs *addrs, const char *fname, uintp
         entry += sizeof(Dwarf_Small);
         assert(address_size == sizeof(uintptr_t));
 
+        /* Every named subprogram of a unit is listed in its pubnames set,
+         * labels are not, so a unit ruled out by pubnames is only
+         * searched for labels */
+        bool labels_only = dwarf_pubnames_excludes(addrs, cu - addrs->info_begin, fname);
+
         /* Parse related DIE's */
-        uint64_t abbrev_code = 0, table_abbrev_code = 0;
-        const uint8_t *abbrev_entry = addrs->abbrev_begin + abbrev_offset;
+        uint64_t abbrev_code = 0;
+        struct Dwarf_Abbrevs abbrevs;
+        dwarf_index_abbrevs(addrs, addrs->abbrev_begin + abbrev_offset, &abbrevs);
 
         while (entry < entry_end) {
             /* Read info abbreviation code */
@@ -645,22 +992,16 @@ naive_address_by_fname(const struct Dwarf_Addrs *addrs, const char *fname, uintp
             if (!abbrev_code) continue;
 
             /* Find abbreviation in abbrev section */
-            /* UNSAFE, Needs to be replaced */
-            const uint8_t *curr_abbrev_entry = abbrev_entry;
             uint64_t name = 0, form = 0, tag = 0;
-            while ((const unsigned char *)curr_abbrev_entry < addrs->abbrev_end) {
-                curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &table_abbrev_code);
-                curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &tag);
-                curr_abbrev_entry += sizeof(Dwarf_Small);
-                if (table_abbrev_code == abbrev_code) break;
+            bool children = 0;
+            const uint8_t *sibling = NULL;
+            const uint8_t *curr_abbrev_entry = dwarf_find_abbrev(addrs, &abbrevs, abbrev_code, &tag, &children);
+            if (!curr_abbrev_entry) return -E_BAD_DWARF;
+
+            /* Types, variables, parameters and the like
+             * never contain subprograms or labels */
+            bool skip = !dwarf_tag_has_code(tag);
 
-                /* skip attributes */
-                do {
-                    curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &name);
-                    curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &form);
-                } while (name || form);
-            }
-            /* parse subprogram or label DIE */
             if (tag == DW_TAG_subprogram || tag == DW_TAG_label) {
                 uintptr_t low_pc = 0;
                 bool found = 0;
@@ -669,6 +1010,10 @@ naive_address_by_fname(const struct Dwarf_Addrs *addrs, const char *fname, uintp
                     curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &form);
                     if (name == DW_AT_low_pc) {
                         entry += dwarf_read_abbrev_entry(entry, form, &low_pc, sizeof(low_pc), address_size);
+                    } else if (name == DW_AT_sibling) {
+                        entry += dwarf_read_sibling(addrs, cu, entry, form, address_size, &sibling);
+                    } else if (name == DW_AT_name && tag == DW_TAG_subprogram && labels_only) {
+                        entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
                     } else if (name == DW_AT_name) {
                         if (form == DW_FORM_strp) {
                             uint64_t str_offset = 0;
@@ -686,14 +1031,16 @@ naive_address_by_fname(const struct Dwarf_Addrs *addrs, const char *fname, uintp
                     *offset = low_pc;
                     return 0;
                 }
+                /* Declarations and abstract instances have
+                 * no code, so they cannot hold a label either */
+                if (!low_pc) skip = 1;
             } else {
                 /* Skip if not a subprogram or label */
-                do {
-                    curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &name);
-                    curr_abbrev_entry += dwarf_read_uleb128(curr_abbrev_entry, &form);
-                    entry += dwarf_read_abbrev_entry(entry, form, NULL, 0, address_size);
-                } while (name || form);
+                entry = dwarf_skip_attrs(addrs, cu, curr_abbrev_entry, entry, address_size, &sibling);
             }
+
+            if (children && skip)
+                entry = dwarf_skip_children(addrs, cu, &abbrevs, entry, entry_end, address_size, sibling);
         }
     }
 
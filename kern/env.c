@@ -13,27 +13,110 @@
 #include <kern/kdebug.h>
 #include <kern/macro.h>
 #include <kern/traceopt.h>
+#include <kern/vsyscall.h>
+#include <kern/magazine.h>
+#include <kern/pgfault.h>
+#include <kern/filemap.h>
+#include <kern/numa.h>
+#include <kern/cpu.h>
+#include <kern/kmalloc.h>
+#include <kern/klog.h>
+#include <kern/workq.h>
+#include <kern/timer.h>
 
 /* Currently active environment */
 struct Env *curenv = NULL;
 
 #ifdef CONFIG_KSPACE
 /* All environments */
-struct Env env_array[NENV];
+struct Env env_array[NENV] __attribute__((aligned(PAGE_SIZE)));
 struct Env *envs = env_array;
 #else
 /* All environments */
 struct Env *envs = NULL;
 #endif
 
+/* Per-env records published at UENVSTATS */
+static struct EnvStat env_stat_array[NENV] __attribute__((aligned(PAGE_SIZE)));
+struct EnvStat *env_stats = env_stat_array;
+
+void map_page_early_boot(uintptr_t va, uintptr_t pa, uint64_t perm);
+
 /* Free environment list
  * (linked by Env->env_link) */
 static struct Env *env_free_list;
+static struct spinlock env_free_lock;
+
+/* Per-CPU caches of free Env structures in front of env_free_list */
+static struct MagCache env_cache;
 
 
 /* NOTE: Should be at least LOGNENV */
 #define ENVGENSHIFT 12
 
+/* Kernel space programs run on stacks from the kernel heap */
+#define ENV_STACK_SIZE (2 * PAGE_SIZE)
+
+/* Programs created at boot keep the 64KiB slots from 16MiB they were
+ * linked for before they became position independent, in creation
+ * order, so debuggers and grade-lab3 find them at fixed addresses.
+ * The range is reserved by page_init() and slots are never reused.
+ * Images that don't fit a slot, or come after the last one, are
+ * loaded into the kernel heap */
+#define ENV_BOOT_IMAGE_BASE 0x1000000
+#define ENV_BOOT_IMAGE_SLOT 0x10000
+#define ENV_BOOT_IMAGE_END  0x2000000
+
+static uintptr_t env_boot_image_next = ENV_BOOT_IMAGE_BASE;
+
+/* A stack can't be freed while it is in use, which is the case when an
+ * environment is destroyed from a trap taken on its own stack.
+ * It is parked here until the next stack is freed on this CPU */
+static uint8_t *env_stack_parked[NCPU];
+
+/* Destroyed environments are freed as deferred work */
+static struct Work env_free_work[NENV];
+
+/* Wakes environments up from sys_sleep() */
+static struct Timer env_sleep_timers[NENV];
+
+/* Global descriptor table.
+ *
+ * Set up global descriptor table (GDT) with separate segments for
+ * kernel mode and user mode.  Segments serve many purposes on the x86.
+ * We don't use any of their memory-mapping capabilities, but we need
+ * them to switch privilege levels.
+ *
+ * The kernel and user segments are identical except for the DPL.
+ * To load the SS register, the CPL must equal the DPL.  Thus,
+ * we must duplicate the segments for the user and the kernel.
+ *
+ * The 32-bit kernel segments are used by efi_call_in_32bit_mode().
+ *
+ * The last slots hold the 64-bit TSS descriptor of every CPU,
+ * which is twice the size of a regular descriptor. */
+struct Segdesc32 gdt[2 * NCPU + 7] = {
+        /* 0x0 - unused (always faults -- for trapping NULL far pointers) */
+        SEG_NULL,
+        /* 0x8 - kernel code segment */
+        [GD_KT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 0),
+        /* 0x10 - kernel data segment */
+        [GD_KD >> 3] = SEG64(STA_W, 0x0, 0xFFFFFFFF, 0),
+        /* 0x18 - kernel code segment 32bit */
+        [GD_KT32 >> 3] = SEG32(STA_X | STA_R, 0x0, 0xFFFFFFFF, 0),
+        /* 0x20 - kernel data segment 32bit */
+        [GD_KD32 >> 3] = SEG32(STA_W, 0x0, 0xFFFFFFFF, 0),
+        /* 0x28 - user code segment */
+        [GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 3),
+        /* 0x30 - user data segment */
+        [GD_UD >> 3] = SEG64(STA_W, 0x0, 0xFFFFFFFF, 3),
+        /* Per-CPU TSS descriptors (starting from GD_TSS0) are initialized
+         * in trap_init_percpu() */
+        [GD_TSS0 >> 3] = SEG_NULL,
+        [6 + NCPU * 2] = SEG_NULL};
+
+struct Pseudodesc gdt_pd = {sizeof(gdt) - 1, (unsigned long)gdt};
+
 /* Converts an envid to an env pointer.
  * If checkperm is set, the specified environment must be either the
  * current environment or an immediate child of the current environment.
@@ -77,6 +160,41 @@ envid2env(envid_t envid, struct Env **env_store, bool need_check_perm) {
     return 0;
 }
 
+/* Map envs[] and env_stats[] read-only at UENVS */
+static void
+env_map_readonly(void) {
+    static_assert(NENV * sizeof(struct Env) <= UENVSTATS - UENVS, "envs[] does not fit UENVS");
+    static_assert(NENV * sizeof(struct EnvStat) <= UENVS + UENVS_SIZE - UENVSTATS, "env_stats[] does not fit UENVS");
+
+#ifdef CONFIG_KSPACE
+    for (size_t off = 0; off < NENV * sizeof(struct Env); off += PAGE_SIZE)
+        map_page_early_boot(UENVS + off, (uintptr_t)envs + off - KERN_BASE_ADDR, PTE_P | PTE_U);
+#endif
+
+    for (size_t off = 0; off < NENV * sizeof(struct EnvStat); off += PAGE_SIZE)
+        map_page_early_boot(UENVSTATS + off, (uintptr_t)env_stats + off - KERN_BASE_ADDR, PTE_P | PTE_U);
+}
+
+/* Backing allocator of env_cache */
+static void *
+env_free_list_get(void *arg) {
+    spin_lock(&env_free_lock);
+    struct Env *env = env_free_list;
+    if (env) env_free_list = env->env_link;
+    spin_unlock(&env_free_lock);
+    return env;
+}
+
+static void
+env_free_list_put(void *arg, void *obj) {
+    struct Env *env = obj;
+
+    spin_lock(&env_free_lock);
+    env->env_link = env_free_list;
+    env_free_list = env;
+    spin_unlock(&env_free_lock);
+}
+
 /* Mark all environments in 'envs' as free, set their env_ids to 0,
  * and insert them into the env_free_list.
  * Make sure the environments are in the free list in the same order
@@ -101,6 +219,64 @@ env_init(void) {
     envs[i].env_id = 0;
     envs[i].env_status = ENV_FREE;
     envs[i].env_link = NULL;
+
+    mag_cache_init(&env_cache, "env", env_free_list_get, env_free_list_put, NULL);
+
+    env_map_readonly();
+
+    /* Per-CPU part of the initialization */
+    env_init_percpu();
+}
+
+/* Publish the current state of env in its EnvStat record.
+ * Must be called after every change of env_status */
+void
+env_stat_update(struct Env *env) {
+    struct EnvStat *es = &env_stats[env - envs];
+    uint64_t now = read_tsc();
+
+    es->es_seq++;
+    asm volatile("" ::: "memory");
+
+    es->es_id = env->env_id;
+    es->es_status = env->env_status;
+    es->es_runs = env->env_runs;
+    if (es->es_started) es->es_cputime += now - es->es_started;
+    es->es_started = env->env_status == ENV_RUNNING ? now : 0;
+    if (env->env_status == ENV_FREE) es->es_cputime = 0;
+
+    asm volatile("" ::: "memory");
+    es->es_seq++;
+}
+
+/* Load GDT and segment descriptors */
+void
+env_init_percpu(void) {
+    lgdt(&gdt_pd);
+
+    /* The kernel never uses GS or FS,
+     * so we leave those set to the user data segment
+     *
+     * For good measure, clear the local descriptor table (LDT),
+     * since we don't use it */
+    asm volatile("movw %%ax,%%gs" ::"a"(GD_UD | 3));
+    asm volatile("movw %%ax,%%fs" ::"a"(GD_UD | 3));
+
+    /* The kernel does use ES, DS, and SS.  We'll change between
+     * the kernel and user data segments as needed */
+    asm volatile("movw %%ax,%%es" ::"a"(GD_KD));
+    asm volatile("movw %%ax,%%ds" ::"a"(GD_KD));
+    asm volatile("movw %%ax,%%ss" ::"a"(GD_KD));
+
+    /* Load the kernel text segment into CS */
+    asm volatile("pushq %%rbx\n"
+                 "movabs $1f, %%rax\n"
+                 "pushq %%rax\n"
+                 "lretq\n"
+                 "1:\n" ::"b"(GD_KT)
+                 : "rax", "cc", "memory");
+
+    lldt(0);
 }
 
 /* Allocates and initializes a new environment.
@@ -116,9 +292,19 @@ int
 env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
 
     struct Env *env;
-    if (!(env = env_free_list))
+    if (!(env = mag_alloc(&env_cache)))
         return -E_NO_FREE_ENV;
 
+    /* Memory of the env is placed on the node it starts on */
+    env->env_node = numa_cpu_node(cpunum());
+#ifdef CONFIG_KSPACE
+    if (!(env->stack = kmalloc_node(ENV_STACK_SIZE, env->env_node))) {
+        mag_free(&env_cache, env);
+        return -E_NO_MEM;
+    }
+#endif
+    env->image = NULL;
+
     /* Generate an env_id for this environment */
     int32_t generation = (env->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
     /* Don't create a negative env_id */
@@ -134,6 +320,8 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
 #endif
     env->env_status = ENV_RUNNABLE;
     env->env_runs = 0;
+    env_stat_update(env);
+    pgfault_env_reset(env->env_id);
 
     /* Clear out all the saved register state,
      * to prevent the register values
@@ -157,12 +345,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
     env->env_tf.tf_cs = GD_KT;
 
     // LAB 3: Your code here:
-    static uintptr_t stack_top = 0x2000000;
-
-    env->env_tf.tf_rsp = stack_top;
-
-    stack_top += 2 * PAGE_SIZE;
-
+    env->env_tf.tf_rsp = (uintptr_t)env->stack + ENV_STACK_SIZE;
 #else
     env->env_tf.tf_ds = GD_UD | 3;
     env->env_tf.tf_es = GD_UD | 3;
@@ -171,22 +354,63 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
     env->env_tf.tf_rsp = USER_STACK_TOP;
 #endif
 
-    /* Commit the allocation */
-    env_free_list = env->env_link;
     *newenv_store = env;
 
-    if (trace_envs) cprintf("[%08x] new env %08x\n", curenv ? curenv->env_id : 0, env->env_id);
+    if (trace_envs && type != ENV_TYPE_IDLE) cprintf("[%08x] new env %08x\n", curenv ? curenv->env_id : 0, env->env_id);
     return 0;
 }
 
 
+/* Allocates an idle environment. It runs 'entry' in kernel mode,
+ * with interrupts disabled, on a stack of its own */
+int
+env_alloc_idle(struct Env **newenv_store, void (*entry)(void)) {
+    struct Env *env;
+    int res = env_alloc(&env, 0, ENV_TYPE_IDLE);
+    if (res < 0) return res;
+
+#ifndef CONFIG_KSPACE
+    if (!(env->stack = kmalloc_node(ENV_STACK_SIZE, env->env_node))) {
+        env_free(env);
+        return -E_NO_MEM;
+    }
+#endif
+
+    env->env_type = ENV_TYPE_IDLE;
+    env->env_tf.tf_ds = GD_KD;
+    env->env_tf.tf_es = GD_KD;
+    env->env_tf.tf_ss = GD_KD;
+    env->env_tf.tf_cs = GD_KT;
+    env_idle_reset(env, entry);
+
+    *newenv_store = env;
+    return 0;
+}
+
+/* Makes the next run of idle environment 'env' start 'entry' from the
+ * top of its stack. Idle environments are never saved, and env_pop_tf()
+ * moves the saved stack pointer, so this is done before every run */
+void
+env_idle_reset(struct Env *env, void (*entry)(void)) {
+    assert(env->env_type == ENV_TYPE_IDLE);
+
+    env->env_tf.tf_rflags = 0;
+    env->env_tf.tf_rip = (uintptr_t)entry;
+
+    /* As if 'entry' was called, with a zero return address */
+    uintptr_t *top = (uintptr_t *)(env->stack + ENV_STACK_SIZE);
+    top[-1] = 0;
+    env->env_tf.tf_rsp = (uintptr_t)&top[-1];
+}
+
 /* Pass the original ELF image to binary/size and bind all the symbols within
  * its loaded address space specified by image_start/image_end.
+ * Symbol values are link addresses, 'base' is added to get load addresses.
  * Make sure you understand why you need to check that each binding
  * must be performed within the image_start/image_end range.
  */
 static int
-bind_functions(struct Env *env, uint8_t *binary, size_t size, uintptr_t image_start, uintptr_t image_end) {
+bind_functions(struct Env *env, uint8_t *binary, size_t size, uintptr_t base, uintptr_t image_start, uintptr_t image_end) {
     // LAB 3: Your code here:
 
     /* NOTE: find_function from kdebug.c should be used */
@@ -238,8 +462,8 @@ bind_functions(struct Env *env, uint8_t *binary, size_t size, uintptr_t image_st
         if (kernFuncAddr == 0)
             continue;
 
-        UINT64 varAddr = symbTab[i].st_value;
-        if (varAddr < image_start || varAddr > image_end)
+        UINT64 varAddr = base + symbTab[i].st_value;
+        if (varAddr < image_start || varAddr + sizeof(uintptr_t) > image_end)
             return -E_INVALID_EXE;
 
         *((uintptr_t *)varAddr) = kernFuncAddr;
@@ -248,6 +472,106 @@ bind_functions(struct Env *env, uint8_t *binary, size_t size, uintptr_t image_st
     return 0;
 }
 
+/* Checks that [addr, addr + size) lies within the loaded image */
+static bool
+image_contains(uintptr_t image_start, uintptr_t image_end, uintptr_t addr, size_t size) {
+    return addr >= image_start && addr <= image_end && size <= image_end - addr;
+}
+
+/* Applies the dynamic relocations of an image loaded 'base' bytes above
+ * its link address, DT_RELA and DT_JMPREL tables are processed in a single
+ * pass each. Programs are static PIEs without a dynamic linker, so every
+ * symbol a relocation refers to must be defined in the image itself */
+static int
+elf_relocate(const struct Proghdr *phdrs, size_t phnum, uintptr_t base, uintptr_t image_start, uintptr_t image_end) {
+    const struct Proghdr *dynPhdr = NULL;
+    for (size_t i = 0; i < phnum; i++)
+        if (phdrs[i].p_type == PT_DYNAMIC) dynPhdr = &phdrs[i];
+    if (!dynPhdr) return 0;
+
+    uintptr_t dynAddr = base + dynPhdr->p_va;
+    if (!image_contains(image_start, image_end, dynAddr, dynPhdr->p_memsz))
+        return -E_INVALID_EXE;
+
+    const struct Elf64_Dyn *dyn = (const struct Elf64_Dyn *)dynAddr;
+    size_t ndyn = dynPhdr->p_memsz / sizeof(*dyn);
+
+    uintptr_t rela = 0, jmprel = 0, symtab = 0;
+    size_t relasz = 0, pltrelsz = 0;
+    size_t relaent = sizeof(struct Elf64_Rela), syment = sizeof(struct Elf64_Sym);
+
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        switch (dyn[i].d_tag) {
+        case DT_RELA: rela = dyn[i].d_val; break;
+        case DT_RELASZ: relasz = dyn[i].d_val; break;
+        case DT_RELAENT: relaent = dyn[i].d_val; break;
+        case DT_JMPREL: jmprel = dyn[i].d_val; break;
+        case DT_PLTRELSZ: pltrelsz = dyn[i].d_val; break;
+        case DT_SYMTAB: symtab = dyn[i].d_val; break;
+        case DT_SYMENT: syment = dyn[i].d_val; break;
+        case DT_PLTREL:
+            if (dyn[i].d_val != DT_RELA) return -E_INVALID_EXE;
+            break;
+        }
+    }
+    if (relaent != sizeof(struct Elf64_Rela) || syment != sizeof(struct Elf64_Sym))
+        return -E_INVALID_EXE;
+
+    const struct {
+        uintptr_t addr;
+        size_t size;
+    } tables[] = {{rela, relasz}, {jmprel, pltrelsz}};
+
+    for (size_t t = 0; t < sizeof(tables) / sizeof(*tables); t++) {
+        if (!tables[t].size) continue;
+
+        uintptr_t tableAddr = base + tables[t].addr;
+        if (!image_contains(image_start, image_end, tableAddr, tables[t].size))
+            return -E_INVALID_EXE;
+
+        const struct Elf64_Rela *relas = (const struct Elf64_Rela *)tableAddr;
+        size_t nrelas = tables[t].size / sizeof(*relas);
+
+        for (size_t i = 0; i < nrelas; i++) {
+            uintptr_t where = base + relas[i].r_offset;
+            if (!image_contains(image_start, image_end, where, sizeof(uint64_t)))
+                return -E_INVALID_EXE;
+
+            UINT64 type = ELF64_R_TYPE(relas[i].r_info);
+            uint64_t value;
+
+            switch (type) {
+            case R_X86_64_NONE:
+                continue;
+            case R_X86_64_RELATIVE:
+                value = base + relas[i].r_addend;
+                break;
+            case R_X86_64_64:
+            case R_X86_64_GLOB_DAT:
+            case R_X86_64_JUMP_SLOT: {
+                uintptr_t symAddr = base + symtab + ELF64_R_SYM(relas[i].r_info) * sizeof(struct Elf64_Sym);
+                if (!symtab || !image_contains(image_start, image_end, symAddr, sizeof(struct Elf64_Sym)))
+                    return -E_INVALID_EXE;
+
+                const struct Elf64_Sym *sym = (const struct Elf64_Sym *)symAddr;
+                if (sym->st_shndx == ELF_SHN_UNDEF)
+                    return -E_INVALID_EXE;
+
+                value = (sym->st_shndx == ELF_SHN_ABS ? 0 : base) + sym->st_value;
+                if (type == R_X86_64_64) value += relas[i].r_addend;
+                break;
+            }
+            default:
+                return -E_INVALID_EXE;
+            }
+
+            *(uint64_t *)where = value;
+        }
+    }
+
+    return 0;
+}
+
 /* Set up the initial program binary, stack, and processor flags
  * for a user process.
  * This function is ONLY called during kernel initialization,
@@ -295,39 +619,79 @@ load_icode(struct Env *env, uint8_t *binary, size_t size) {
 
     const struct Elf *ElfHeader = (const struct Elf *)binary;
 
-    if (ElfHeader->e_magic != ELF_MAGIC) {
+    if (size < sizeof(*ElfHeader) || ElfHeader->e_magic != ELF_MAGIC) {
+        return -E_INVALID_EXE;
+    }
+    if (ElfHeader->e_type != ET_EXEC && ElfHeader->e_type != ET_DYN) {
+        return -E_INVALID_EXE;
+    }
+    if (ElfHeader->e_phoff > size || ElfHeader->e_phnum > (size - ElfHeader->e_phoff) / sizeof(struct Proghdr)) {
         return -E_INVALID_EXE;
     }
-
-    uintptr_t image_start = 0, image_end = 0;
 
     const struct Proghdr *phdrs = (const struct Proghdr *)(binary + ElfHeader->e_phoff);
 
+    /* Link address range of all loadable segments */
+    uintptr_t link_start = (uintptr_t)-1, link_end = 0;
+
+    for (size_t i = 0; i < ElfHeader->e_phnum; i++) {
+        const struct Proghdr *currPhdr = phdrs + i;
+
+        if (currPhdr->p_type != ELF_PROG_LOAD) continue;
+
+        if (currPhdr->p_filesz > currPhdr->p_memsz ||
+            currPhdr->p_offset > size || currPhdr->p_filesz > size - currPhdr->p_offset ||
+            currPhdr->p_va + currPhdr->p_memsz < currPhdr->p_va)
+            return -E_INVALID_EXE;
+
+        link_start = MIN(link_start, (uintptr_t)currPhdr->p_va);
+        link_end = MAX(link_end, (uintptr_t)(currPhdr->p_va + currPhdr->p_memsz));
+    }
+    if (link_start >= link_end) return -E_INVALID_EXE;
+
+    /* Position independent programs go to the next boot slot or to a
+     * fresh heap allocation, so any number of them can be loaded at once.
+     * Everything else is loaded at its link address */
+    uintptr_t base = 0;
+    if (ElfHeader->e_type == ET_DYN) {
+        link_start = ROUNDDOWN(link_start, PAGE_SIZE);
+        size_t image_size = ROUNDUP(link_end - link_start, PAGE_SIZE);
+
+        uintptr_t image;
+        if (image_size <= ENV_BOOT_IMAGE_SLOT && env_boot_image_next < ENV_BOOT_IMAGE_END) {
+            image = env_boot_image_next;
+            env_boot_image_next += ENV_BOOT_IMAGE_SLOT;
+        } else {
+            if (!(env->image = kmalloc_node(image_size, env->env_node))) return -E_NO_MEM;
+            image = (uintptr_t)env->image;
+        }
+        base = image - link_start;
+    }
+
     for (size_t i = 0; i < ElfHeader->e_phnum; i++) {
 
         const struct Proghdr *currPhdr = phdrs + i;
 
         if (currPhdr->p_type != ELF_PROG_LOAD) continue;
 
-        void *p_va = (void *)currPhdr->p_va;
+        void *p_va = (void *)(base + currPhdr->p_va);
 
         memcpy(p_va, binary + currPhdr->p_offset, (size_t)currPhdr->p_filesz);
 
         size_t segToZero = currPhdr->p_memsz - currPhdr->p_filesz;
         memset(p_va + currPhdr->p_filesz, 0, segToZero);
+    }
 
-        if (image_start > (uintptr_t)p_va || image_start == 0)
-            image_start = (uintptr_t)p_va;
+    uintptr_t image_start = base + link_start, image_end = base + link_end;
 
-        if (image_end < (uintptr_t)p_va + currPhdr->p_memsz || image_end == 0)
-            image_end = (uintptr_t)p_va + currPhdr->p_memsz;
-    }
+    if (elf_relocate(phdrs, ElfHeader->e_phnum, base, image_start, image_end) < 0)
+        return -E_INVALID_EXE;
 
-    if (bind_functions(env, binary, size, image_start, image_end) < 0)
+    if (bind_functions(env, binary, size, base, image_start, image_end) < 0)
         return -E_INVALID_EXE;
 
     env->binary = binary;
-    env->env_tf.tf_rip = (uintptr_t)ElfHeader->e_entry;
+    env->env_tf.tf_rip = base + (uintptr_t)ElfHeader->e_entry;
 
     return 0;
 }
@@ -356,6 +720,43 @@ env_create(uint8_t *binary, size_t size, enum EnvType type) {
 }
 
 
+/* Moves the memory of 'env' to 'node' it is about to run on.
+ * Boot slot images have fixed addresses and stay where they are,
+ * as does a stack we are running on */
+static void
+env_migrate(struct Env *env, int node) {
+    uintptr_t rsp = read_rsp();
+    size_t moved = 0;
+
+    if (env->stack && (rsp < (uintptr_t)env->stack || rsp >= (uintptr_t)env->stack + ENV_STACK_SIZE))
+        moved += kmalloc_migrate(env->stack, node);
+    if (env->image) moved += kmalloc_migrate(env->image, node);
+
+    env->env_node = node;
+    numa_migrations++;
+    numa_migrated_pages += moved;
+}
+
+/* Frees a kernel space program stack, or parks it
+ * if it is the stack we are currently running on */
+static void
+env_stack_free(uint8_t *stack) {
+    uintptr_t rsp = read_rsp();
+    uint8_t **parked = &env_stack_parked[cpunum()];
+
+    if (*parked && (rsp < (uintptr_t)*parked || rsp >= (uintptr_t)*parked + ENV_STACK_SIZE)) {
+        kfree(*parked);
+        *parked = NULL;
+    }
+
+    if (stack && rsp >= (uintptr_t)stack && rsp < (uintptr_t)stack + ENV_STACK_SIZE) {
+        assert(!*parked);
+        *parked = stack;
+    } else {
+        kfree(stack);
+    }
+}
+
 /* Frees env and all memory it uses */
 void
 env_free(struct Env *env) {
@@ -363,10 +764,22 @@ env_free(struct Env *env) {
     /* Note the environment's demise. */
     if (trace_envs) cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, env->env_id);
 
+    filemap_env_exit(env->env_id);
+
+    kfree(env->image);
+    env->image = NULL;
+    env_stack_free(env->stack);
+    env->stack = NULL;
+
     /* Return the environment to the free list */
     env->env_status = ENV_FREE;
-    env->env_link = env_free_list;
-    env_free_list = env;
+    env_stat_update(env);
+    mag_free(&env_cache, env);
+}
+
+static void
+env_free_deferred(struct Work *work) {
+    env_free(work->arg);
 }
 
 /* Frees environment env
@@ -382,7 +795,17 @@ env_destroy(struct Env *env) {
 
     // LAB 3: Your code here
 
-    env_free(env);
+    /* The environment stops being runnable right away, its memory is
+     * released by deferred work when the scheduler is entered next */
+    if (env->env_status != ENV_DYING) {
+        timer_cancel(&env_sleep_timers[env - envs]);
+        env->env_status = ENV_DYING;
+        env_stat_update(env);
+
+        struct Work *work = &env_free_work[env - envs];
+        work_init(work, env_free_deferred, env);
+        work_queue(work);
+    }
 
     if (env == curenv)
         sched_yield();
@@ -400,6 +823,35 @@ csys_yield(struct Trapframe *tf) {
     memcpy(&curenv->env_tf, tf, sizeof(struct Trapframe));
     sched_yield();
 }
+
+static void
+env_sleep_wake(struct Timer *timer) {
+    struct Env *env = timer->arg;
+
+    if (env->env_status == ENV_NOT_RUNNABLE) {
+        env->env_status = ENV_RUNNABLE;
+        env_stat_update(env);
+    }
+}
+
+/* Sleeps for at least the number of nanoseconds passed
+ * to sys_sleep(), found in saved %rdi */
+void
+csys_sleep(struct Trapframe *tf) {
+    memcpy(&curenv->env_tf, tf, sizeof(struct Trapframe));
+
+    uint64_t ns = tf->tf_regs.reg_rdi;
+    if (ns) {
+        struct Timer *timer = &env_sleep_timers[curenv - envs];
+        timer_setup(timer, env_sleep_wake, curenv);
+        timer_arm(timer, ns, TIMER_SLACK_DEFAULT);
+
+        curenv->env_status = ENV_NOT_RUNNABLE;
+        env_stat_update(curenv);
+    }
+
+    sched_yield();
+}
 #endif
 
 /* Restores the register values in the Trapframe with the 'ret' instruction.
@@ -470,10 +922,13 @@ _Noreturn void
 env_run(struct Env *env) {
     assert(env);
 
+    /* Idle environments are not traced, they come and go all the time */
     if (trace_envs_more) {
         const char *state[] = {"FREE", "DYING", "RUNNABLE", "RUNNING", "NOT_RUNNABLE"};
-        if (curenv) cprintf("[%08X] env stopped: %s\n", curenv->env_id, state[curenv->env_status]);
-        cprintf("[%08X] env started: %s\n", env->env_id, state[env->env_status]);
+        if (curenv && curenv->env_type != ENV_TYPE_IDLE)
+            cprintf("[%08X] env stopped: %s\n", curenv->env_id, state[curenv->env_status]);
+        if (env->env_type != ENV_TYPE_IDLE)
+            cprintf("[%08X] env started: %s\n", env->env_id, state[env->env_status]);
     }
 
     // LAB 3: Your code here
@@ -481,11 +936,21 @@ env_run(struct Env *env) {
     if (curenv != NULL) {
         if (curenv->env_status == ENV_RUNNING)
             curenv->env_status = ENV_RUNNABLE;
+        env_stat_update(curenv);
     }
 
+    int node = numa_cpu_node(cpunum());
+    if (env->env_node != node) env_migrate(env, node);
+
+    klog("[%08x] env run %u on cpu %d\n", env->env_id, env->env_runs + 1, cpunum());
+
     curenv = env;
     curenv->env_status = ENV_RUNNING;
     curenv->env_runs++;
+    env_stat_update(curenv);
+
+    vsys[VSYS_envid] = curenv->env_type == ENV_TYPE_IDLE ? 0 : curenv->env_id;
+    vsys[VSYS_env_switches]++;
 
     env_pop_tf(&curenv->env_tf);
 
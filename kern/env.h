@@ -11,13 +11,19 @@
 extern struct Env *envs;
 /* Currently active environment */
 extern struct Env *curenv;
+/* Records mirrored at UENVSTATS, indexed like envs */
+extern struct EnvStat *env_stats;
 extern struct Segdesc32 gdt[];
 
 void env_init(void);
+void env_init_percpu(void);
 int env_alloc(struct Env **penv, envid_t parent_id, enum EnvType type);
+int env_alloc_idle(struct Env **penv, void (*entry)(void));
+void env_idle_reset(struct Env *env, void (*entry)(void));
 void env_free(struct Env *env);
 void env_create(uint8_t *binary, size_t size, enum EnvType type);
 void env_destroy(struct Env *env);
+void env_stat_update(struct Env *env);
 
 int envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 _Noreturn void env_run(struct Env *e);
@@ -26,6 +32,7 @@ _Noreturn void env_pop_tf(struct Trapframe *tf);
 #ifdef CONFIG_KSPACE
 extern void sys_exit(void);
 extern void sys_yield(void);
+extern void sys_sleep(uint64_t ns);
 #endif
 
 /* Without this extra macro, we couldn't pass macros like TEST to
@@ -0,0 +1,278 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/memlayout.h>
+#include <inc/string.h>
+
+#include <kern/filemap.h>
+#include <kern/kmalloc.h>
+#include <kern/pgfault.h>
+#include <kern/pmap.h>
+#include <kern/traceopt.h>
+
+#define FILEMAP_MAX_PROVIDERS 4
+#define FILEMAP_MAX_BLOBS     16
+#define PAGECACHE_BUCKETS     256
+
+static_assert((uint64_t)MAXOPEN * FILE_WINDOW_SIZE <= KERN_BASE_ADDR - FILE_BASE, "File windows overlap the kernel");
+
+static const struct FileProvider *providers[FILEMAP_MAX_PROVIDERS];
+
+/* Page cache, pages stay cached after their last mapping
+ * is gone until memory runs short */
+struct PageCacheEntry {
+    struct PageCacheEntry *next;
+    const struct FileProvider *prov;
+    uint64_t id;
+    size_t pgoff;
+    physaddr_t pa;
+    uint32_t maps; /* Number of windows the page is mapped in */
+};
+
+static struct PageCacheEntry *pagecache[PAGECACHE_BUCKETS];
+
+/* Open file windows, slot i is mapped at FILE_BASE + i * FILE_WINDOW_SIZE */
+struct FileMap {
+    const struct FileProvider *prov; /* NULL if the slot is free */
+    uint64_t id;
+    size_t size;
+    envid_t owner;
+    size_t ra_next;   /* Page a sequential reader faults on next */
+    size_t ra_window; /* Pages mapped by the last fault */
+};
+
+static struct FileMap filemaps[MAXOPEN];
+
+static struct FilemapStats filemap_stats;
+
+static size_t
+pagecache_hash(const struct FileProvider *prov, uint64_t id, size_t pgoff) {
+    uint64_t key = ((uintptr_t)prov ^ (id << 32) ^ pgoff) * 0x9E3779B97F4A7C15ULL;
+    return key >> 56;
+}
+
+static struct PageCacheEntry *
+pagecache_lookup(const struct FileProvider *prov, uint64_t id, size_t pgoff) {
+    struct PageCacheEntry *ent = pagecache[pagecache_hash(prov, id, pgoff)];
+    while (ent && (ent->prov != prov || ent->id != id || ent->pgoff != pgoff)) ent = ent->next;
+    return ent;
+}
+
+/* Drop all cached pages that are not mapped anywhere */
+static size_t
+pagecache_reclaim(void) {
+    size_t freed = 0;
+
+    for (size_t i = 0; i < PAGECACHE_BUCKETS; i++) {
+        for (struct PageCacheEntry **pent = &pagecache[i]; *pent;) {
+            struct PageCacheEntry *ent = *pent;
+            if (ent->maps) {
+                pent = &ent->next;
+                continue;
+            }
+
+            *pent = ent->next;
+            page_free(ent->pa);
+            kfree(ent);
+            freed++;
+        }
+    }
+
+    filemap_stats.cached -= freed;
+    filemap_stats.reclaimed += freed;
+    return freed;
+}
+
+/* Find page 'pgoff' of a file in the cache, reading it in if needed */
+static struct PageCacheEntry *
+pagecache_get(const struct FileProvider *prov, uint64_t id, size_t pgoff) {
+    struct PageCacheEntry *ent = pagecache_lookup(prov, id, pgoff);
+    if (ent) {
+        filemap_stats.hits++;
+        return ent;
+    }
+
+    physaddr_t pa = page_alloc(0);
+    if (!pa && pagecache_reclaim()) pa = page_alloc(0);
+    if (!pa) return NULL;
+
+    if (!(ent = kmalloc(sizeof(*ent))) || prov->read_page(id, pgoff, KADDR(pa)) < 0) {
+        kfree(ent);
+        page_free(pa);
+        return NULL;
+    }
+
+    size_t bucket = pagecache_hash(prov, id, pgoff);
+    *ent = (struct PageCacheEntry){pagecache[bucket], prov, id, pgoff, pa, 0};
+    pagecache[bucket] = ent;
+
+    filemap_stats.cached++;
+    filemap_stats.misses++;
+    return ent;
+}
+
+/* Map the faulting page and, for sequential readers, a growing
+ * number of pages after it, so that a scan takes few faults */
+static int
+filemap_fault(struct PfRegion *region, uintptr_t va, uint64_t err) {
+    struct FileMap *fm = region->arg;
+    if (err & FEC_W) return -E_INVAL;
+
+    size_t pgoff = (va - region->start) / PAGE_SIZE;
+    size_t npages = (region->end - region->start) / PAGE_SIZE;
+
+    fm->ra_window = pgoff == fm->ra_next ? MIN(fm->ra_window * 2, FILEMAP_RA_MAX) : FILEMAP_RA_MIN;
+    size_t end = MIN(pgoff + fm->ra_window, npages);
+    fm->ra_next = end;
+
+    for (size_t pg = pgoff; pg < end; pg++) {
+        uintptr_t pva = region->start + pg * PAGE_SIZE;
+        uint64_t *pte = kpte_find(pva);
+        if (pte && (*pte & PTE_P)) continue;
+
+        struct PageCacheEntry *ent = pagecache_get(fm->prov, fm->id, pg);
+        if (!ent || kmap_page(pva, ent->pa, PTE_U) < 0) {
+            if (pg == pgoff) return -E_NO_MEM;
+            break;
+        }
+
+        ent->maps++;
+        filemap_stats.mapped++;
+        if (pg != pgoff) filemap_stats.readahead++;
+    }
+
+    return 0;
+}
+
+int
+filemap_provider_add(const struct FileProvider *prov) {
+    for (size_t i = 0; i < FILEMAP_MAX_PROVIDERS; i++) {
+        if (!providers[i]) {
+            providers[i] = prov;
+            return 0;
+        }
+    }
+    return -E_NO_MEM;
+}
+
+/* Map file 'path' read-only into a free window and store its size.
+ * Pages are filled in on first access. Returns NULL on failure */
+void *
+filemap_open(const char *path, size_t *size) {
+    const struct FileProvider *prov = NULL;
+    uint64_t id = 0;
+    size_t fsize = 0;
+
+    for (size_t i = 0; i < FILEMAP_MAX_PROVIDERS && !prov; i++)
+        if (providers[i] && !providers[i]->lookup(path, &id, &fsize)) prov = providers[i];
+    if (!prov || fsize > FILE_WINDOW_SIZE) return NULL;
+
+    size_t slot = 0;
+    while (slot < MAXOPEN && filemaps[slot].prov) slot++;
+    if (slot == MAXOPEN) return NULL;
+
+    uintptr_t va = FILE_BASE + slot * (uintptr_t)FILE_WINDOW_SIZE;
+    struct FileMap *fm = &filemaps[slot];
+    if (pgfault_region_add(va, va + MAX(ROUNDUP(fsize, PAGE_SIZE), PAGE_SIZE), PF_IMAGE, filemap_fault, fm) < 0)
+        return NULL;
+
+    *fm = (struct FileMap){prov, id, fsize, curenv ? curenv->env_id : 0, 0, 0};
+    if (size) *size = fsize;
+
+    if (trace_memory) cprintf("filemap: %s (%lu bytes) at %p\n", path, (unsigned long)fsize, (void *)va);
+    return (void *)va;
+}
+
+int
+filemap_close(void *ptr) {
+    uintptr_t va = (uintptr_t)ptr;
+    size_t slot = (va - FILE_BASE) / FILE_WINDOW_SIZE;
+    if (va < FILE_BASE || slot >= MAXOPEN || (va - FILE_BASE) % FILE_WINDOW_SIZE) return -E_INVAL;
+
+    struct FileMap *fm = &filemaps[slot];
+    if (!fm->prov) return -E_INVAL;
+
+    for (size_t pg = 0; pg * PAGE_SIZE < fm->size; pg++) {
+        if (!kunmap_page(va + pg * PAGE_SIZE)) continue;
+
+        struct PageCacheEntry *ent = pagecache_lookup(fm->prov, fm->id, pg);
+        assert(ent && ent->maps);
+        ent->maps--;
+        filemap_stats.mapped--;
+    }
+
+    pgfault_region_remove(va);
+    memset(fm, 0, sizeof(*fm));
+    return 0;
+}
+
+/* Close the windows an exiting environment left open */
+void
+filemap_env_exit(envid_t envid) {
+    for (size_t slot = 0; slot < MAXOPEN; slot++)
+        if (filemaps[slot].prov && filemaps[slot].owner == envid)
+            filemap_close((void *)(FILE_BASE + slot * (uintptr_t)FILE_WINDOW_SIZE));
+}
+
+const struct FilemapStats *
+filemap_get_stats(void) {
+    return &filemap_stats;
+}
+
+void *
+sys_fmap(const char *path, size_t *size) {
+    return filemap_open(path, size);
+}
+
+int
+sys_funmap(void *va) {
+    size_t slot = ((uintptr_t)va - FILE_BASE) / FILE_WINDOW_SIZE;
+    if (curenv && slot < MAXOPEN && filemaps[slot].owner != curenv->env_id) return -E_INVAL;
+    return filemap_close(va);
+}
+
+/* Provider serving binaries embedded in the kernel image */
+
+static struct {
+    const char *path;
+    const uint8_t *data;
+    size_t size;
+} blobs[FILEMAP_MAX_BLOBS];
+
+static int
+blob_lookup(const char *path, uint64_t *id, size_t *size) {
+    for (size_t i = 0; i < FILEMAP_MAX_BLOBS && blobs[i].path; i++) {
+        if (!strcmp(blobs[i].path, path)) {
+            *id = i;
+            *size = blobs[i].size;
+            return 0;
+        }
+    }
+    return -E_NO_ENT;
+}
+
+static int
+blob_read_page(uint64_t id, size_t pgoff, void *dst) {
+    size_t off = pgoff * PAGE_SIZE;
+    size_t len = MIN(blobs[id].size - off, (size_t)PAGE_SIZE);
+
+    memcpy(dst, blobs[id].data + off, len);
+    memset((uint8_t *)dst + len, 0, PAGE_SIZE - len);
+    return 0;
+}
+
+static const struct FileProvider blob_provider = {"kernel", blob_lookup, blob_read_page};
+
+int
+filemap_add_blob(const char *path, const void *data, size_t size) {
+    size_t i = 0;
+    while (i < FILEMAP_MAX_BLOBS && blobs[i].path) i++;
+    if (i == FILEMAP_MAX_BLOBS) return -E_NO_MEM;
+
+    if (!i) filemap_provider_add(&blob_provider);
+    blobs[i].path = path;
+    blobs[i].data = data;
+    blobs[i].size = size;
+    return 0;
+}
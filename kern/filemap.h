@@ -0,0 +1,64 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FILEMAP_H
+#define JOS_KERN_FILEMAP_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+#include <kern/env.h>
+
+/* Files are mapped read-only at FILE_BASE, one window of
+ * FILE_WINDOW_SIZE bytes per open mapping, MAXOPEN windows.
+ * Pages are filled on fault from a page cache shared by all
+ * mappings of a file */
+#define FILE_WINDOW_SIZE (64 * 1024 * 1024)
+
+/* Read-ahead window bounds, in pages. The window doubles
+ * while faults are sequential and drops back on a random one */
+#define FILEMAP_RA_MIN 4
+#define FILEMAP_RA_MAX 64
+
+/* Source of file contents */
+struct FileProvider {
+    const char *name;
+    /* Find file 'path', store its id and size.
+     * Returns 0 or -E_NO_ENT */
+    int (*lookup)(const char *path, uint64_t *id, size_t *size);
+    /* Fill 'dst' with page 'pgoff' of file 'id'. Returns 0 on success */
+    int (*read_page)(uint64_t id, size_t pgoff, void *dst);
+};
+
+struct FilemapStats {
+    size_t cached;    /* Pages in the page cache */
+    size_t mapped;    /* Page mappings in file windows */
+    size_t hits;      /* Pages found in the page cache */
+    size_t misses;    /* Pages read from a provider */
+    size_t readahead; /* Pages mapped ahead of the faulting one */
+    size_t reclaimed; /* Cached pages dropped to free memory */
+};
+
+int filemap_provider_add(const struct FileProvider *prov);
+int filemap_add_blob(const char *path, const void *data, size_t size);
+void *filemap_open(const char *path, size_t *size);
+int filemap_close(void *va);
+void filemap_env_exit(envid_t envid);
+const struct FilemapStats *filemap_get_stats(void);
+
+/* Entry points bound into kernel-space programs */
+void *sys_fmap(const char *path, size_t *size);
+int sys_funmap(void *va);
+
+/* Publish a binary embedded in the kernel as file 'path' */
+#define FILEMAP_ADD_BINARY(x, path)                                    \
+    do {                                                               \
+        extern uint8_t ENV_PASTE3(_binary_obj_, x, _start)[];          \
+        extern uint8_t ENV_PASTE3(_binary_obj_, x, _end)[];            \
+        filemap_add_blob(path, ENV_PASTE3(_binary_obj_, x, _start),    \
+                         ENV_PASTE3(_binary_obj_, x, _end) -           \
+                                 ENV_PASTE3(_binary_obj_, x, _start)); \
+    } while (0)
+
+#endif /* !JOS_KERN_FILEMAP_H */
@@ -0,0 +1,56 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FONT_H
+#define JOS_KERN_FONT_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Monochrome bitmap font. Each glyph is 'height' rows
+ * of 'pitch' bytes, one bit per pixel */
+struct Font {
+    const char *name;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t nglyphs;
+    bool lsb_first; /* Leftmost pixel is bit 0 rather than bit 7 */
+    const uint8_t *glyphs;
+};
+
+/* Built-in 8x8 font, always available */
+extern const struct Font font8x8;
+
+int font_load_psf(struct Font *font, const uint8_t *data, size_t size);
+const struct Font *font_embedded(void);
+
+/* Number of character codes kept in the atlas */
+#define ATLAS_GLYPHS 128
+/* Largest tile, in pixels, the atlas pool can hold */
+#define ATLAS_MAX_TILE_PIXELS (32 * 32)
+
+/* Glyphs of a font pre-rasterized at a given scale and colors
+ * into tiles of framebuffer pixels, so that drawing a character
+ * is a plain copy of 'height' rows of 'width' pixels.
+ * 'width' is always even, so tile rows can be copied in pairs */
+struct GlyphAtlas {
+    const struct Font *font;
+    uint32_t scale;
+    uint32_t fg;
+    uint32_t bg;
+    uint32_t width;
+    uint32_t height;
+    uint32_t *tiles;
+};
+
+bool atlas_fits(const struct Font *font, uint32_t scale);
+const struct GlyphAtlas *atlas_get(const struct Font *font, uint32_t scale, uint32_t fg, uint32_t bg);
+
+static inline const uint32_t *
+atlas_tile(const struct GlyphAtlas *atlas, uint8_t c) {
+    return atlas->tiles + (size_t)(c % ATLAS_GLYPHS) * atlas->width * atlas->height;
+}
+
+#endif /* !JOS_KERN_FONT_H */
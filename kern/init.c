@@ -10,8 +10,16 @@
 #include <kern/console.h>
 #include <kern/env.h>
 #include <kern/sched.h>
+#include <kern/timer.h>
 #include <kern/kdebug.h>
 #include <kern/traceopt.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
+#include <kern/vsyscall.h>
+#include <kern/pmap.h>
+#include <kern/filemap.h>
+#include <kern/acpi.h>
+#include <kern/numa.h>
 
 pde_t *
 alloc_pd_early_boot(void) {
@@ -49,6 +57,34 @@ map_addr_early_boot(uintptr_t va, uintptr_t pa, size_t sz) {
     }
 }
 
+/* Map a single 4K page. Its 2M region must not be mapped with a huge page */
+void
+map_page_early_boot(uintptr_t va, uintptr_t pa, uint64_t perm) {
+    extern uintptr_t pml4phys;
+
+    pml4e_t *pml4 = &pml4phys;
+    pdpe_t *pdp;
+    pde_t *pd;
+    pte_t *pt;
+
+    pdp = (pdpe_t *)PTE_ADDR(pml4[PML4_INDEX(va)]);
+    pd = (pde_t *)PTE_ADDR(pdp[PDP_INDEX(va)]);
+    if (!pd) {
+        pd = alloc_pd_early_boot();
+        assert(pd);
+        pdp[PDP_INDEX(va)] = (uintptr_t)pd | PTE_P | PTE_W | PTE_U;
+    }
+    assert(!(pd[PD_INDEX(va)] & PTE_PS));
+    pt = (pte_t *)PTE_ADDR(pd[PD_INDEX(va)]);
+    if (!pt) {
+        pt = alloc_pd_early_boot();
+        assert(pt);
+        pd[PD_INDEX(va)] = (uintptr_t)pt | PTE_P | PTE_W | PTE_U;
+    }
+    pt[PT_INDEX(va)] = PTE_ADDR(pa) | perm;
+    invlpg((void *)va);
+}
+
 #if defined(SANITIZE_SHADOW_BASE) && LAB >= 6
 void
 map_shadow_early_boot(uintptr_t va, uintptr_t sz, void *page) {
@@ -100,6 +136,13 @@ i386_init(void) {
         cprintf("END: %p\n", end);
     }
 
+    /* Memory topology, needed by the page allocator */
+    acpi_init();
+    numa_init();
+
+    /* Physical page allocator and kernel heap */
+    pmap_init();
+
     /* Framebuffer init should be done after memory init */
     fb_init();
     if (trace_init) cprintf("Framebuffer initialised\n");
@@ -107,7 +150,28 @@ i386_init(void) {
     /* User environment initialization functions */
     env_init();
 
+    /* Exception and interrupt handling initialization */
+    trap_init();
+    pic_init();
+
+    /* Console input is interrupt-driven from now on */
+    cons_irq_init();
+
+    /* Time and identity readable without entering the kernel */
+    vsys_init();
+
+    /* Idle environments pick how to wait for interrupts */
+    sched_idle_init();
+
+    /* Timers tick from the RTC, counted with the TSC */
+    timer_init();
+
 #ifdef CONFIG_KSPACE
+    /* Program images can also be mapped as files */
+    FILEMAP_ADD_BINARY(prog_test1, "prog/test1");
+    FILEMAP_ADD_BINARY(prog_test2, "prog/test2");
+    FILEMAP_ADD_BINARY(prog_test3, "prog/test3");
+
     /* Touch all you want */
     ENV_CREATE_KERNEL_TYPE(prog_test1);
     ENV_CREATE_KERNEL_TYPE(prog_test2);
@@ -0,0 +1,112 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+#include <inc/assert.h>
+
+#include <kern/kclock.h>
+
+uint8_t
+mc146818_read(uint8_t reg) {
+    outb(IO_RTC_CMND, reg);
+    return inb(IO_RTC_DATA);
+}
+
+void
+mc146818_write(uint8_t reg, uint8_t datum) {
+    outb(IO_RTC_CMND, reg);
+    outb(IO_RTC_DATA, datum);
+}
+
+static uint32_t
+rtc_field(uint8_t reg, bool binary) {
+    uint8_t val = mc146818_read(reg);
+    return binary ? val : (val >> 4) * 10 + (val & 0x0F);
+}
+
+/* Days since 1970-01-01 of the given date in the proleptic
+ * Gregorian calendar, with March as the first month of a year */
+static uint64_t
+days_from_civil(uint32_t year, uint32_t month, uint32_t day) {
+    if (month <= 2) year--;
+    uint32_t era = year / 400;
+    uint32_t yoe = year - era * 400;
+    uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (uint64_t)era * 146097 + doe - 719468;
+}
+
+/* Current wall clock time in seconds since the Unix epoch.
+ * RTC is assumed to keep UTC and to be in the 21st century */
+uint64_t
+rtc_gettime(void) {
+    uint8_t breg = mc146818_read(RTC_BREG);
+    bool binary = breg & RTC_BINARY;
+
+    /* Do not read in the middle of an update */
+    while (mc146818_read(RTC_AREG) & RTC_UPDATE_IN_PROGRESS)
+        ;
+
+    uint32_t sec = rtc_field(RTC_SEC, binary);
+    uint32_t min = rtc_field(RTC_MIN, binary);
+    uint8_t rawhour = mc146818_read(RTC_HOUR);
+    uint32_t day = rtc_field(RTC_DAY, binary);
+    uint32_t mon = rtc_field(RTC_MON, binary);
+    uint32_t year = rtc_field(RTC_YEAR, binary) + 2000;
+
+    uint32_t hour = rawhour & ~RTC_PM;
+    if (!binary) hour = (hour >> 4) * 10 + (hour & 0x0F);
+    if (!(breg & RTC_24H)) hour = hour % 12 + (rawhour & RTC_PM ? 12 : 0);
+
+    return ((days_from_civil(year, mon, day) * 24 + hour) * 60 + min) * 60 + sec;
+}
+
+/* Sets the rate of the periodic interrupt on IRQ8
+ * to 32768 >> (rate - 1) Hz, rate is 3 to 15 */
+void
+rtc_timer_init(uint8_t rate) {
+    assert(rate >= 3 && rate <= 15);
+
+    uint8_t areg = mc146818_read(RTC_AREG);
+    mc146818_write(RTC_AREG, (areg & ~RTC_RATE_MASK) | rate);
+}
+
+/* Starts or stops the periodic interrupt */
+void
+rtc_timer_enable(bool enable) {
+    uint8_t breg = mc146818_read(RTC_BREG);
+    mc146818_write(RTC_BREG, enable ? breg | RTC_PIE : breg & ~RTC_PIE);
+
+    /* A flag left set blocks further interrupts */
+    rtc_check_status();
+}
+
+/* Reads and clears the interrupt flags,
+ * the RTC raises no more interrupts until this is done */
+uint8_t
+rtc_check_status(void) {
+    return mc146818_read(RTC_CREG);
+}
+
+#define CALIBRATE_HZ 100 /* Calibration takes 1/CALIBRATE_HZ seconds */
+
+/* Measure TSC frequency in Hz against PIT counter 2.
+ * The counter runs in mode 0, its output goes high on terminal count */
+uint64_t
+tsc_calibrate(void) {
+    uint32_t latch = TIMER_FREQ / CALIBRATE_HZ;
+
+    /* Enable the gate and disconnect the speaker */
+    outb(PIT_GATE, (inb(PIT_GATE) & ~PIT_SPEAKER) | PIT_GATE_EN);
+
+    outb(TIMER_MODE, TIMER_SEL2 | TIMER_16BIT);
+    outb(TIMER_CNTR2, latch & 0xFF);
+    outb(TIMER_CNTR2, latch >> 8);
+
+    uint64_t start = read_tsc();
+    while (!(inb(PIT_GATE) & PIT_OUT2))
+        ;
+    uint64_t end = read_tsc();
+
+    return (end - start) * CALIBRATE_HZ;
+}
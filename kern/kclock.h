@@ -0,0 +1,55 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KCLOCK_H
+#define JOS_KERN_KCLOCK_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* MC146818 real time clock and CMOS RAM */
+#define IO_RTC_CMND 0x070 /* RTC control port */
+#define IO_RTC_DATA 0x071 /* RTC data port */
+
+#define RTC_SEC  0x00
+#define RTC_MIN  0x02
+#define RTC_HOUR 0x04
+#define RTC_DAY  0x07
+#define RTC_MON  0x08
+#define RTC_YEAR 0x09
+
+#define RTC_AREG 0x0A
+#define RTC_BREG 0x0B
+#define RTC_CREG 0x0C
+
+#define RTC_UPDATE_IN_PROGRESS 0x80 /* In register A */
+#define RTC_RATE_MASK          0x0F /* In register A, periodic interrupt rate */
+#define RTC_24H                0x02 /* In register B */
+#define RTC_BINARY             0x04 /* In register B */
+#define RTC_PIE                0x40 /* In register B, periodic interrupt enable */
+#define RTC_PF                 0x40 /* In register C, periodic interrupt flag */
+#define RTC_PM                 0x80 /* In hour register, 12 hour mode */
+
+/* Intel 8253/8254 programmable interval timer */
+#define IO_TIMER1    0x040 /* 8253 Timer #1 */
+#define TIMER_CNTR2  (IO_TIMER1 + 2)
+#define TIMER_MODE   (IO_TIMER1 + 3)
+#define TIMER_SEL2   0x80 /* Select counter 2 */
+#define TIMER_16BIT  0x30 /* r/w counter 16 bits, LSB first */
+#define TIMER_FREQ   1193182
+#define PIT_GATE     0x061 /* Counter 2 gate and output */
+#define PIT_GATE_EN  0x01
+#define PIT_SPEAKER  0x02
+#define PIT_OUT2     0x20
+
+uint8_t mc146818_read(uint8_t reg);
+void mc146818_write(uint8_t reg, uint8_t datum);
+
+uint64_t rtc_gettime(void);
+void rtc_timer_init(uint8_t rate);
+void rtc_timer_enable(bool enable);
+uint8_t rtc_check_status(void);
+uint64_t tsc_calibrate(void);
+
+#endif /* !JOS_KERN_KCLOCK_H */
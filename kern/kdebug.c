@@ -5,6 +5,7 @@
 #include <inc/elf.h>
 #include <inc/x86.h>
 #include <inc/error.h>
+#include <inc/symdb.h>
 
 #include <kern/kdebug.h>
 #include <kern/env.h>
@@ -31,6 +32,72 @@ load_kernel_dwarf_info(struct Dwarf_Addrs *addrs) {
 #define UNKNOWN       "<unknown>"
 #define CALL_INSN_LEN 5
 
+/* Symbolization database built at link time, NULL when the
+ * loader did not find it, then raw DWARF is parsed instead */
+static const struct SymdbHeader *
+symdb_get(void) {
+    const struct SymdbHeader *db = (const struct SymdbHeader *)uefi_lp->SymdbStart;
+    size_t size = uefi_lp->SymdbEnd - uefi_lp->SymdbStart;
+
+    if (!db || size < sizeof(*db)) return NULL;
+    if (db->magic != SYMDB_MAGIC || db->version != SYMDB_VERSION) return NULL;
+    if (db->header_size < sizeof(*db) || db->total_size > size) return NULL;
+    return db;
+}
+
+#define SYMDB_TABLE(db, type, off) ((const type *)((const uint8_t *)(db) + (off)))
+
+static const char *
+symdb_string(const struct SymdbHeader *db, uint32_t off) {
+    return off < db->strings_size ? SYMDB_TABLE(db, char, db->strings_off + off) : "";
+}
+
+static const struct SymdbFunc *
+symdb_func_by_addr(const struct SymdbHeader *db, uintptr_t addr) {
+    const struct SymdbFunc *funcs = SYMDB_TABLE(db, struct SymdbFunc, db->funcs_off);
+
+    /* Last function starting at or below 'addr' */
+    size_t lo = 0, hi = db->nfuncs;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (funcs[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (!lo || addr - funcs[lo - 1].addr >= funcs[lo - 1].size) return NULL;
+    return &funcs[lo - 1];
+}
+
+static const struct SymdbLine *
+symdb_line_by_addr(const struct SymdbHeader *db, uintptr_t addr) {
+    const struct SymdbLine *lines = SYMDB_TABLE(db, struct SymdbLine, db->lines_off);
+
+    size_t lo = 0, hi = db->nlines;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (lines[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+
+    /* Past the end of a sequence */
+    if (!lo || !lines[lo - 1].line) return NULL;
+    return &lines[lo - 1];
+}
+
+static const struct SymdbFunc *
+symdb_func_by_name(const struct SymdbHeader *db, const char *name) {
+    const struct SymdbFunc *funcs = SYMDB_TABLE(db, struct SymdbFunc, db->funcs_off);
+    const uint32_t *buckets = SYMDB_TABLE(db, uint32_t, db->buckets_off);
+    const uint32_t *chain = SYMDB_TABLE(db, uint32_t, db->chain_off);
+
+    if (!db->nbuckets) return NULL;
+
+    for (uint32_t i = buckets[symdb_hash(name) & (db->nbuckets - 1)]; i; i = chain[i - 1])
+        if (!strcmp(symdb_string(db, funcs[i - 1].name), name)) return &funcs[i - 1];
+
+    return NULL;
+}
+
 /* debuginfo_rip(addr, info)
  * Fill in the 'info' structure with information about the specified
  * instruction address, 'addr'.  Returns 0 if information was found, and
@@ -49,8 +116,22 @@ debuginfo_rip(uintptr_t addr, struct Ripdebuginfo *info) {
     info->rip_fn_addr = addr;
     info->rip_fn_narg = 0;
 
-    struct Dwarf_Addrs addrs;
     assert(addr >= MAX_USER_READABLE);
+
+    const struct SymdbHeader *db = symdb_get();
+    if (db) {
+        const struct SymdbFunc *func = symdb_func_by_addr(db, addr - CALL_INSN_LEN);
+        const struct SymdbLine *line = symdb_line_by_addr(db, addr - CALL_INSN_LEN);
+        if (func && line) {
+            strlcpy(info->rip_file, symdb_string(db, line->file), sizeof(info->rip_file));
+            info->rip_line = line->line;
+            info->rip_fn_namelen = strlcpy(info->rip_fn_name, symdb_string(db, func->name), sizeof(info->rip_fn_name));
+            info->rip_fn_addr = func->addr;
+            return 0;
+        }
+    }
+
+    struct Dwarf_Addrs addrs;
     load_kernel_dwarf_info(&addrs);
 
     Dwarf_Off offset = 0, line_offset = 0;
@@ -101,6 +182,12 @@ find_function(const char *const fname) {
     uintptr_t funcAddr = 0;
     int err = 0;
 
+    const struct SymdbHeader *db = symdb_get();
+    if (db) {
+        const struct SymdbFunc *func = symdb_func_by_name(db, fname);
+        if (func) return func->addr;
+    }
+
     struct Dwarf_Addrs addrs = {};
     load_kernel_dwarf_info(&addrs);
 
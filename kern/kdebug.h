@@ -22,6 +22,9 @@ struct Ripdebuginfo {
     int rip_fn_narg;
 };
 
+struct Dwarf_Addrs;
+
+void load_kernel_dwarf_info(struct Dwarf_Addrs *addrs);
 int debuginfo_rip(uintptr_t eip, struct Ripdebuginfo *info);
 uintptr_t find_function(const char *const fname);
 
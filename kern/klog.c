@@ -0,0 +1,50 @@
+/* Per-CPU deferred binary log, see kern/klog.h */
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/stdarg.h>
+
+#include <kern/klog.h>
+#include <kern/vsyscall.h>
+
+struct KlogRing klog_rings[NCPU];
+
+/* Arguments were stored as 64-bit words, which is also how they
+ * are passed here, so printfmt reads them as the format says */
+static void
+klog_print(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vcprintf(fmt, ap);
+    va_end(ap);
+}
+
+/* Formats and prints all entries that were not drained yet */
+void
+klog_drain(void) {
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        struct KlogRing *ring = &klog_rings[cpu];
+        uint64_t head = ring->head;
+        uint64_t start = ring->drained;
+
+        if (head - start > KLOG_ENTRIES) {
+            cprintf("klog: cpu %d: %lu entries lost\n", cpu, (unsigned long)(head - start - KLOG_ENTRIES));
+            start = head - KLOG_ENTRIES;
+        }
+
+        for (uint64_t i = start; i < head; i++) {
+            const struct KlogEntry *entry = &ring->entries[i & (KLOG_ENTRIES - 1)];
+
+            /* Nanoseconds since vsys_init(), raw TSC before that */
+            uint64_t time = entry->tsc;
+            if (vsys[VSYS_tsc_mult] && time >= vsys[VSYS_tsc_base])
+                time = ((unsigned __int128)(time - vsys[VSYS_tsc_base]) * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift];
+
+            cprintf("[%d %lu.%09lu] ", cpu, (unsigned long)(time / 1000000000), (unsigned long)(time % 1000000000));
+            klog_print(entry->fmt, entry->args[0], entry->args[1], entry->args[2],
+                       entry->args[3], entry->args[4], entry->args[5]);
+        }
+
+        ring->drained = head;
+    }
+}
@@ -0,0 +1,87 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KLOG_H
+#define JOS_KERN_KLOG_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/x86.h>
+#include <kern/cpu.h>
+
+/* Deferred binary log.
+ *
+ * klog(fmt, ...) formats nothing at the call site: it stores the format
+ * string pointer, a TSC timestamp and the raw argument words into one
+ * cache line of a per-CPU ring, overwriting the oldest entry when full.
+ * Entries are formatted when the rings are drained by klog_drain() (the
+ * 'klog' monitor command), or offline by kern/klogdecode.py from a memory
+ * dump of klog_rings and the kernel ELF.
+ *
+ * Arguments are kept as 64-bit words, so only integer, character and
+ * pointer conversions make sense. A %s argument is read when the entry
+ * is formatted, so it has to outlive it; use string literals */
+
+#define KLOG_MAX_ARGS 6
+#define KLOG_ENTRIES  1024 /* Per CPU, a power of two */
+
+struct KlogEntry {
+    const char *fmt;
+    uint64_t tsc;
+    uint64_t args[KLOG_MAX_ARGS];
+};
+
+struct KlogRing {
+    uint64_t head;    /* Number of entries ever written */
+    uint64_t drained; /* Number of entries printed by klog_drain() */
+    struct KlogEntry entries[KLOG_ENTRIES] __attribute__((aligned(CPU_CACHE_LINE)));
+} __attribute__((aligned(CPU_CACHE_LINE)));
+
+extern struct KlogRing klog_rings[NCPU];
+
+void klog_drain(void);
+
+static inline void
+klog_record(const char *fmt, uint64_t a0, uint64_t a1, uint64_t a2,
+            uint64_t a3, uint64_t a4, uint64_t a5) {
+    struct KlogRing *ring = &klog_rings[cpunum()];
+
+    /* Claiming the slot is a single instruction, so an interrupt
+     * handler logging on this CPU can't get the same one */
+    uint64_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    struct KlogEntry *entry = &ring->entries[slot & (KLOG_ENTRIES - 1)];
+
+    entry->fmt = fmt;
+    entry->tsc = read_tsc();
+    entry->args[0] = a0;
+    entry->args[1] = a1;
+    entry->args[2] = a2;
+    entry->args[3] = a3;
+    entry->args[4] = a4;
+    entry->args[5] = a5;
+}
+
+/* Never called, lets the compiler check klog() formats */
+static inline void __attribute__((format(printf, 1, 2)))
+klog_check_format(const char *fmt, ...) {
+}
+
+/* Number of arguments including the format, up to 12 */
+#define KLOG_NARGS(...) KLOG_NARGS_(__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, n, ...) n
+
+#define KLOG_RECORD(fmt, a0, a1, a2, a3, a4, a5, ...)           \
+    klog_record((fmt), (uint64_t)(a0), (uint64_t)(a1),          \
+                (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4), \
+                (uint64_t)(a5))
+
+#define klog(...)                                                    \
+    do {                                                             \
+        _Static_assert(KLOG_NARGS(__VA_ARGS__) <= KLOG_MAX_ARGS + 1, \
+                       "klog: too many arguments");                  \
+        if (0) klog_check_format(__VA_ARGS__);                       \
+        KLOG_RECORD(__VA_ARGS__, 0, 0, 0, 0, 0, 0, 0);               \
+    } while (0)
+
+#endif /* !JOS_KERN_KLOG_H */
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""Decode the deferred kernel log (kern/klog.h) offline.
+
+Dump the rings from a running or crashed kernel, for example in gdb:
+
+    dump binary memory klog.bin (char *)klog_rings (char *)klog_rings + sizeof(klog_rings)
+
+and format them with the format strings read from the kernel ELF:
+
+    kern/klogdecode.py obj/kern/kernel klog.bin
+
+Entries of all CPUs are merged in timestamp order. Formatting follows
+lib/printfmt.c, %s arguments are resolved if they point into the image.
+"""
+
+import argparse
+import struct
+import sys
+
+KLOG_MAX_ARGS = 6
+KLOG_ENTRY_SIZE = 16 + 8 * KLOG_MAX_ARGS
+KLOG_HEADER_SIZE = 64  # head and drained, padded to a cache line
+
+SHF_ALLOC = 0x2
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+
+ERRORS = [
+    None,
+    "unspecified error",
+    "bad environment",
+    "invalid parameter",
+    "out of memory",
+    "out of environments",
+    "corrupted debug info",
+    "segmentation fault",
+    "invalid ELF image",
+    "entry not found",
+    "no such system call",
+]
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 2:
+            raise ValueError("%s is not an ELF64 file" % path)
+        shoff, = struct.unpack_from("<Q", self.data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x3A)
+        self.sections = []
+        for i in range(shnum):
+            name, type, flags, addr, offset, size, link = struct.unpack_from(
+                "<IIQQQQI", self.data, shoff + i * shentsize)
+            self.sections.append((name, type, flags, addr, offset, size, link))
+
+    def string(self, offset):
+        end = self.data.index(b"\0", offset)
+        return self.data[offset:end].decode("latin-1")
+
+    def symbol(self, wanted):
+        for _, type, _, _, offset, size, link in self.sections:
+            if type != SHT_SYMTAB:
+                continue
+            stroff = self.sections[link][4]
+            for pos in range(offset, offset + size, 24):
+                name, _, _, _, value, symsize = struct.unpack_from("<IBBHQQ", self.data, pos)
+                if self.string(stroff + name) == wanted:
+                    return value, symsize
+        raise KeyError(wanted)
+
+    def cstring(self, addr):
+        """NUL-terminated string at a virtual address, None if not in the image"""
+        for _, type, flags, start, offset, size, _ in self.sections:
+            if flags & SHF_ALLOC and type != SHT_NOBITS and start <= addr < start + size:
+                return self.string(offset + addr - start)
+        return None
+
+
+def signed(value, bits):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def number(num, base, width, padc, capital=False):
+    digits = "0123456789ABCDEF" if capital else "0123456789abcdef"
+    out = ""
+    while True:
+        out = digits[num % base] + out
+        num //= base
+        if not num:
+            break
+    return padc * max(0, width - len(out)) + out
+
+
+def format(elf, fmt, args):
+    """Formats like vprintfmt(), including its handling of widths"""
+    args = list(args)
+    out = []
+    i = 0
+
+    def arg():
+        return args.pop(0) if args else 0
+
+    while i < len(fmt):
+        ch = fmt[i]
+        i += 1
+        if ch != "%":
+            out.append(ch)
+            continue
+
+        start = i - 1
+        padc, width, precision, lflag, altflag, zflag = " ", -1, -1, 0, False, False
+        while i < len(fmt):
+            ch = fmt[i]
+            i += 1
+            if ch in "0-":
+                padc = ch
+                continue
+            if ch == "*" or ch.isdigit() and ch != "0":
+                if ch == "*":
+                    precision = signed(arg(), 32)
+                else:
+                    precision = int(ch)
+                    while i < len(fmt) and fmt[i].isdigit():
+                        precision = precision * 10 + int(fmt[i])
+                        i += 1
+                if width < 0:
+                    width, precision = precision, -1
+                continue
+            if ch == ".":
+                width = max(0, width)
+                continue
+            if ch == "#":
+                altflag = True
+                continue
+            if ch == "l":
+                lflag += 1
+                continue
+            if ch == "z":
+                zflag = True
+                continue
+            break
+        else:
+            break
+
+        bits = 64 if zflag or lflag else 32
+        if ch == "c":
+            out.append(chr(arg() & 0xFF))
+        elif ch == "i":
+            err = abs(signed(arg(), 32))
+            out.append(ERRORS[err] if 0 < err < len(ERRORS) else "error %d" % err)
+        elif ch == "s":
+            ptr = arg()
+            s = "(null)" if not ptr else elf.cstring(ptr)
+            if s is None:
+                s = "<string at 0x%x>" % ptr
+            if precision >= 0:
+                s = s[:precision]
+            if altflag:
+                s = "".join(c if " " <= c <= "~" else "?" for c in s)
+            if width > 0 and padc != "-":
+                s = padc * (width - len(s)) + s
+            out.append(s.ljust(width))
+        elif ch == "d":
+            value = signed(arg(), bits)
+            if value < 0:
+                out.append("-")
+            out.append(number(abs(value), 10, width, padc))
+        elif ch in "uoxX":
+            base = {"u": 10, "o": 8}.get(ch, 16)
+            out.append(number(arg() & ((1 << bits) - 1), base, width, padc, ch == "X"))
+        elif ch == "p":
+            out.append("0x" + number(arg(), 16, width, padc))
+        elif ch == "%":
+            out.append("%")
+        else:
+            out.append(fmt[start:i])
+
+    return "".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a dump of the JOS deferred kernel log")
+    parser.add_argument("kernel", help="kernel ELF, e.g. obj/kern/kernel")
+    parser.add_argument("dump", help="raw dump of klog_rings")
+    parser.add_argument("--entries", type=int, default=1024, help="KLOG_ENTRIES the kernel was built with")
+    parser.add_argument("--tsc-hz", type=float, help="print seconds since the first entry instead of TSC values")
+    opts = parser.parse_args()
+
+    elf = Elf(opts.kernel)
+    with open(opts.dump, "rb") as f:
+        dump = f.read()
+
+    ring_size = KLOG_HEADER_SIZE + opts.entries * KLOG_ENTRY_SIZE
+    try:
+        _, size = elf.symbol("klog_rings")
+        if size % ring_size:
+            sys.exit("klog_rings is %d bytes, not a multiple of %d: wrong --entries?" % (size, ring_size))
+    except KeyError:
+        size = len(dump) - len(dump) % ring_size
+    if len(dump) < size:
+        sys.exit("dump is %d bytes, klog_rings is %d" % (len(dump), size))
+
+    records = []
+    for cpu in range(size // ring_size):
+        base = cpu * ring_size
+        head, = struct.unpack_from("<Q", dump, base)
+        for seq in range(max(0, head - opts.entries), head):
+            offset = base + KLOG_HEADER_SIZE + (seq % opts.entries) * KLOG_ENTRY_SIZE
+            fmt, tsc, *args = struct.unpack_from("<QQ%dQ" % KLOG_MAX_ARGS, dump, offset)
+            if fmt:
+                records.append((tsc, cpu, fmt, args))
+
+    records.sort()
+    first = records[0][0] if records else 0
+    for tsc, cpu, fmt, args in records:
+        text = elf.cstring(fmt)
+        if text is None:
+            text = "<format at 0x%x>\n" % fmt
+        stamp = "%.9f" % ((tsc - first) / opts.tsc_hz) if opts.tsc_hz else "%d" % tsc
+        sys.stdout.write("[%d %s] %s" % (cpu, stamp, format(elf, text, args)))
+
+
+if __name__ == "__main__":
+    main()
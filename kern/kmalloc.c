@@ -0,0 +1,384 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/memlayout.h>
+#include <inc/string.h>
+#include <inc/uefi.h>
+
+#include <kern/kmalloc.h>
+#include <kern/magazine.h>
+#include <kern/pmap.h>
+#include <kern/numa.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/traceopt.h>
+
+/* Kernel heap lives in the KERN_HEAP_START..KERN_HEAP_END window
+ * right after the framebuffer mapping. Every virtual page of the
+ * window has a tag in heap_tags telling what it is used for */
+#define HEAP_PAGES ((KERN_HEAP_END - KERN_HEAP_START) / PAGE_SIZE)
+
+#define HEAP_FREE  0U
+#define HEAP_SLAB  (1U << 30) /* Low bits are the size class */
+#define HEAP_LARGE (2U << 30) /* Low bits are the number of pages */
+#define HEAP_TAIL  (3U << 30) /* Following page of a large allocation */
+#define HEAP_TYPE  (3U << 30)
+
+static uint32_t heap_tags[HEAP_PAGES];
+static size_t heap_first;
+static size_t heap_hint;
+
+#define HEAP_VA(pgnum) (KERN_HEAP_START + (uintptr_t)(pgnum) * PAGE_SIZE)
+#define HEAP_PG(va)    (((uintptr_t)(va) - KERN_HEAP_START) / PAGE_SIZE)
+
+struct KmallocFree {
+    struct KmallocFree *next;
+};
+
+/* Central free lists, heap window and its tags are
+ * protected by heap_lock. Size classes are reached through
+ * per-CPU magazine caches which only fall back to the central
+ * lists when the depot runs dry or fills up */
+static struct spinlock heap_lock;
+static struct KmallocFree *kmalloc_free[KMALLOC_NCLASSES];
+static struct MagCache kmalloc_caches[KMALLOC_NCLASSES];
+static struct KmallocStats kmalloc_stats;
+
+#if KMALLOC_REDZONE
+/* Object layout is [header | user data | tail redzone],
+ * header keeps the requested size and is guarded as well */
+#define KMALLOC_RZ       16
+#define KMALLOC_RZ_BYTE  0xCB
+#define KMALLOC_RZ_MAGIC 0x52454421U
+
+struct KmallocHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint8_t guard[KMALLOC_RZ - 2 * sizeof(uint32_t)];
+};
+
+/* Sum of requested sizes of live small objects */
+static size_t kmalloc_rz_bytes;
+#else
+#define KMALLOC_RZ 0
+#endif
+
+/* Find 'npages' consecutive unused pages of the heap window
+ * starting at a multiple of 'align' pages */
+static size_t
+heap_vm_alloc(size_t npages, size_t align) {
+    size_t start = heap_hint, run = 0;
+
+    for (size_t i = 0; i < 2 * HEAP_PAGES && run < npages; i++) {
+        size_t pg = heap_first + (heap_hint - heap_first + i) % (HEAP_PAGES - heap_first);
+
+        /* Runs cannot wrap around the end of the window */
+        if (pg == heap_first) run = 0;
+        if (heap_tags[pg] != HEAP_FREE) {
+            run = 0;
+            continue;
+        }
+        if (!run) {
+            if (HEAP_VA(pg) & (align * PAGE_SIZE - 1)) continue;
+            start = pg;
+        }
+        run++;
+    }
+
+    if (run < npages) return 0;
+    heap_hint = start + npages;
+    if (heap_hint >= HEAP_PAGES) heap_hint = heap_first;
+    return start;
+}
+
+/* Back heap pages [pgnum, pgnum + npages) with physical memory of
+ * 'node', 'flags' are passed to the page allocator */
+static int
+heap_map(size_t pgnum, size_t npages, int flags, int node) {
+    if (kmap_span(HEAP_VA(pgnum), npages, PTE_W, flags, node) < 0) return -E_NO_MEM;
+    kmalloc_stats.heap_pages += npages;
+    return 0;
+}
+
+static void
+heap_unmap(size_t pgnum, size_t npages) {
+    kunmap_span(HEAP_VA(pgnum), npages);
+    kmalloc_stats.heap_pages -= npages;
+}
+
+/* Give size class 'cls' a new page worth of free objects */
+static int
+kmalloc_refill(int cls) {
+    size_t pg = heap_vm_alloc(1, 1);
+    if (!pg || heap_map(pg, 1, 0, numa_cpu_node(cpunum())) < 0) return -E_NO_MEM;
+    heap_tags[pg] = HEAP_SLAB | cls;
+
+    size_t size = (size_t)1 << (cls + KMALLOC_MIN_SHIFT);
+    for (size_t off = PAGE_SIZE; off >= size; off -= size) {
+        struct KmallocFree *obj = (struct KmallocFree *)(HEAP_VA(pg) + off - size);
+        obj->next = kmalloc_free[cls];
+        kmalloc_free[cls] = obj;
+    }
+
+    kmalloc_stats.classes[cls].pages++;
+    return 0;
+}
+
+static int
+kmalloc_class(size_t size) {
+    int cls = 0;
+    while (((size_t)1 << (cls + KMALLOC_MIN_SHIFT)) < size) cls++;
+    return cls;
+}
+
+/* Backing allocator of the magazine cache of class 'arg' */
+static void *
+kmalloc_class_alloc(void *arg) {
+    int cls = (int)(uintptr_t)arg;
+
+    spin_lock(&heap_lock);
+    struct KmallocFree *obj = kmalloc_free[cls];
+    if (obj || (kmalloc_refill(cls) == 0 && (obj = kmalloc_free[cls])))
+        kmalloc_free[cls] = obj->next;
+    spin_unlock(&heap_lock);
+
+    return obj;
+}
+
+static void
+kmalloc_class_free(void *arg, void *ptr) {
+    int cls = (int)(uintptr_t)arg;
+    struct KmallocFree *obj = ptr;
+
+    spin_lock(&heap_lock);
+    obj->next = kmalloc_free[cls];
+    kmalloc_free[cls] = obj;
+    spin_unlock(&heap_lock);
+}
+
+static void *
+kmalloc_small(size_t size) {
+    int cls = kmalloc_class(size + 2 * KMALLOC_RZ);
+
+    void *obj = mag_alloc(&kmalloc_caches[cls]);
+    if (!obj) return NULL;
+
+#if KMALLOC_REDZONE
+    spin_lock(&heap_lock);
+    kmalloc_rz_bytes += size;
+    spin_unlock(&heap_lock);
+    struct KmallocHeader *hdr = (struct KmallocHeader *)obj;
+    hdr->magic = KMALLOC_RZ_MAGIC;
+    hdr->size = size;
+    memset(hdr->guard, KMALLOC_RZ_BYTE, sizeof(hdr->guard));
+    memset((uint8_t *)(hdr + 1) + size, KMALLOC_RZ_BYTE, ((size_t)1 << (cls + KMALLOC_MIN_SHIFT)) - size - KMALLOC_RZ);
+    return hdr + 1;
+#else
+    return obj;
+#endif
+}
+
+static void *
+kmalloc_large(size_t size, int flags, int node) {
+    size_t npages = ROUNDUP(size, PAGE_SIZE) / PAGE_SIZE;
+
+    spin_lock(&heap_lock);
+
+    /* Allocations of a huge page or more are aligned so that
+     * they can be mapped with huge pages. Leave an unmapped
+     * guard page after the allocation */
+    size_t align = npages >= HUGE_PAGE_SIZE / PAGE_SIZE ? HUGE_PAGE_SIZE / PAGE_SIZE : 1;
+    size_t pg = heap_vm_alloc(npages + (KMALLOC_REDZONE ? 1 : 0), align);
+    if (!pg || heap_map(pg, npages, flags, node) < 0) {
+        spin_unlock(&heap_lock);
+        return NULL;
+    }
+
+    heap_tags[pg] = HEAP_LARGE | npages;
+    for (size_t i = 1; i < npages; i++)
+        heap_tags[pg + i] = HEAP_TAIL;
+    if (KMALLOC_REDZONE) heap_tags[pg + npages] = HEAP_TAIL;
+
+    kmalloc_stats.large_pages += npages;
+    kmalloc_stats.large_inuse++;
+
+    spin_unlock(&heap_lock);
+    return (void *)HEAP_VA(pg);
+}
+
+/* Large zeroed allocations take their pages from
+ * the pre-zeroed pool instead of clearing them here */
+static void *
+kmalloc_flags(size_t size, int flags, int node) {
+    if (!size || size >= HEAP_PAGES * PAGE_SIZE) return NULL;
+
+    void *ptr;
+    if (size + 2 * KMALLOC_RZ <= KMALLOC_MAX_SMALL) {
+        ptr = kmalloc_small(size);
+        if (ptr && (flags & ALLOC_ZERO)) memset(ptr, 0, size);
+    } else {
+        ptr = kmalloc_large(size, flags, node);
+    }
+
+    if (trace_memory_more) cprintf("kmalloc(%lu) = %p\n", (unsigned long)size, ptr);
+    return ptr;
+}
+
+/* Allocate 'size' bytes of kernel memory.
+ * Small objects are aligned to the smaller of their class size
+ * and 16 bytes, large ones are page aligned.
+ * Returns NULL if out of memory */
+void *
+kmalloc(size_t size) {
+    return kmalloc_flags(size, 0, numa_cpu_node(cpunum()));
+}
+
+void *
+kzalloc(size_t size) {
+    return kmalloc_flags(size, ALLOC_ZERO, numa_cpu_node(cpunum()));
+}
+
+/* Like kmalloc(), but large allocations are backed by memory
+ * of 'node'. Small objects share slabs and may be anywhere */
+void *
+kmalloc_node(size_t size, int node) {
+    return kmalloc_flags(size, 0, node);
+}
+
+void
+kfree(void *ptr) {
+    if (!ptr) return;
+    if (trace_memory_more) cprintf("kfree(%p)\n", ptr);
+
+    uintptr_t va = (uintptr_t)ptr;
+    if (va < HEAP_VA(heap_first) || va >= KERN_HEAP_END)
+        panic("kfree: %p is not a heap address", ptr);
+
+    size_t pg = HEAP_PG(va);
+    uint32_t tag = heap_tags[pg];
+
+    switch (tag & HEAP_TYPE) {
+    case HEAP_SLAB: {
+        int cls = tag & ~HEAP_TYPE;
+        size_t size = (size_t)1 << (cls + KMALLOC_MIN_SHIFT);
+        uintptr_t obj = va - KMALLOC_RZ;
+        if (obj & (size - 1)) panic("kfree: %p is not an object start", ptr);
+
+#if KMALLOC_REDZONE
+        struct KmallocHeader *hdr = (struct KmallocHeader *)obj;
+        if (hdr->magic != KMALLOC_RZ_MAGIC) panic("kfree: %p is corrupted or freed twice", ptr);
+        for (size_t i = 0; i < sizeof(hdr->guard); i++)
+            if (hdr->guard[i] != KMALLOC_RZ_BYTE) panic("kfree: %p head redzone is overwritten", ptr);
+        for (uint8_t *p = (uint8_t *)ptr + hdr->size; p < (uint8_t *)obj + size; p++)
+            if (*p != KMALLOC_RZ_BYTE) panic("kfree: %p tail redzone is overwritten", ptr);
+        hdr->magic = 0;
+        spin_lock(&heap_lock);
+        kmalloc_rz_bytes -= hdr->size;
+        spin_unlock(&heap_lock);
+#endif
+
+        mag_free(&kmalloc_caches[cls], (void *)obj);
+        break;
+    }
+    case HEAP_LARGE: {
+        size_t npages = tag & ~HEAP_TYPE;
+        if (va & (PAGE_SIZE - 1)) panic("kfree: %p is not an object start", ptr);
+
+        spin_lock(&heap_lock);
+        heap_unmap(pg, npages);
+        for (size_t i = 0; i < npages + (KMALLOC_REDZONE ? 1 : 0); i++)
+            heap_tags[pg + i] = HEAP_FREE;
+
+        kmalloc_stats.large_pages -= npages;
+        kmalloc_stats.large_inuse--;
+        spin_unlock(&heap_lock);
+        break;
+    }
+    default:
+        panic("kfree: %p was not allocated", ptr);
+    }
+}
+
+/* Move the pages of large allocation 'ptr' to 'node'.
+ * Small objects are left alone.
+ * Returns the number of pages moved */
+size_t
+kmalloc_migrate(void *ptr, int node) {
+    uintptr_t va = (uintptr_t)ptr;
+    if (va < HEAP_VA(heap_first) || va >= KERN_HEAP_END) return 0;
+
+    size_t moved = 0;
+    spin_lock(&heap_lock);
+    uint32_t tag = heap_tags[HEAP_PG(va)];
+    if ((tag & HEAP_TYPE) == HEAP_LARGE)
+        moved = kmigrate_span(va, tag & ~HEAP_TYPE, node);
+    spin_unlock(&heap_lock);
+
+    return moved;
+}
+
+/* Try to map aligned huge page spans of large allocations
+ * that had to fall back to 4K pages with huge pages.
+ * Returns the number of spans promoted */
+size_t
+kmalloc_promote(void) {
+    size_t promoted = 0;
+
+    spin_lock(&heap_lock);
+    for (size_t pg = heap_first; pg < HEAP_PAGES; pg++) {
+        if ((heap_tags[pg] & HEAP_TYPE) != HEAP_LARGE) continue;
+
+        size_t npages = heap_tags[pg] & ~HEAP_TYPE;
+        uintptr_t va = ROUNDUP(HEAP_VA(pg), HUGE_PAGE_SIZE);
+        for (; va + HUGE_PAGE_SIZE <= HEAP_VA(pg + npages); va += HUGE_PAGE_SIZE)
+            if (kpromote(va) == 0) promoted++;
+        pg += npages - 1;
+    }
+    spin_unlock(&heap_lock);
+
+    return promoted;
+}
+
+/* Per-class counters live in the magazine caches,
+ * collect them into kmalloc_stats */
+const struct KmallocStats *
+kmalloc_get_stats(void) {
+    size_t small_bytes = 0;
+
+    for (int cls = 0; cls < KMALLOC_NCLASSES; cls++) {
+        struct KmallocClassStats *cs = &kmalloc_stats.classes[cls];
+        struct MagStats ms;
+
+        mag_cache_stats(&kmalloc_caches[cls], &ms);
+        cs->allocs = ms.allocs;
+        cs->inuse = ms.allocs - ms.frees;
+        cs->cached = ms.cached;
+        cs->hits = ms.hits;
+        small_bytes += cs->inuse * cs->size;
+    }
+
+#if KMALLOC_REDZONE
+    /* Exact requested sizes are known */
+    small_bytes = kmalloc_rz_bytes;
+#endif
+    kmalloc_stats.bytes_inuse = small_bytes + kmalloc_stats.large_pages * PAGE_SIZE;
+
+    return &kmalloc_stats;
+}
+
+void
+kmalloc_init(void) {
+    /* Heap starts after the framebuffer mapping, its
+     * first page is never used so that 0 is not a valid page */
+    uintptr_t start = ROUNDUP(FRAMEBUFFER + MAX((uintptr_t)uefi_lp->FrameBufferSize, 1), HUGE_PAGE_SIZE);
+    heap_first = heap_hint = HEAP_PG(start);
+    assert(heap_first < HEAP_PAGES);
+
+    kmalloc_stats.heap_size = HEAP_PAGES - heap_first;
+    for (int cls = 0; cls < KMALLOC_NCLASSES; cls++) {
+        kmalloc_stats.classes[cls].size = (size_t)1 << (cls + KMALLOC_MIN_SHIFT);
+        mag_cache_init(&kmalloc_caches[cls], "kmalloc", kmalloc_class_alloc,
+                       kmalloc_class_free, (void *)(uintptr_t)cls);
+    }
+}
@@ -0,0 +1,51 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KMALLOC_H
+#define JOS_KERN_KMALLOC_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Build with EXTRA_CFLAGS=-DKMALLOC_REDZONE=1 to surround small
+ * objects with checked guard bytes and put an unmapped page after
+ * every large allocation */
+#ifndef KMALLOC_REDZONE
+#define KMALLOC_REDZONE 0
+#endif
+
+/* Small objects come from power of two size classes 16..2048 bytes,
+ * anything bigger is a run of whole pages */
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_NCLASSES  8
+#define KMALLOC_MAX_SMALL (1 << (KMALLOC_MIN_SHIFT + KMALLOC_NCLASSES - 1))
+
+struct KmallocClassStats {
+    size_t size;
+    size_t pages;  /* Slab pages owned by the class */
+    size_t inuse;  /* Objects currently allocated */
+    size_t allocs; /* Total number of allocations */
+    size_t cached; /* Free objects held in magazines */
+    size_t hits;   /* Operations served by per-CPU magazines */
+};
+
+struct KmallocStats {
+    size_t bytes_inuse;  /* Bytes handed out, exact sizes with redzones on */
+    size_t large_pages;  /* Pages in large allocations */
+    size_t large_inuse;  /* Large allocations currently live */
+    size_t heap_pages;   /* Pages of the heap window in use */
+    size_t heap_size;    /* Heap window size in pages */
+    struct KmallocClassStats classes[KMALLOC_NCLASSES];
+};
+
+void kmalloc_init(void);
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void *kmalloc_node(size_t size, int node);
+void kfree(void *ptr);
+size_t kmalloc_migrate(void *ptr, int node);
+size_t kmalloc_promote(void);
+const struct KmallocStats *kmalloc_get_stats(void);
+
+#endif /* !JOS_KERN_KMALLOC_H */
@@ -0,0 +1,169 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/magazine.h>
+#include <kern/kmalloc.h>
+
+/* Per-CPU state is only ever touched by its own CPU with
+ * interrupts disabled, so it needs no lock. Kernel-space programs
+ * run with interrupts enabled, so mag_alloc() and mag_free()
+ * disable them themselves. The backing
+ * allocator and kmalloc are always called without the depot
+ * lock held: magazines come from kmalloc, which may itself
+ * be layered over a magazine cache */
+
+void
+mag_cache_init(struct MagCache *cache, const char *name,
+               void *(*backing_alloc)(void *arg),
+               void (*backing_free)(void *arg, void *obj), void *arg) {
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->backing_alloc = backing_alloc;
+    cache->backing_free = backing_free;
+    cache->arg = arg;
+}
+
+static void
+mag_push(struct Magazine **list, size_t *count, struct Magazine *mag) {
+    mag->next = *list;
+    *list = mag;
+    (*count)++;
+}
+
+static struct Magazine *
+mag_pop(struct Magazine **list, size_t *count) {
+    struct Magazine *mag = *list;
+    if (mag) {
+        *list = mag->next;
+        (*count)--;
+    }
+    return mag;
+}
+
+/* Loaded and previous magazines are each either NULL,
+ * empty or full, except for the loaded one being in use */
+static void *
+mag_alloc_cpu(struct MagCache *cache) {
+    struct MagCpu *mc = &cache->cpu[cpunum()];
+    struct MagDepot *depot = &cache->depot;
+    bool local = 1;
+
+    if (!mc->loaded || !mc->loaded->rounds) {
+        if (mc->prev && mc->prev->rounds) {
+            struct Magazine *tmp = mc->loaded;
+            mc->loaded = mc->prev;
+            mc->prev = tmp;
+        } else {
+            spin_lock(&depot->lock);
+            struct Magazine *full = mag_pop(&depot->full, &depot->nfull);
+            if (full && mc->prev) mag_push(&depot->empty, &depot->nempty, mc->prev);
+            spin_unlock(&depot->lock);
+
+            if (!full) {
+                void *obj = cache->backing_alloc(cache->arg);
+                if (obj) mc->allocs++;
+                return obj;
+            }
+
+            mc->prev = mc->loaded;
+            mc->loaded = full;
+            mc->exchanges++;
+            local = 0;
+        }
+    }
+
+    if (local) mc->hits++;
+    mc->allocs++;
+    return mc->loaded->round[--mc->loaded->rounds];
+}
+
+static void
+mag_free_cpu(struct MagCache *cache, void *obj) {
+    struct MagCpu *mc = &cache->cpu[cpunum()];
+    struct MagDepot *depot = &cache->depot;
+
+    mc->frees++;
+
+    for (bool exchanged = 0;;) {
+        if (mc->loaded && mc->loaded->rounds < MAG_ROUNDS) {
+            if (!exchanged) mc->hits++;
+            mc->loaded->round[mc->loaded->rounds++] = obj;
+            return;
+        }
+
+        if (mc->prev && !mc->prev->rounds) {
+            struct Magazine *tmp = mc->loaded;
+            mc->loaded = mc->prev;
+            mc->prev = tmp;
+            continue;
+        }
+
+        spin_lock(&depot->lock);
+        struct Magazine *empty = mag_pop(&depot->empty, &depot->nempty);
+        if (empty && mc->prev) mag_push(&depot->full, &depot->nfull, mc->prev);
+        spin_unlock(&depot->lock);
+
+        if (empty) {
+            mc->prev = mc->loaded;
+            mc->loaded = empty;
+            mc->exchanges++;
+            exchanged = 1;
+            continue;
+        }
+
+        /* Depot is out of empty magazines, make a new one.
+         * kmalloc may reenter this cache, so start over after it */
+        struct Magazine *mag = kmalloc(sizeof(*mag));
+        if (!mag) {
+            cache->backing_free(cache->arg, obj);
+            return;
+        }
+        mag->rounds = 0;
+
+        spin_lock(&depot->lock);
+        mag_push(&depot->empty, &depot->nempty, mag);
+        spin_unlock(&depot->lock);
+        exchanged = 1;
+    }
+}
+
+void *
+mag_alloc(struct MagCache *cache) {
+    uint64_t rflags = read_rflags();
+    asm volatile("cli" ::: "memory");
+    void *obj = mag_alloc_cpu(cache);
+    write_rflags(rflags);
+    return obj;
+}
+
+void
+mag_free(struct MagCache *cache, void *obj) {
+    uint64_t rflags = read_rflags();
+    asm volatile("cli" ::: "memory");
+    mag_free_cpu(cache, obj);
+    write_rflags(rflags);
+}
+
+/* Counters are read without synchronization,
+ * the result is only approximate while other CPUs run */
+void
+mag_cache_stats(struct MagCache *cache, struct MagStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < NCPU; i++) {
+        struct MagCpu *mc = &cache->cpu[i];
+        stats->allocs += mc->allocs;
+        stats->frees += mc->frees;
+        stats->hits += mc->hits;
+        stats->exchanges += mc->exchanges;
+        if (mc->loaded) stats->cached += mc->loaded->rounds;
+        if (mc->prev) stats->cached += mc->prev->rounds;
+    }
+
+    stats->nfull = cache->depot.nfull;
+    stats->nempty = cache->depot.nempty;
+    stats->cached += stats->nfull * MAG_ROUNDS;
+}
@@ -0,0 +1,74 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_MAGAZINE_H
+#define JOS_KERN_MAGAZINE_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+/* Per-CPU object caching layer in front of an object allocator.
+ *
+ * Every CPU keeps two magazines, stacks of up to MAG_ROUNDS free
+ * objects. Allocation and free work on the loaded magazine and fall
+ * back to the previous one, so they only touch CPU-local data.
+ * When both are empty (full) the CPU exchanges a magazine with the
+ * depot, the only shared and locked part. The backing allocator is
+ * only called when the depot has no full (empty) magazine to give */
+
+/* Sized so that a magazine is exactly 128 bytes */
+#define MAG_ROUNDS 14
+
+struct Magazine {
+    struct Magazine *next;
+    size_t rounds;
+    void *round[MAG_ROUNDS];
+};
+
+struct MagCpu {
+    struct Magazine *loaded;
+    struct Magazine *prev;
+    size_t allocs;     /* Objects handed out by this CPU */
+    size_t frees;      /* Objects returned on this CPU */
+    size_t hits;       /* Operations served without the depot */
+    size_t exchanges;  /* Magazines swapped with the depot */
+} __attribute__((aligned(CPU_CACHE_LINE)));
+
+struct MagDepot {
+    struct spinlock lock;
+    struct Magazine *full;
+    struct Magazine *empty;
+    size_t nfull;
+    size_t nempty;
+};
+
+struct MagCache {
+    const char *name;
+    void *(*backing_alloc)(void *arg);
+    void (*backing_free)(void *arg, void *obj);
+    void *arg;
+    struct MagCpu cpu[NCPU];
+    struct MagDepot depot;
+};
+
+struct MagStats {
+    size_t allocs;
+    size_t frees;
+    size_t hits;
+    size_t exchanges;
+    size_t cached;    /* Free objects held in magazines */
+    size_t nfull;
+    size_t nempty;
+};
+
+void mag_cache_init(struct MagCache *cache, const char *name,
+                    void *(*backing_alloc)(void *arg),
+                    void (*backing_free)(void *arg, void *obj), void *arg);
+void *mag_alloc(struct MagCache *cache);
+void mag_free(struct MagCache *cache, void *obj);
+void mag_cache_stats(struct MagCache *cache, struct MagStats *stats);
+
+#endif /* !JOS_KERN_MAGAZINE_H */
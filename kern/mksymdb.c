@@ -0,0 +1,519 @@
+/* Host tool: digest the symbol table and .debug_line of the linked
+ * kernel into the symbolization database described in inc/symdb.h.
+ *
+ * Usage: mksymdb kernel output */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SYMDB_HOST
+#include <inc/symdb.h>
+
+/* Just enough of ELF64 */
+#define EI_NIDENT   16
+#define SHT_SYMTAB  2
+#define STT_FUNC    2
+#define SHN_UNDEF   0
+#define ST_TYPE(i)  ((i)&0xF)
+
+struct Ehdr {
+    uint8_t e_ident[EI_NIDENT];
+    uint16_t e_type, e_machine;
+    uint32_t e_version;
+    uint64_t e_entry, e_phoff, e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+};
+
+struct Shdr {
+    uint32_t sh_name, sh_type;
+    uint64_t sh_flags, sh_addr, sh_offset, sh_size;
+    uint32_t sh_link, sh_info;
+    uint64_t sh_addralign, sh_entsize;
+};
+
+struct Sym {
+    uint32_t st_name;
+    uint8_t st_info, st_other;
+    uint16_t st_shndx;
+    uint64_t st_value, st_size;
+};
+
+static const char *progname;
+static uint8_t *image;
+static size_t image_size;
+
+static void __attribute__((noreturn, format(printf, 1, 2)))
+fatal(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%s: ", progname);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+static void *
+xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size ? size : 1);
+    if (!ptr) fatal("out of memory");
+    return ptr;
+}
+
+/* Growable arrays */
+
+#define VEC(type) \
+    struct {      \
+        type *data; \
+        size_t len, cap; \
+    }
+
+#define VEC_PUSH(vec, val)                                                      \
+    do {                                                                        \
+        if ((vec).len == (vec).cap) {                                           \
+            (vec).cap = (vec).cap ? (vec).cap * 2 : 256;                        \
+            (vec).data = xrealloc((vec).data, (vec).cap * sizeof(*(vec).data)); \
+        }                                                                       \
+        (vec).data[(vec).len++] = (val);                                        \
+    } while (0)
+
+/* Interned strings */
+
+static VEC(char) strings;
+static uint32_t *intern_table;
+static size_t intern_size, intern_count;
+
+static uint32_t
+intern_insert(const char *str, uint32_t hash) {
+    uint32_t off = strings.len;
+    for (const char *ptr = str;; ptr++) {
+        VEC_PUSH(strings, *ptr);
+        if (!*ptr) break;
+    }
+
+    size_t i = hash & (intern_size - 1);
+    while (intern_table[i]) i = (i + 1) & (intern_size - 1);
+    intern_table[i] = off;
+    intern_count++;
+    return off;
+}
+
+static void
+intern_grow(void) {
+    uint32_t *old = intern_table;
+    size_t old_size = intern_size;
+
+    intern_size = intern_size ? intern_size * 2 : 1024;
+    intern_table = calloc(intern_size, sizeof(*intern_table));
+    if (!intern_table) fatal("out of memory");
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (!old[i]) continue;
+        size_t j = symdb_hash(strings.data + old[i]) & (intern_size - 1);
+        while (intern_table[j]) j = (j + 1) & (intern_size - 1);
+        intern_table[j] = old[i];
+    }
+    free(old);
+}
+
+static uint32_t
+intern(const char *str) {
+    if (!*str) return 0;
+    if (!strings.len) VEC_PUSH(strings, '\0');
+    if ((intern_count + 1) * 2 > intern_size) intern_grow();
+
+    uint32_t hash = symdb_hash(str);
+    for (size_t i = hash & (intern_size - 1); intern_table[i]; i = (i + 1) & (intern_size - 1))
+        if (!strcmp(strings.data + intern_table[i], str)) return intern_table[i];
+
+    return intern_insert(str, hash);
+}
+
+/* ELF sections */
+
+static const struct Ehdr *ehdr;
+static const struct Shdr *shdrs;
+
+static const struct Shdr *
+find_section(const char *name) {
+    const char *shstr = (const char *)image + shdrs[ehdr->e_shstrndx].sh_offset;
+    for (size_t i = 0; i < ehdr->e_shnum; i++)
+        if (!strcmp(shstr + shdrs[i].sh_name, name)) return &shdrs[i];
+    return NULL;
+}
+
+static const uint8_t *
+section_data(const struct Shdr *sh) {
+    if (sh->sh_offset + sh->sh_size > image_size) fatal("section out of file bounds");
+    return image + sh->sh_offset;
+}
+
+/* Functions */
+
+static VEC(struct SymdbFunc) funcs;
+
+static int
+func_cmp(const void *a, const void *b) {
+    const struct SymdbFunc *fa = a, *fb = b;
+    if (fa->addr != fb->addr) return fa->addr < fb->addr ? -1 : 1;
+    /* Keep the sort stable with respect to names */
+    return fa->name < fb->name ? -1 : fa->name > fb->name;
+}
+
+static void
+load_functions(void) {
+    const struct Shdr *symtab = find_section(".symtab");
+    if (!symtab || symtab->sh_type != SHT_SYMTAB) fatal("no .symtab");
+    const struct Shdr *strtab = &shdrs[symtab->sh_link];
+
+    const struct Sym *syms = (const struct Sym *)section_data(symtab);
+    const char *names = (const char *)section_data(strtab);
+    size_t nsyms = symtab->sh_size / sizeof(*syms);
+
+    for (size_t i = 0; i < nsyms; i++) {
+        const struct Sym *sym = &syms[i];
+        if (ST_TYPE(sym->st_info) != STT_FUNC) continue;
+        if (sym->st_shndx == SHN_UNDEF || !sym->st_value) continue;
+        if (sym->st_size > UINT32_MAX) fatal("function %s is too large", names + sym->st_name);
+
+        struct SymdbFunc func = {
+                .addr = sym->st_value,
+                .size = (uint32_t)sym->st_size,
+                .name = intern(names + sym->st_name)};
+        VEC_PUSH(funcs, func);
+    }
+
+    qsort(funcs.data, funcs.len, sizeof(*funcs.data), func_cmp);
+
+    /* Assembly labels often have no size, let them
+     * extend up to the next function */
+    for (size_t i = 0; i < funcs.len; i++) {
+        if (funcs.data[i].size) continue;
+        for (size_t j = i + 1; j < funcs.len; j++) {
+            if (funcs.data[j].addr > funcs.data[i].addr) {
+                uint64_t size = funcs.data[j].addr - funcs.data[i].addr;
+                funcs.data[i].size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+                break;
+            }
+        }
+    }
+}
+
+/* Line table */
+
+struct Row {
+    struct SymdbLine line;
+    size_t order;
+};
+
+static VEC(struct Row) rows;
+
+static void
+emit_row(uint64_t addr, uint32_t line, uint32_t file) {
+    struct Row row = {{addr, line, file}, rows.len};
+    VEC_PUSH(rows, row);
+}
+
+static uint64_t
+read_uleb(const uint8_t **ptr, const uint8_t *end) {
+    uint64_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+
+    do {
+        if (*ptr >= end) fatal("truncated .debug_line");
+        byte = *(*ptr)++;
+        if (shift < 64) result |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return result;
+}
+
+static int64_t
+read_sleb(const uint8_t **ptr, const uint8_t *end) {
+    uint64_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+
+    do {
+        if (*ptr >= end) fatal("truncated .debug_line");
+        byte = *(*ptr)++;
+        if (shift < 64) result |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (shift < 64 && (byte & 0x40)) result |= ~0ULL << shift;
+    return (int64_t)result;
+}
+
+#define READ(ptr, type) ({      \
+    type val;                   \
+    memcpy(&val, ptr, sizeof(type)); \
+    ptr += sizeof(type);        \
+    val;                        \
+})
+
+/* Parse one DWARF 2-4 line number program, returns its end */
+static const uint8_t *
+load_unit(const uint8_t *ptr, const uint8_t *section_end) {
+    uint64_t unit_length = READ(ptr, uint32_t);
+    bool dwarf64 = unit_length == 0xFFFFFFFF;
+    if (dwarf64) unit_length = READ(ptr, uint64_t);
+
+    const uint8_t *end = ptr + unit_length;
+    if (end > section_end) fatal("truncated .debug_line");
+
+    uint16_t version = READ(ptr, uint16_t);
+    if (version < 2 || version > 4) {
+        fprintf(stderr, "%s: skipping DWARF %u line program\n", progname, version);
+        return end;
+    }
+
+    uint64_t header_length = dwarf64 ? READ(ptr, uint64_t) : READ(ptr, uint32_t);
+    const uint8_t *program = ptr + header_length;
+
+    uint8_t min_inst_length = READ(ptr, uint8_t);
+    if (version >= 4) (void)READ(ptr, uint8_t); /* maximum_operations_per_instruction */
+    uint8_t default_is_stmt = READ(ptr, uint8_t);
+    int8_t line_base = READ(ptr, int8_t);
+    uint8_t line_range = READ(ptr, uint8_t);
+    uint8_t opcode_base = READ(ptr, uint8_t);
+    const uint8_t *opcode_lengths = ptr;
+    ptr += opcode_base - 1;
+    (void)default_is_stmt;
+    if (!line_range) fatal("bad line_range");
+
+    /* Directory 0 is the compilation directory, names
+     * relative to it are kept as they are */
+    VEC(const char *) dirs = {0};
+    VEC_PUSH(dirs, "");
+    while (*ptr) {
+        VEC_PUSH(dirs, (const char *)ptr);
+        ptr += strlen((const char *)ptr) + 1;
+    }
+    ptr++;
+
+    VEC(uint32_t) files = {0};
+    VEC_PUSH(files, 0);
+    char path[1024];
+    while (*ptr) {
+        const char *name = (const char *)ptr;
+        ptr += strlen(name) + 1;
+        uint64_t dir = read_uleb(&ptr, end);
+        read_uleb(&ptr, end);
+        read_uleb(&ptr, end);
+
+        if (dir && dir < dirs.len && name[0] != '/')
+            snprintf(path, sizeof(path), "%s/%s", dirs.data[dir], name);
+        else
+            snprintf(path, sizeof(path), "%s", name);
+        VEC_PUSH(files, intern(path));
+    }
+
+    uint64_t addr = 0;
+    uint64_t file = 1, line = 1;
+    /* Sequences of functions dropped by the linker start at 0 */
+    bool valid = false;
+
+#define FILE_NAME() (file < files.len ? files.data[file] : 0)
+#define EMIT()                                                   \
+    do {                                                         \
+        if (valid) emit_row(addr, (uint32_t)line, FILE_NAME()); \
+    } while (0)
+
+    for (ptr = program; ptr < end;) {
+        uint8_t op = *ptr++;
+
+        if (op >= opcode_base) {
+            uint8_t adj = op - opcode_base;
+            addr += (adj / line_range) * min_inst_length;
+            line += line_base + adj % line_range;
+            EMIT();
+            continue;
+        }
+
+        switch (op) {
+        case 0: { /* Extended opcode */
+            uint64_t len = read_uleb(&ptr, end);
+            const uint8_t *next = ptr + len;
+            if (!len || next > end) fatal("bad extended opcode");
+
+            switch (*ptr++) {
+            case 1: /* DW_LNE_end_sequence */
+                if (valid) emit_row(addr, 0, 0);
+                addr = 0;
+                file = line = 1;
+                valid = false;
+                break;
+            case 2: /* DW_LNE_set_address */
+                addr = READ(ptr, uint64_t);
+                valid = addr != 0;
+                break;
+            default:
+                break;
+            }
+            ptr = next;
+            break;
+        }
+        case 1: /* DW_LNS_copy */
+            EMIT();
+            break;
+        case 2: /* DW_LNS_advance_pc */
+            addr += read_uleb(&ptr, end) * min_inst_length;
+            break;
+        case 3: /* DW_LNS_advance_line */
+            line += read_sleb(&ptr, end);
+            break;
+        case 4: /* DW_LNS_set_file */
+            file = read_uleb(&ptr, end);
+            break;
+        case 8: /* DW_LNS_const_add_pc */
+            addr += ((255 - opcode_base) / line_range) * min_inst_length;
+            break;
+        case 9: /* DW_LNS_fixed_advance_pc */
+            addr += READ(ptr, uint16_t);
+            break;
+        default:
+            /* Column, statement and block flags do not matter here */
+            for (uint8_t i = 0; i < opcode_lengths[op - 1]; i++)
+                read_uleb(&ptr, end);
+        }
+    }
+
+#undef EMIT
+#undef FILE_NAME
+
+    free(dirs.data);
+    free(files.data);
+    return end;
+}
+
+static int
+row_cmp(const void *a, const void *b) {
+    const struct Row *ra = a, *rb = b;
+    if (ra->line.addr != rb->line.addr) return ra->line.addr < rb->line.addr ? -1 : 1;
+    /* End of sequence markers go first, so that a sequence
+     * starting where another ends takes precedence */
+    if (!ra->line.line != !rb->line.line) return ra->line.line ? 1 : -1;
+    return ra->order < rb->order ? -1 : ra->order > rb->order;
+}
+
+static void
+load_lines(void) {
+    const struct Shdr *sh = find_section(".debug_line");
+    if (!sh) {
+        fprintf(stderr, "%s: no .debug_line, line numbers are not available\n", progname);
+        return;
+    }
+
+    const uint8_t *ptr = section_data(sh), *end = ptr + sh->sh_size;
+    while (ptr < end) ptr = load_unit(ptr, end);
+
+    qsort(rows.data, rows.len, sizeof(*rows.data), row_cmp);
+
+    /* Of several rows at the same address the last one
+     * describes it, the others cover no bytes at all */
+    size_t out = 0;
+    for (size_t i = 0; i < rows.len; i++) {
+        if (out && rows.data[out - 1].line.addr == rows.data[i].line.addr) out--;
+        /* Drop end markers immediately followed by another end marker */
+        if (!rows.data[i].line.line && out && !rows.data[out - 1].line.line) continue;
+        rows.data[out++] = rows.data[i];
+    }
+    rows.len = out;
+}
+
+/* Output */
+
+static VEC(uint8_t) blob;
+
+static uint32_t
+append(const void *data, size_t size) {
+    while (blob.len % 8) VEC_PUSH(blob, 0);
+    uint32_t off = blob.len;
+    for (size_t i = 0; i < size; i++) VEC_PUSH(blob, ((const uint8_t *)data)[i]);
+    return off;
+}
+
+static void
+build(void) {
+    struct SymdbHeader hdr = {
+            .magic = SYMDB_MAGIC,
+            .version = SYMDB_VERSION,
+            .header_size = sizeof(hdr),
+            .nfuncs = funcs.len,
+            .nlines = rows.len};
+    append(&hdr, sizeof(hdr));
+
+    hdr.funcs_off = append(funcs.data, funcs.len * sizeof(*funcs.data));
+
+    hdr.lines_off = append(NULL, 0);
+    for (size_t i = 0; i < rows.len; i++)
+        append(&rows.data[i].line, sizeof(rows.data[i].line));
+
+    hdr.nbuckets = 1;
+    while (hdr.nbuckets < funcs.len) hdr.nbuckets *= 2;
+    uint32_t *buckets = calloc(hdr.nbuckets, sizeof(*buckets));
+    uint32_t *chain = calloc(funcs.len + 1, sizeof(*chain));
+    if (!buckets || !chain) fatal("out of memory");
+
+    /* Insert in reverse, so that chains list functions in address order */
+    for (size_t i = funcs.len; i-- > 0;) {
+        uint32_t bucket = symdb_hash(strings.data + funcs.data[i].name) & (hdr.nbuckets - 1);
+        chain[i] = buckets[bucket];
+        buckets[bucket] = i + 1;
+    }
+    hdr.buckets_off = append(buckets, hdr.nbuckets * sizeof(*buckets));
+    hdr.chain_off = append(chain, funcs.len * sizeof(*chain));
+    free(buckets);
+    free(chain);
+
+    if (!strings.len) VEC_PUSH(strings, '\0');
+    hdr.strings_off = append(strings.data, strings.len);
+    hdr.strings_size = strings.len;
+
+    append(NULL, 0);
+    hdr.total_size = blob.len;
+    memcpy(blob.data, &hdr, sizeof(hdr));
+}
+
+int
+main(int argc, char **argv) {
+    progname = argv[0];
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s kernel output\n", progname);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) fatal("cannot open %s", argv[1]);
+    fseek(file, 0, SEEK_END);
+    image_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    image = xrealloc(NULL, image_size);
+    if (fread(image, 1, image_size, file) != image_size) fatal("cannot read %s", argv[1]);
+    fclose(file);
+
+    ehdr = (const struct Ehdr *)image;
+    if (image_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, "\177ELF\2\1", 6))
+        fatal("%s is not a little endian ELF64 file", argv[1]);
+    if (ehdr->e_shoff + ehdr->e_shnum * sizeof(struct Shdr) > image_size)
+        fatal("section headers out of file bounds");
+    shdrs = (const struct Shdr *)(image + ehdr->e_shoff);
+
+    load_functions();
+    load_lines();
+    build();
+
+    file = fopen(argv[2], "wb");
+    if (!file) fatal("cannot create %s", argv[2]);
+    if (fwrite(blob.data, 1, blob.len, file) != blob.len) fatal("cannot write %s", argv[2]);
+    fclose(file);
+    return 0;
+}
@@ -7,11 +7,22 @@
 #include <inc/assert.h>
 #include <inc/env.h>
 #include <inc/x86.h>
+#include <inc/dwarf.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/kmalloc.h>
+#include <kern/pgfault.h>
+#include <kern/filemap.h>
+#include <kern/numa.h>
+#include <kern/klog.h>
+#include <kern/sched.h>
+#include <kern/workq.h>
+#include <kern/timer.h>
+#include <kern/vsyscall.h>
 
 #define WHITESPACE "\t\r\n "
 #define MAXARGS    16
@@ -21,6 +32,15 @@ int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
 int mon_test_cmd(int argc, char **argv, struct Trapframe *tf);
+int mon_stats(int argc, char **argv, struct Trapframe *tf);
+int mon_kmem(int argc, char **argv, struct Trapframe *tf);
+int mon_pfstat(int argc, char **argv, struct Trapframe *tf);
+int mon_numa(int argc, char **argv, struct Trapframe *tf);
+int mon_lebbench(int argc, char **argv, struct Trapframe *tf);
+int mon_klog(int argc, char **argv, struct Trapframe *tf);
+int mon_idle(int argc, char **argv, struct Trapframe *tf);
+int mon_workq(int argc, char **argv, struct Trapframe *tf);
+int mon_timers(int argc, char **argv, struct Trapframe *tf);
 
 struct Command {
     const char *name;
@@ -34,6 +54,15 @@ static struct Command commands[] = {
         {"kerninfo", "Display information about the kernel", mon_kerninfo},
         {"backtrace", "Print stack backtrace", mon_backtrace},
         {"test", "Prints test info", mon_test_cmd},
+        {"stats", "Toggle statistics pane", mon_stats},
+        {"kmem", "Display kernel memory allocator statistics, 'kmem promote' remaps the heap with huge pages", mon_kmem},
+        {"pfstat", "Display page fault counts and handling times", mon_pfstat},
+        {"numa", "Display NUMA nodes and allocation counters", mon_numa},
+        {"lebbench", "Time LEB128 decoding and a DIE tree walk over the kernel .debug_info", mon_lebbench},
+        {"klog", "Print the deferred kernel log, 'klog bench' times logging against formatting and clobbers the log", mon_klog},
+        {"idle", "Display how idle CPUs spent their time", mon_idle},
+        {"workq", "Display deferred work run counts and queueing latency", mon_workq},
+        {"timers", "Display timer wheel counters", mon_timers},
 };
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
 
@@ -75,8 +104,8 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf) {
         struct Ripdebuginfo dinfo = {};
         debuginfo_rip(rip, &dinfo);
 
-        cprintf("  rbp %016lx  rip %016lx\n", rbp, rip);
-        cprintf("    %s:%d: %s+%ld\n", dinfo.rip_file, dinfo.rip_line, dinfo.rip_fn_name, rip - dinfo.rip_fn_addr);
+        cprintf_fast("  rbp %016lx  rip %016lx\n", rbp, rip);
+        cprintf_fast("    %s:%d: %s+%ld\n", dinfo.rip_file, dinfo.rip_line, dinfo.rip_fn_name, rip - dinfo.rip_fn_addr);
 
         rbp = *((uint64_t*)rbp);
     }
@@ -90,6 +119,301 @@ int mon_test_cmd(int argc, char **argv, struct Trapframe *tf) {
     return 0;
 }
 
+/* Statistics pane in the top right corner of the screen,
+ * refreshed every time the monitor prompt is shown */
+
+#define STATS_ROWS 16
+#define STATS_COLS 40
+
+static struct Pane *stats_pane;
+
+static const char *
+env_status_name(unsigned status) {
+    static const char *const names[] = {
+            [ENV_FREE] = "free",
+            [ENV_DYING] = "dying",
+            [ENV_RUNNABLE] = "runnable",
+            [ENV_RUNNING] = "running",
+            [ENV_NOT_RUNNABLE] = "blocked"};
+
+    return status < sizeof(names) / sizeof(*names) ? names[status] : "?";
+}
+
+static void
+stats_refresh(void) {
+    if (!stats_pane) return;
+
+    const struct FbStats *fs = fb_get_stats();
+    pane_clear(stats_pane);
+    pane_printf(stats_pane, "fb: %lu flushes %lu tiles\n", (unsigned long)fs->flushes, (unsigned long)fs->tiles);
+    pane_printf(stats_pane, "    %lu cells drawn\n", (unsigned long)fs->cells);
+    pane_printf(stats_pane, "env      status   runs\n");
+
+    /* Leave the last line empty so the pane never scrolls */
+    int lines = STATS_ROWS - 4;
+    for (size_t i = 0; i < NENV && lines > 0; i++) {
+        if (envs[i].env_status == ENV_FREE) continue;
+        pane_printf(stats_pane, "%08x %-8s %u\n", envs[i].env_id,
+                    env_status_name(envs[i].env_status), envs[i].env_runs);
+        lines--;
+    }
+
+    fb_flush();
+}
+
+int
+mon_stats(int argc, char **argv, struct Trapframe *tf) {
+    if (stats_pane) {
+        pane_destroy(stats_pane);
+        stats_pane = NULL;
+        fb_flush();
+        return 0;
+    }
+
+    uint32_t rows, cols;
+    fb_size(&rows, &cols);
+    stats_pane = pane_create(0, cols > STATS_COLS ? cols - STATS_COLS : 0, STATS_ROWS, STATS_COLS);
+    if (!stats_pane) cprintf("No room for statistics pane\n");
+    return 0;
+}
+
+int
+mon_kmem(int argc, char **argv, struct Trapframe *tf) {
+    if (argc > 1 && !strcmp(argv[1], "promote"))
+        cprintf("Promoted %lu spans to huge pages\n", (unsigned long)kmalloc_promote());
+
+    const struct PmapStats *ps = pmap_get_stats();
+    const struct KmallocStats *ks = kmalloc_get_stats();
+
+    cprintf("Physical pages: %lu free of %lu, %lu in kernel page tables\n",
+            (unsigned long)ps->free_pages, (unsigned long)ps->total_pages, (unsigned long)ps->pt_pages);
+    cprintf("Zeroed pool: %lu pages, %lu zeroed when idle, %lu hits, %lu misses\n",
+            (unsigned long)ps->zeroed_pages, (unsigned long)ps->zeroed_total,
+            (unsigned long)ps->zero_hits, (unsigned long)ps->zero_misses);
+    cprintf("Huge pages: %lu mapped (%luK), %lu fallbacks, %lu promotions, %lu demotions\n",
+            (unsigned long)ps->huge_pages, (unsigned long)(ps->huge_pages * HUGE_PAGE_SIZE / 1024),
+            (unsigned long)ps->huge_fallbacks, (unsigned long)ps->huge_promotions, (unsigned long)ps->huge_demotions);
+    const struct FilemapStats *fs = filemap_get_stats();
+    cprintf("Page cache: %lu pages, %lu mapped, %lu hits, %lu misses, %lu read ahead, %lu reclaimed\n",
+            (unsigned long)fs->cached, (unsigned long)fs->mapped, (unsigned long)fs->hits,
+            (unsigned long)fs->misses, (unsigned long)fs->readahead, (unsigned long)fs->reclaimed);
+
+    size_t mapped = ks->heap_pages * PAGE_SIZE;
+    cprintf("Heap: %lu of %lu pages mapped, %lu bytes in use", (unsigned long)ks->heap_pages,
+            (unsigned long)ks->heap_size, (unsigned long)ks->bytes_inuse);
+    if (mapped) cprintf(", %lu%% unused", (unsigned long)((mapped - ks->bytes_inuse) * 100 / mapped));
+    cprintf("\n");
+    cprintf("Large: %lu allocations in %lu pages\n", (unsigned long)ks->large_inuse, (unsigned long)ks->large_pages);
+
+    cprintf("  size  pages  inuse  allocs  cached    hits\n");
+    for (size_t i = 0; i < KMALLOC_NCLASSES; i++) {
+        const struct KmallocClassStats *cs = &ks->classes[i];
+        cprintf("  %4lu  %5lu  %5lu  %6lu  %6lu  %6lu\n", (unsigned long)cs->size, (unsigned long)cs->pages,
+                (unsigned long)cs->inuse, (unsigned long)cs->allocs, (unsigned long)cs->cached, (unsigned long)cs->hits);
+    }
+    return 0;
+}
+
+int
+mon_pfstat(int argc, char **argv, struct Trapframe *tf) {
+    const struct PfStats *st = pgfault_get_stats();
+
+    cprintf("Page faults, %lu resolved:\n", (unsigned long)st->resolved);
+    for (int i = 0; i < PF_NTYPES; i++)
+        cprintf("  %-12s %lu\n", pgfault_type_name(i), (unsigned long)st->count[i]);
+
+    cprintf("Handling time, TSC ticks:\n");
+    for (int i = 0; i < PF_HIST_BUCKETS; i++)
+        if (st->hist[i]) cprintf("  < 2^%-2d %lu\n", i + 1, (unsigned long)st->hist[i]);
+
+    for (size_t i = 0; i < NENV; i++) {
+        if (envs[i].env_status == ENV_FREE) continue;
+
+        const uint32_t *counts = pgfault_env_counts(envs[i].env_id);
+        cprintf("[%08x]", envs[i].env_id);
+        for (int j = 0; j < PF_NTYPES; j++)
+            cprintf(" %s %u", pgfault_type_name(j), counts[j]);
+        cprintf("\n");
+    }
+    return 0;
+}
+
+int
+mon_numa(int argc, char **argv, struct Trapframe *tf) {
+    cprintf("node     pages      free     local    remote  distances\n");
+    for (int i = 0; i < numa_nnodes; i++) {
+        cprintf("%4d  %8lu  %8lu  %8lu  %8lu ", i, (unsigned long)numa_stats[i].total,
+                (unsigned long)page_free_on_node(i), (unsigned long)numa_stats[i].local,
+                (unsigned long)numa_stats[i].remote);
+        for (int j = 0; j < numa_nnodes; j++)
+            cprintf(" %3u", numa_distance(i, j));
+        cprintf("\n");
+    }
+    cprintf("Env migrations between nodes: %lu, pages moved: %lu\n",
+            (unsigned long)numa_migrations, (unsigned long)numa_migrated_pages);
+    return 0;
+}
+
+/* Decode the whole .debug_info section as a stream of LEB128 data,
+ * which gives a realistic mix of value lengths, once with the byte
+ * loop and once with the word at a time decoder */
+int
+mon_lebbench(int argc, char **argv, struct Trapframe *tf) {
+    struct Dwarf_Addrs addrs;
+    load_kernel_dwarf_info(&addrs);
+
+    const uint8_t *begin = addrs.info_begin, *end = addrs.info_end;
+    /* Leave room for the longest datum the slow path may scan */
+    if (end - begin < 16) {
+        cprintf("No .debug_info\n");
+        return 0;
+    }
+    end -= 16;
+
+    uint64_t sum_slow = 0, sum_fast = 0, sum_signed = 0, count = 0;
+
+    uint64_t start = read_tsc();
+    for (const uint8_t *ptr = begin; ptr < end; count++) {
+        uint64_t val;
+        ptr += dwarf_read_uleb128_slow(ptr, &val);
+        sum_slow += val;
+    }
+    uint64_t slow = read_tsc() - start;
+
+    start = read_tsc();
+    for (const uint8_t *ptr = begin; ptr < end;) {
+        uint64_t val;
+        ptr += dwarf_read_uleb128(ptr, &val);
+        sum_fast += val;
+    }
+    uint64_t fast = read_tsc() - start;
+
+    /* Signed decoders are checked against each other
+     * for correctness only, they are rare in DWARF */
+    for (const uint8_t *ptr = begin; ptr < end;) {
+        int64_t val1, val2;
+        uint64_t len = dwarf_read_leb128_slow((const char *)ptr, &val1);
+        if (dwarf_read_leb128((const char *)ptr, &val2) != len || val1 != val2) sum_signed++;
+        ptr += len;
+    }
+
+    cprintf("%lu values in %lu bytes\n", (unsigned long)count, (unsigned long)(end - begin));
+    if (count) {
+        cprintf("  byte loop  %lu ticks, %lu.%02lu per value\n", (unsigned long)slow,
+                (unsigned long)(slow / count), (unsigned long)(slow * 100 / count % 100));
+        cprintf("  word load  %lu ticks, %lu.%02lu per value\n", (unsigned long)fast,
+                (unsigned long)(fast / count), (unsigned long)(fast * 100 / count % 100));
+    }
+    if (sum_slow != sum_fast || sum_signed) cprintf("  MISMATCH: unsigned %s, %lu signed\n",
+                                                    sum_slow != sum_fast ? "differ" : "match", (unsigned long)sum_signed);
+
+    /* A full DIE tree walk for a name that does not exist */
+    uintptr_t offset;
+    start = read_tsc();
+    naive_address_by_fname(&addrs, "lebbench_no_such_function", &offset);
+    cprintf("  DIE walk   %lu ticks\n", (unsigned long)(read_tsc() - start));
+    return 0;
+}
+
+int
+mon_klog(int argc, char **argv, struct Trapframe *tf) {
+    if (argc < 2) {
+        klog_drain();
+        return 0;
+    }
+    if (strcmp(argv[1], "bench")) {
+        cprintf("Usage: klog [bench]\n");
+        return 0;
+    }
+
+    /* The bench overwrites most of this CPU's ring,
+     * print what is there before it is lost */
+    klog_drain();
+
+    enum { N = 1000 };
+    char buf[128];
+
+    uint64_t start = read_tsc();
+    for (int i = 0; i < N; i++)
+        klog("[%08x] bench %d of %d at %p\n", i, i, N, buf);
+    uint64_t logged = read_tsc() - start;
+
+    start = read_tsc();
+    for (int i = 0; i < N; i++)
+        snprintf(buf, sizeof(buf), "[%08x] bench %d of %d at %p\n", i, i, N, buf);
+    uint64_t formatted = read_tsc() - start;
+
+    /* Bench entries are not interesting, skip them when draining */
+    klog_rings[cpunum()].drained = klog_rings[cpunum()].head;
+
+    cprintf("klog:     %lu cycles per message\n", (unsigned long)(logged / N));
+    cprintf("snprintf: %lu cycles per message\n", (unsigned long)(formatted / N));
+    return 0;
+}
+
+int
+mon_idle(int argc, char **argv, struct Trapframe *tf) {
+    static const char *const names[IDLE_NSTATES] = {
+            [IDLE_WORK] = "work",
+            [IDLE_HLT] = "hlt",
+            [IDLE_MWAIT] = "mwait"};
+
+    uint64_t hz = vsys[VSYS_tsc_hz];
+    uint64_t uptime = read_tsc() - vsys[VSYS_tsc_base];
+    if (!hz || !uptime) {
+        cprintf("TSC is not calibrated\n");
+        return 0;
+    }
+
+    cprintf("cpu  state    entries        ms  residency\n");
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        const struct SchedIdleStats *stats = sched_idle_stats(cpu);
+        for (int i = 0; i < IDLE_NSTATES; i++) {
+            cprintf("%3d  %-5s %10lu %9lu  %8lu%%\n", cpu, names[i], (unsigned long)stats->entries[i],
+                    (unsigned long)(stats->tsc[i] * 1000 / hz), (unsigned long)(stats->tsc[i] * 100 / uptime));
+        }
+    }
+    cprintf("Idle environment entered %lu times\n", (unsigned long)vsys[VSYS_sched_halts]);
+    return 0;
+}
+
+int
+mon_workq(int argc, char **argv, struct Trapframe *tf) {
+    uint64_t hz = vsys[VSYS_tsc_hz];
+    if (!hz) {
+        cprintf("TSC is not calibrated\n");
+        return 0;
+    }
+
+    cprintf("cpu    queued      runs    passes  overruns  avg us  max us\n");
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        const struct WorkStats *stats = work_get_stats(cpu);
+        uint64_t avg = stats->runs ? stats->lat_sum / stats->runs : 0;
+        cprintf("%3d %9lu %9lu %9lu %9lu %7lu %7lu\n", cpu, (unsigned long)stats->queued,
+                (unsigned long)stats->runs, (unsigned long)stats->passes, (unsigned long)stats->overruns,
+                (unsigned long)(avg * 1000000 / hz), (unsigned long)(stats->lat_max * 1000000 / hz));
+    }
+    return 0;
+}
+
+int
+mon_timers(int argc, char **argv, struct Trapframe *tf) {
+    if (!vsys[VSYS_tsc_hz]) {
+        cprintf("TSC is not calibrated\n");
+        return 0;
+    }
+
+    const struct TimerStats *stats = timer_get_stats();
+    cprintf("tick       %lu at %d Hz\n", (unsigned long)timer_ticks(), TIMER_HZ);
+    cprintf("pending    %lu\n", (unsigned long)stats->pending);
+    cprintf("armed      %lu (%lu coalesced)\n", (unsigned long)stats->armed, (unsigned long)stats->coalesced);
+    cprintf("cancelled  %lu\n", (unsigned long)stats->cancelled);
+    cprintf("fired      %lu in %lu ticks\n", (unsigned long)stats->fired, (unsigned long)stats->batches);
+    cprintf("cascaded   %lu\n", (unsigned long)stats->cascaded);
+    cprintf("interrupts %lu\n", (unsigned long)stats->interrupts);
+    return 0;
+}
+
 /* Kernel monitor command interpreter */
 
 static int
@@ -133,6 +457,8 @@ monitor(struct Trapframe *tf) {
     cprintf("Type 'help' for a list of commands.\n");
 
     char *buf;
-    do buf = readline("K> ");
-    while (!buf || runcmd(buf, tf) >= 0);
+    do {
+        stats_refresh();
+        buf = readline("K> ");
+    } while (!buf || runcmd(buf, tf) >= 0);
 }
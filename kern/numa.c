@@ -0,0 +1,156 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/acpi.h>
+#include <kern/cpu.h>
+#include <kern/numa.h>
+#include <kern/traceopt.h>
+
+/* Without SRAT all memory and CPUs are on node 0 */
+int numa_nnodes = 1;
+struct NumaRange numa_ranges[NUMA_MAX_RANGES];
+size_t numa_nranges;
+struct NumaNodeStats numa_stats[NUMA_MAX_NODES];
+size_t numa_migrations;
+size_t numa_migrated_pages;
+
+/* Proximity domain of every node, nodes are numbered
+ * in the order their domains first appear in SRAT */
+static uint32_t node_domain[NUMA_MAX_NODES];
+static uint8_t node_distance[NUMA_MAX_NODES][NUMA_MAX_NODES];
+
+/* Nodes ordered by distance from every node, nearest first */
+static int8_t node_order[NUMA_MAX_NODES][NUMA_MAX_NODES];
+
+/* Node of every local APIC id */
+static int8_t apic_node[256];
+static int cpu_node[NCPU];
+
+static int
+numa_domain_node(uint32_t domain) {
+    for (int i = 0; i < numa_nnodes; i++)
+        if (node_domain[i] == domain) return i;
+
+    if (numa_nnodes == NUMA_MAX_NODES) {
+        cprintf("NUMA: too many proximity domains, domain %u put on node 0\n", domain);
+        return 0;
+    }
+    node_domain[numa_nnodes] = domain;
+    return numa_nnodes++;
+}
+
+static void
+numa_parse_srat(const struct AcpiSrat *srat) {
+    const uint8_t *ptr = srat->entries;
+    const uint8_t *end = (const uint8_t *)srat + srat->h.length;
+
+    numa_nnodes = 0;
+
+    for (; ptr + 2 <= end && ptr[1] && ptr + ptr[1] <= end; ptr += ptr[1]) {
+        switch (ptr[0]) {
+        case SRAT_CPU_AFFINITY: {
+            const struct AcpiSratCpu *cpu = (const void *)ptr;
+            if (!(cpu->flags & SRAT_ENABLED)) break;
+            uint32_t domain = cpu->proximity_lo | cpu->proximity_hi[0] << 8 |
+                              cpu->proximity_hi[1] << 16 | (uint32_t)cpu->proximity_hi[2] << 24;
+            apic_node[cpu->apic_id] = numa_domain_node(domain);
+            break;
+        }
+        case SRAT_X2APIC_AFFINITY: {
+            const struct AcpiSratX2apic *cpu = (const void *)ptr;
+            if (!(cpu->flags & SRAT_ENABLED) || cpu->x2apic_id >= 256) break;
+            apic_node[cpu->x2apic_id] = numa_domain_node(cpu->proximity);
+            break;
+        }
+        case SRAT_MEMORY_AFFINITY: {
+            const struct AcpiSratMemory *mem = (const void *)ptr;
+            if (!(mem->flags & SRAT_ENABLED) || !mem->size) break;
+            if (numa_nranges == NUMA_MAX_RANGES) {
+                cprintf("NUMA: too many memory ranges\n");
+                break;
+            }
+            numa_ranges[numa_nranges++] = (struct NumaRange){mem->base, mem->base + mem->size,
+                                                             numa_domain_node(mem->proximity)};
+            break;
+        }
+        }
+    }
+
+    if (!numa_nnodes) numa_nnodes = 1;
+}
+
+static void
+numa_parse_slit(const struct AcpiSlit *slit) {
+    size_t n = slit->nlocalities;
+    if (sizeof(*slit) + n * n > slit->h.length) return;
+
+    for (int i = 0; i < numa_nnodes; i++) {
+        for (int j = 0; j < numa_nnodes; j++) {
+            if (node_domain[i] < n && node_domain[j] < n)
+                node_distance[i][j] = slit->distance[node_domain[i] * n + node_domain[j]];
+        }
+    }
+}
+
+void
+numa_init(void) {
+    const struct AcpiSrat *srat = acpi_find_table("SRAT");
+    if (srat) numa_parse_srat(srat);
+
+    /* Without SLIT every remote node is equally far */
+    for (int i = 0; i < numa_nnodes; i++)
+        for (int j = 0; j < numa_nnodes; j++)
+            node_distance[i][j] = i == j ? NUMA_LOCAL_DISTANCE : 2 * NUMA_LOCAL_DISTANCE;
+
+    const struct AcpiSlit *slit = acpi_find_table("SLIT");
+    if (slit) numa_parse_slit(slit);
+
+    for (int i = 0; i < numa_nnodes; i++) {
+        for (int j = 0; j < numa_nnodes; j++) {
+            int k = j;
+            for (; k > 0 && node_distance[i][node_order[i][k - 1]] > node_distance[i][j]; k--)
+                node_order[i][k] = node_order[i][k - 1];
+            node_order[i][k] = j;
+        }
+    }
+
+    /* cpuid is slow, especially under virtualization,
+     * so the node of the CPU is looked up once */
+    uint32_t ebx;
+    cpuid(1, NULL, &ebx, NULL, NULL);
+    cpu_node[cpunum()] = apic_node[ebx >> 24];
+
+    if (trace_init) {
+        cprintf("NUMA: %d node%s", numa_nnodes, numa_nnodes > 1 ? "s" : "");
+        for (size_t i = 0; i < numa_nranges; i++)
+            cprintf(", [%p-%p) on %d", (void *)numa_ranges[i].start, (void *)numa_ranges[i].end, numa_ranges[i].node);
+        cprintf("\n");
+    }
+}
+
+/* Node of physical address 'pa', memory SRAT does not describe is on node 0 */
+int
+numa_node_of(physaddr_t pa) {
+    for (size_t i = 0; i < numa_nranges; i++)
+        if (numa_ranges[i].start <= pa && pa < numa_ranges[i].end) return numa_ranges[i].node;
+    return 0;
+}
+
+int
+numa_cpu_node(int cpu) {
+    return cpu_node[cpu];
+}
+
+/* The 'i'th nearest node to 'node', 'node' itself comes first */
+int
+numa_nearest(int node, int i) {
+    return node_order[node][i];
+}
+
+uint8_t
+numa_distance(int from, int to) {
+    return node_distance[from][to];
+}
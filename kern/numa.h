@@ -0,0 +1,43 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_NUMA_H
+#define JOS_KERN_NUMA_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define NUMA_MAX_NODES  8
+#define NUMA_MAX_RANGES 32
+
+/* Distance of a node to itself, as in SLIT */
+#define NUMA_LOCAL_DISTANCE 10
+
+/* Physical memory range belonging to a node */
+struct NumaRange {
+    physaddr_t start;
+    physaddr_t end;
+    int node;
+};
+
+struct NumaNodeStats {
+    size_t total;  /* Pages the page allocator manages on the node */
+    size_t local;  /* Pages allocated on the node by its own CPUs */
+    size_t remote; /* Pages allocated on the node for other nodes */
+};
+
+extern int numa_nnodes;
+extern struct NumaRange numa_ranges[NUMA_MAX_RANGES];
+extern size_t numa_nranges;
+extern struct NumaNodeStats numa_stats[NUMA_MAX_NODES];
+extern size_t numa_migrations;     /* Envs run on a node other than their own */
+extern size_t numa_migrated_pages; /* Env pages moved along with them */
+
+void numa_init(void);
+int numa_node_of(physaddr_t pa);
+int numa_cpu_node(int cpu);
+int numa_nearest(int node, int i);
+uint8_t numa_distance(int from, int to);
+
+#endif /* !JOS_KERN_NUMA_H */
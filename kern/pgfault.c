@@ -0,0 +1,131 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/pgfault.h>
+#include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/traceopt.h>
+
+/* Page faults are delivered on their own stack (IST1), so a fault
+ * on an overflowing kernel stack still gets handled. A fault nested
+ * inside the handler reuses that stack and is fatal */
+
+#define PF_MAX_REGIONS 16
+
+static struct PfRegion pf_regions[PF_MAX_REGIONS];
+/* Region that resolved the last fault, checked first */
+static struct PfRegion *pf_last;
+
+static struct PfStats pf_stats;
+static uint32_t pf_env[NENV][PF_NTYPES];
+
+static const char *const pf_type_names[PF_NTYPES] = {
+        [PF_DEMAND_ZERO] = "demand-zero",
+        [PF_IMAGE] = "image",
+        [PF_PROTECTION] = "protection",
+        [PF_UNMAPPED] = "unmapped",
+};
+
+const char *
+pgfault_type_name(enum PfType type) {
+    return type < PF_NTYPES ? pf_type_names[type] : "?";
+}
+
+/* Let 'resolve' handle faults in [start, end) */
+int
+pgfault_region_add(uintptr_t start, uintptr_t end, enum PfType type,
+                   int (*resolve)(struct PfRegion *, uintptr_t, uint64_t), void *arg) {
+    assert(start < end);
+
+    struct PfRegion *free = NULL;
+    for (struct PfRegion *reg = pf_regions; reg < pf_regions + PF_MAX_REGIONS; reg++) {
+        if (!reg->resolve) {
+            if (!free) free = reg;
+        } else if (reg->start < end && start < reg->end) {
+            return -E_INVAL;
+        }
+    }
+    if (!free) return -E_NO_MEM;
+
+    *free = (struct PfRegion){start, end, type, resolve, arg};
+    return 0;
+}
+
+void
+pgfault_region_remove(uintptr_t start) {
+    for (struct PfRegion *reg = pf_regions; reg < pf_regions + PF_MAX_REGIONS; reg++) {
+        if (reg->resolve && reg->start == start) {
+            memset(reg, 0, sizeof(*reg));
+            if (pf_last == reg) pf_last = NULL;
+        }
+    }
+}
+
+static struct PfRegion *
+pgfault_region_find(uintptr_t va) {
+    if (pf_last && pf_last->start <= va && va < pf_last->end) return pf_last;
+
+    for (struct PfRegion *reg = pf_regions; reg < pf_regions + PF_MAX_REGIONS; reg++)
+        if (reg->resolve && reg->start <= va && va < reg->end) return reg;
+    return NULL;
+}
+
+/* Tell what kind of fault the access 'err' caused */
+static enum PfType
+pgfault_classify(struct PfRegion *region, uint64_t err) {
+    if (!(err & FEC_P)) return region ? region->type : PF_UNMAPPED;
+    return PF_PROTECTION;
+}
+
+/* Fast path of the page fault handler. Returns true
+ * if the fault was resolved and the access can be retried */
+bool
+pgfault_handle(struct Trapframe *tf) {
+    uint64_t start = read_tsc();
+    uintptr_t va = rcr2();
+    uint64_t err = tf->tf_err;
+
+    struct PfRegion *region = pgfault_region_find(va);
+    enum PfType type = pgfault_classify(region, err);
+
+    bool resolved = 0;
+    if (region && type != PF_PROTECTION && type != PF_UNMAPPED) {
+        resolved = !region->resolve(region, va, err);
+        if (resolved) pf_last = region;
+    }
+
+    pf_stats.count[type]++;
+    pf_stats.resolved += resolved;
+    if (curenv) pf_env[ENVX(curenv->env_id)][type]++;
+
+    uint64_t ticks = read_tsc() - start;
+    pf_stats.hist[ticks ? MIN(63 - __builtin_clzll(ticks), PF_HIST_BUCKETS - 1) : 0]++;
+
+    if (trace_pagefaults) {
+        cprintf("[%08x] %s fault va %p ip %p err %lx: %s in %lu ticks\n",
+                curenv ? curenv->env_id : 0, pgfault_type_name(type), (void *)va,
+                (void *)tf->tf_rip, (unsigned long)err, resolved ? "resolved" : "fatal", (unsigned long)ticks);
+    }
+
+    return resolved;
+}
+
+void
+pgfault_env_reset(envid_t envid) {
+    memset(pf_env[ENVX(envid)], 0, sizeof(pf_env[0]));
+}
+
+const struct PfStats *
+pgfault_get_stats(void) {
+    return &pf_stats;
+}
+
+const uint32_t *
+pgfault_env_counts(envid_t envid) {
+    return pf_env[ENVX(envid)];
+}
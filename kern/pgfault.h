@@ -0,0 +1,50 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PGFAULT_H
+#define JOS_KERN_PGFAULT_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/trap.h>
+#include <inc/env.h>
+
+enum PfType {
+    PF_DEMAND_ZERO, /* Not present, backed by zero pages */
+    PF_IMAGE,       /* Not present, backed by an image or file */
+    PF_PROTECTION,  /* Access that is not allowed */
+    PF_UNMAPPED,    /* Not present and no region claims it */
+    PF_NTYPES
+};
+
+/* Range of kernel virtual addresses whose faults are resolved
+ * by 'resolve'. It returns 0 if the faulting access may be retried */
+struct PfRegion {
+    uintptr_t start;
+    uintptr_t end;
+    enum PfType type; /* Type of not-present faults in the region */
+    int (*resolve)(struct PfRegion *region, uintptr_t va, uint64_t err);
+    void *arg;
+};
+
+/* Log2 buckets of fault handling time in TSC ticks */
+#define PF_HIST_BUCKETS 32
+
+struct PfStats {
+    uint64_t count[PF_NTYPES];
+    uint64_t resolved;
+    uint64_t hist[PF_HIST_BUCKETS];
+};
+
+int pgfault_region_add(uintptr_t start, uintptr_t end, enum PfType type,
+                       int (*resolve)(struct PfRegion *, uintptr_t, uint64_t), void *arg);
+void pgfault_region_remove(uintptr_t start);
+bool pgfault_handle(struct Trapframe *tf);
+void pgfault_env_reset(envid_t envid);
+
+const struct PfStats *pgfault_get_stats(void);
+const uint32_t *pgfault_env_counts(envid_t envid);
+const char *pgfault_type_name(enum PfType type);
+
+#endif /* !JOS_KERN_PGFAULT_H */
@@ -0,0 +1,568 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/uefi.h>
+
+#include <kern/pmap.h>
+#include <kern/kmalloc.h>
+#include <kern/traceopt.h>
+#include <kern/numa.h>
+#include <kern/cpu.h>
+
+/* One bit per physical page below BOOT_MEM_SIZE, set if the page is free */
+static uint64_t page_free_map[MAX_PHYS_PAGES / 64];
+/* Free pages known to contain only zeroes, a subset of page_free_map.
+ * Idle loops fill it so that ALLOC_ZERO does not have to zero pages */
+static uint64_t page_zero_map[MAX_PHYS_PAGES / 64];
+/* Word of page_free_map where the idle zeroing search starts */
+static size_t page_zero_hint;
+
+/* Pages [first, last) of a NUMA node. SRAT ranges need not be
+ * aligned to bitmap words, so a boundary word may be shared with
+ * another zone and only its bits inside the range belong to this one.
+ * The last zone covers all memory on behalf of node 0,
+ * for pages SRAT does not describe and for running out */
+struct PageZone {
+    int node;
+    size_t first;
+    size_t last;
+    size_t hint; /* Word where the search for a free page starts */
+};
+
+static struct PageZone page_zones[NUMA_MAX_RANGES + 1];
+static size_t page_nzones;
+
+static struct PmapStats pmap_stats;
+
+/* Kernel page tables, reached through the direct map */
+static pml4e_t *kern_pml4;
+
+static void
+page_mark_free(size_t pgnum, bool zeroed) {
+    assert(!(page_free_map[pgnum / 64] & (1ULL << (pgnum % 64))));
+    page_free_map[pgnum / 64] |= 1ULL << (pgnum % 64);
+    pmap_stats.free_pages++;
+
+    if (zeroed) {
+        page_zero_map[pgnum / 64] |= 1ULL << (pgnum % 64);
+        pmap_stats.zeroed_pages++;
+    }
+}
+
+/* Bits of bitmap word 'word' for pages in [first, last) */
+static uint64_t
+page_range_mask(size_t word, size_t first, size_t last) {
+    uint64_t mask = ~0ULL;
+    if (word == first / 64) mask &= ~0ULL << (first % 64);
+    if (word == (last - 1) / 64 && last % 64) mask &= ~0ULL >> (64 - last % 64);
+    return mask;
+}
+
+/* Find a free page that is zeroed or not in pages [first, last),
+ * starting at word *hint. The page is taken out of the free map,
+ * returns -1 if there is none */
+static ssize_t
+page_take(bool zeroed, size_t first, size_t last, size_t *hint) {
+    size_t first_word = first / 64, nwords = ROUNDUP(last, 64) / 64 - first_word;
+    for (size_t i = 0; i < nwords; i++) {
+        size_t word = first_word + (*hint - first_word + i) % nwords;
+        uint64_t mask = page_free_map[word] & (zeroed ? page_zero_map[word] : ~page_zero_map[word]);
+        mask &= page_range_mask(word, first, last);
+        if (!mask) continue;
+
+        size_t bit = __builtin_ctzll(mask);
+        page_free_map[word] &= ~(1ULL << bit);
+        page_zero_map[word] &= ~(1ULL << bit);
+        pmap_stats.free_pages--;
+        if (zeroed) pmap_stats.zeroed_pages--;
+        *hint = word;
+
+        return word * 64 + bit;
+    }
+
+    return -1;
+}
+
+/* Take a free page from the zones of 'node', -1 if they have none */
+static ssize_t
+page_take_node(int node, bool want_zero, bool *zeroed) {
+    for (size_t i = 0; i + 1 < page_nzones; i++) {
+        struct PageZone *zone = &page_zones[i];
+        if (zone->node != node) continue;
+
+        ssize_t pgnum = page_take(want_zero, zone->first, zone->last, &zone->hint);
+        *zeroed = want_zero;
+        if (pgnum < 0) {
+            pgnum = page_take(!want_zero, zone->first, zone->last, &zone->hint);
+            *zeroed = !want_zero;
+        }
+        if (pgnum >= 0) return pgnum;
+    }
+
+    return -1;
+}
+
+/* Allocate one physical page, preferably on 'node' and otherwise
+ * on the nearest node that has one. ALLOC_ZERO requests are served
+ * from the pre-zeroed pool first, others leave it alone.
+ * Returns 0 if out of memory, page 0 is never handed out */
+physaddr_t
+page_alloc_node(int flags, int node) {
+    bool want_zero = flags & ALLOC_ZERO, zeroed = 0;
+
+    ssize_t pgnum = -1;
+    int from = node;
+    for (int i = 0; i < numa_nnodes && pgnum < 0; i++)
+        pgnum = page_take_node(from = numa_nearest(node, i), want_zero, &zeroed);
+    if (pgnum < 0) {
+        struct PageZone *all = &page_zones[page_nzones - 1];
+        pgnum = page_take(want_zero, all->first, all->last, &all->hint);
+        zeroed = want_zero;
+        if (pgnum < 0) {
+            pgnum = page_take(!want_zero, all->first, all->last, &all->hint);
+            zeroed = !want_zero;
+        }
+        from = numa_node_of(pgnum * PAGE_SIZE);
+    }
+    if (pgnum < 0) return 0;
+
+    if (from == node) numa_stats[from].local++;
+    else numa_stats[from].remote++;
+
+    physaddr_t pa = pgnum * PAGE_SIZE;
+    if (want_zero) {
+        if (zeroed) {
+            pmap_stats.zero_hits++;
+        } else {
+            memset(KADDR(pa), 0, PAGE_SIZE);
+            pmap_stats.zero_misses++;
+        }
+    }
+
+    if (trace_memory_more) cprintf("page_alloc: %p\n", (void *)pa);
+    return pa;
+}
+
+/* Allocate a page on the node of the executing CPU */
+physaddr_t
+page_alloc(int flags) {
+    return page_alloc_node(flags, numa_cpu_node(cpunum()));
+}
+
+/* Number of free pages on 'node' */
+size_t
+page_free_on_node(int node) {
+    size_t free = 0;
+
+    for (size_t i = 0; i + 1 < page_nzones; i++) {
+        if (page_zones[i].node != node) continue;
+        size_t first = page_zones[i].first, last = page_zones[i].last;
+        for (size_t word = first / 64; word < ROUNDUP(last, 64) / 64; word++)
+            free += __builtin_popcountll(page_free_map[word] & page_range_mask(word, first, last));
+    }
+
+    /* Without SRAT ranges all memory is on node 0 */
+    if (page_nzones == 1 && !node) free = pmap_stats.free_pages;
+    return free;
+}
+
+/* Zero free pages into the pre-zeroed pool until it holds
+ * PAGE_ZERO_POOL pages or wake() reports there is work to do.
+ * Pages are zeroed with non-temporal stores PAGE_ZERO_CHUNK bytes
+ * at a time, and pending interrupts are let in after every chunk.
+ * Only call it from idle loops that may enable interrupts, the
+ * caller's interrupt flag is restored on return */
+void
+page_zero_idle(bool (*wake)(void)) {
+    uint64_t rflags = read_rflags();
+
+    while (pmap_stats.zeroed_pages < PAGE_ZERO_POOL && !(wake && wake())) {
+        /* The page stays out of the free map while it is being zeroed */
+        ssize_t pgnum = page_take(0, 0, MAX_PHYS_PAGES, &page_zero_hint);
+        if (pgnum < 0) break;
+
+        uint64_t *va = KADDR(pgnum * PAGE_SIZE);
+        for (size_t off = 0; off < PAGE_SIZE / sizeof(*va);) {
+            for (size_t end = off + PAGE_ZERO_CHUNK / sizeof(*va); off < end; off++)
+                movnti(va + off, 0);
+            asm volatile("sti\n\tnop\n\tcli" ::: "memory");
+        }
+        sfence();
+
+        page_mark_free(pgnum, 1);
+        pmap_stats.zeroed_total++;
+    }
+
+    write_rflags(rflags);
+}
+
+void
+page_free(physaddr_t pa) {
+    assert(pa && !(pa & (PAGE_SIZE - 1)) && pa < BOOT_MEM_SIZE);
+    if (trace_memory_more) cprintf("page_free: %p\n", (void *)pa);
+    page_mark_free(pa / PAGE_SIZE, 0);
+}
+
+#define HUGE_PAGE_PAGES (HUGE_PAGE_SIZE / PAGE_SIZE)
+#define HUGE_PAGE_WORDS (HUGE_PAGE_PAGES / 64)
+
+/* Allocate HUGE_PAGE_SIZE aligned, physically contiguous
+ * HUGE_PAGE_SIZE bytes. Returns 0 if there is no such run */
+physaddr_t
+page_alloc_huge(int flags) {
+    for (size_t word = 0; word < MAX_PHYS_PAGES / 64; word += HUGE_PAGE_WORDS) {
+        bool free = 1, zeroed = 1;
+        for (size_t i = 0; i < HUGE_PAGE_WORDS && free; i++) {
+            free = page_free_map[word + i] == ~0ULL;
+            zeroed &= page_zero_map[word + i] == ~0ULL;
+        }
+        if (!free) continue;
+
+        for (size_t i = 0; i < HUGE_PAGE_WORDS; i++) {
+            pmap_stats.zeroed_pages -= __builtin_popcountll(page_zero_map[word + i]);
+            page_free_map[word + i] = page_zero_map[word + i] = 0;
+        }
+        pmap_stats.free_pages -= HUGE_PAGE_PAGES;
+
+        physaddr_t pa = word * 64 * PAGE_SIZE;
+        if ((flags & ALLOC_ZERO) && !zeroed) memset(KADDR(pa), 0, HUGE_PAGE_SIZE);
+        if (trace_memory_more) cprintf("page_alloc_huge: %p\n", (void *)pa);
+        return pa;
+    }
+
+    return 0;
+}
+
+void
+page_free_huge(physaddr_t pa) {
+    assert(pa && !(pa & (HUGE_PAGE_SIZE - 1)) && pa < BOOT_MEM_SIZE);
+    if (trace_memory_more) cprintf("page_free_huge: %p\n", (void *)pa);
+    for (size_t i = 0; i < HUGE_PAGE_PAGES; i++)
+        page_mark_free(pa / PAGE_SIZE + i, 0);
+}
+
+/* Return the next level table for entry 'pte', allocating
+ * it if 'create' is set. Returns NULL if there is none */
+static uint64_t *
+pmap_next(uint64_t *pte, bool create) {
+    if (*pte & PTE_P) {
+        assert(!(*pte & PTE_PS));
+        return KADDR(PTE_ADDR(*pte));
+    }
+    if (!create) return NULL;
+
+    physaddr_t pa = page_alloc(ALLOC_ZERO);
+    if (!pa) return NULL;
+    pmap_stats.pt_pages++;
+
+    *pte = pa | PTE_P | PTE_W;
+    return KADDR(pa);
+}
+
+/* Find the page directory entry of kernel address 'va' */
+static pde_t *
+kpde(uintptr_t va, bool create) {
+    pdpe_t *pdp = pmap_next(&kern_pml4[PML4_INDEX(va)], create);
+    if (!pdp) return NULL;
+    pde_t *pd = pmap_next(&pdp[PDP_INDEX(va)], create);
+    if (!pd) return NULL;
+    return &pd[PD_INDEX(va)];
+}
+
+/* Find the page table entry of kernel address 'va',
+ * a huge page mapping it is split up first */
+static pte_t *
+kpte(uintptr_t va, bool create) {
+    pde_t *pde = kpde(va, create);
+    if (!pde) return NULL;
+    if ((*pde & PTE_PS) && kdemote(va) < 0) return NULL;
+    pte_t *pt = pmap_next(pde, create);
+    if (!pt) return NULL;
+    return &pt[PT_INDEX(va)];
+}
+
+/* Find the entry mapping 'va', which is a page directory
+ * entry for huge pages. Nothing is allocated or split up */
+uint64_t *
+kpte_find(uintptr_t va) {
+    uint64_t *pte = &kern_pml4[PML4_INDEX(va)];
+    if (!(*pte & PTE_P)) return NULL;
+    pte = (uint64_t *)KADDR(PTE_ADDR(*pte)) + PDP_INDEX(va);
+    if (!(*pte & PTE_P) || (*pte & PTE_PS)) return pte;
+    pte = (uint64_t *)KADDR(PTE_ADDR(*pte)) + PD_INDEX(va);
+    if (!(*pte & PTE_P) || (*pte & PTE_PS)) return pte;
+    return (uint64_t *)KADDR(PTE_ADDR(*pte)) + PT_INDEX(va);
+}
+
+/* Map 4K page 'pa' at kernel address 'va'.
+ * Page tables are allocated as needed */
+int
+kmap_page(uintptr_t va, physaddr_t pa, uint64_t perm) {
+    pte_t *pte = kpte(va, 1);
+    if (!pte) return -E_NO_MEM;
+
+    assert(!(*pte & PTE_P));
+    *pte = PTE_ADDR(pa) | perm | PTE_P;
+    return 0;
+}
+
+/* Remove mapping of kernel address 'va'
+ * and return the page it was mapped to */
+physaddr_t
+kunmap_page(uintptr_t va) {
+    pte_t *pte = kpte(va, 0);
+    if (!pte || !(*pte & PTE_P)) return 0;
+
+    physaddr_t pa = PTE_ADDR(*pte);
+    *pte = 0;
+    invlpg((void *)va);
+    return pa;
+}
+
+/* Map huge page 'pa' at HUGE_PAGE_SIZE aligned kernel address 'va' */
+int
+kmap_huge(uintptr_t va, physaddr_t pa, uint64_t perm) {
+    assert(!(va & (HUGE_PAGE_SIZE - 1)) && !(pa & (HUGE_PAGE_SIZE - 1)));
+
+    pde_t *pde = kpde(va, 1);
+    if (!pde) return -E_NO_MEM;
+
+    assert(!(*pde & PTE_P));
+    *pde = pa | perm | PTE_PS | PTE_P;
+    pmap_stats.huge_pages++;
+    return 0;
+}
+
+/* Remove huge page mapping of 'va' and return the memory it
+ * was mapped to, 0 if 'va' is not mapped with a huge page */
+physaddr_t
+kunmap_huge(uintptr_t va) {
+    pde_t *pde = kpde(va, 0);
+    if (!pde || (*pde & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS)) return 0;
+
+    physaddr_t pa = PTE_ADDR(*pde);
+    *pde = 0;
+    pmap_stats.huge_pages--;
+    for (uintptr_t off = 0; off < HUGE_PAGE_SIZE; off += PAGE_SIZE)
+        invlpg((void *)(va + off));
+    return pa;
+}
+
+/* Back 'npages' pages at kernel address 'va' with fresh memory.
+ * HUGE_PAGE_SIZE aligned spans get huge pages when contiguous
+ * physical memory is available, the rest is mapped with 4K pages
+ * taken from 'node' first. 'flags' are passed to the page allocator */
+int
+kmap_span(uintptr_t va, size_t npages, uint64_t perm, int flags, int node) {
+    for (size_t i = 0; i < npages;) {
+        uintptr_t cur = va + i * PAGE_SIZE;
+
+        if (!(cur & (HUGE_PAGE_SIZE - 1)) && npages - i >= HUGE_PAGE_PAGES) {
+            physaddr_t pa = page_alloc_huge(flags);
+            if (pa && kmap_huge(cur, pa, perm) == 0) {
+                i += HUGE_PAGE_PAGES;
+                continue;
+            }
+            if (pa) page_free_huge(pa);
+            pmap_stats.huge_fallbacks++;
+        }
+
+        physaddr_t pa = page_alloc_node(flags, node);
+        if (!pa || kmap_page(cur, pa, perm) < 0) {
+            if (pa) page_free(pa);
+            kunmap_span(va, i);
+            return -E_NO_MEM;
+        }
+        i++;
+    }
+
+    return 0;
+}
+
+/* Move the 4K pages mapped at 'va' that are not on 'node' to
+ * pages of 'node', contents and permissions are kept. Huge pages
+ * stay where they are. Stops when 'node' has no free pages left.
+ * Only the boot CPU runs, so flushing its TLB is enough.
+ * Returns the number of pages moved */
+size_t
+kmigrate_span(uintptr_t va, size_t npages, int node) {
+    size_t moved = 0;
+
+    for (size_t i = 0; i < npages; i++) {
+        uintptr_t cur = va + i * PAGE_SIZE;
+        pde_t *pde = kpde(cur, 0);
+        if (!pde || (*pde & (PTE_P | PTE_PS)) != PTE_P) continue;
+        pte_t *pte = (pte_t *)KADDR(PTE_ADDR(*pde)) + PT_INDEX(cur);
+        if (!(*pte & PTE_P)) continue;
+
+        physaddr_t old = PTE_ADDR(*pte);
+        if (numa_node_of(old) == node) continue;
+
+        physaddr_t pa = page_alloc_node(0, node);
+        if (pa && numa_node_of(pa) != node) {
+            page_free(pa);
+            pa = 0;
+        }
+        if (!pa) break;
+
+        memcpy(KADDR(pa), KADDR(old), PAGE_SIZE);
+        *pte = pa | (*pte & (PTE_NX | (PAGE_SIZE - 1)));
+        invlpg((void *)cur);
+        page_free(old);
+        moved++;
+    }
+
+    return moved;
+}
+
+/* Unmap 'npages' pages at 'va' mapped by kmap_span() and free them */
+void
+kunmap_span(uintptr_t va, size_t npages) {
+    for (size_t i = 0; i < npages;) {
+        uintptr_t cur = va + i * PAGE_SIZE;
+
+        if (!(cur & (HUGE_PAGE_SIZE - 1)) && npages - i >= HUGE_PAGE_PAGES) {
+            physaddr_t pa = kunmap_huge(cur);
+            if (pa) {
+                page_free_huge(pa);
+                i += HUGE_PAGE_PAGES;
+                continue;
+            }
+        }
+
+        physaddr_t pa = kunmap_page(cur);
+        if (pa) page_free(pa);
+        i++;
+    }
+}
+
+/* Split the huge page mapping 'va' into 4K pages
+ * with the same physical memory and permissions */
+int
+kdemote(uintptr_t va) {
+    pde_t *pde = kpde(va, 0);
+    assert(pde && (*pde & PTE_PS));
+
+    physaddr_t ptpa = page_alloc(0);
+    if (!ptpa) return -E_NO_MEM;
+    pmap_stats.pt_pages++;
+
+    physaddr_t pa = PTE_ADDR(*pde);
+    uint64_t perm = (*pde & ~PTE_ADDR(*pde)) & ~PTE_PS;
+    pte_t *pt = KADDR(ptpa);
+    for (size_t i = 0; i < PT_ENTRY_COUNT; i++)
+        pt[i] = (pa + i * PAGE_SIZE) | perm;
+
+    /* Translations do not change, so stale TLB entries are harmless */
+    *pde = ptpa | PTE_P | PTE_W;
+    pmap_stats.huge_pages--;
+    pmap_stats.huge_demotions++;
+    return 0;
+}
+
+/* Replace the 4K mappings of the HUGE_PAGE_SIZE aligned range
+ * at 'va' with a huge page. If the pages are not physically
+ * contiguous and aligned, they are copied into a fresh huge page.
+ * All pages of the range must be mapped with equal permissions.
+ * Returns 1 if the range is already mapped with a huge page */
+int
+kpromote(uintptr_t va) {
+    assert(!(va & (HUGE_PAGE_SIZE - 1)));
+
+    pde_t *pde = kpde(va, 0);
+    if (!pde || !(*pde & PTE_P)) return -E_INVAL;
+    if (*pde & PTE_PS) return 1;
+
+    pte_t *pt = KADDR(PTE_ADDR(*pde));
+    uint64_t perm = pt[0] & ~PTE_ADDR(pt[0]) & ~(PTE_A | PTE_D);
+    bool contiguous = !(PTE_ADDR(pt[0]) & (HUGE_PAGE_SIZE - 1));
+    for (size_t i = 0; i < PT_ENTRY_COUNT; i++) {
+        if (!(pt[i] & PTE_P) || (pt[i] & ~PTE_ADDR(pt[i]) & ~(PTE_A | PTE_D)) != perm)
+            return -E_INVAL;
+        contiguous &= PTE_ADDR(pt[i]) == PTE_ADDR(pt[0]) + i * PAGE_SIZE;
+    }
+
+    physaddr_t pa = PTE_ADDR(pt[0]);
+    if (!contiguous) {
+        pa = page_alloc_huge(0);
+        if (!pa) return -E_NO_MEM;
+        for (size_t i = 0; i < PT_ENTRY_COUNT; i++)
+            memcpy(KADDR(pa + i * PAGE_SIZE), (void *)(va + i * PAGE_SIZE), PAGE_SIZE);
+    }
+
+    physaddr_t ptpa = PTE_ADDR(*pde);
+    *pde = pa | perm | PTE_PS;
+    for (uintptr_t off = 0; off < HUGE_PAGE_SIZE; off += PAGE_SIZE)
+        invlpg((void *)(va + off));
+
+    if (!contiguous) {
+        for (size_t i = 0; i < PT_ENTRY_COUNT; i++)
+            page_free(PTE_ADDR(pt[i]));
+    }
+    page_free(ptpa);
+    pmap_stats.pt_pages--;
+    pmap_stats.huge_pages++;
+    pmap_stats.huge_promotions++;
+    return 0;
+}
+
+const struct PmapStats *
+pmap_get_stats(void) {
+    return &pmap_stats;
+}
+
+/* Hand all conventional memory from the UEFI memory map
+ * to the page allocator, except for what the kernel,
+ * its embedded programs and their stacks occupy */
+static void
+page_init(void) {
+    extern char end[];
+
+    physaddr_t reserved = MAX(ROUNDUP(PADDR(end), PAGE_SIZE), MAX_LOW_ADDR_KERN_SIZE);
+
+    EFI_MEMORY_DESCRIPTOR *mmap = (EFI_MEMORY_DESCRIPTOR *)uefi_lp->MemoryMap;
+    EFI_MEMORY_DESCRIPTOR *mmap_end = (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)mmap + uefi_lp->MemoryMapSize);
+
+    for (; mmap < mmap_end; mmap = (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)mmap + uefi_lp->MemoryMapDescriptorSize)) {
+        if (mmap->Type != EFI_CONVENTIONAL_MEMORY) continue;
+
+        physaddr_t start = MAX(mmap->PhysicalStart, reserved);
+        physaddr_t stop = MIN(mmap->PhysicalStart + mmap->NumberOfPages * EFI_PAGE_SIZE, BOOT_MEM_SIZE);
+
+        for (physaddr_t pa = start; pa < stop; pa += PAGE_SIZE) {
+            page_mark_free(pa / PAGE_SIZE, 0);
+            pmap_stats.total_pages++;
+            numa_stats[numa_node_of(pa)].total++;
+        }
+    }
+
+    /* One zone per SRAT memory range the allocator can reach */
+    for (size_t i = 0; i < numa_nranges; i++) {
+        if (numa_ranges[i].start >= BOOT_MEM_SIZE) continue;
+
+        size_t first = ROUNDUP(numa_ranges[i].start, PAGE_SIZE) / PAGE_SIZE;
+        size_t last = MIN(numa_ranges[i].end, BOOT_MEM_SIZE) / PAGE_SIZE;
+        if (first >= last) continue;
+        page_zones[page_nzones++] = (struct PageZone){numa_ranges[i].node, first, last, first / 64};
+    }
+    page_zones[page_nzones++] = (struct PageZone){0, 0, MAX_PHYS_PAGES, 0};
+
+    if (trace_memory) cprintf("Physical memory: %luK available\n", (unsigned long)(pmap_stats.total_pages * PAGE_SIZE / 1024));
+}
+
+void
+pmap_init(void) {
+    kern_pml4 = KADDR(rcr3());
+
+    /* Programs run in ring 0, read-only mappings such as shared
+     * page cache pages only stop their writes with CR0.WP set.
+     * Don't rely on the firmware having set it */
+    lcr0(rcr0() | CR0_WP);
+
+    page_init();
+    kmalloc_init();
+}
@@ -0,0 +1,85 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
+#include <inc/assert.h>
+
+/* Physical memory the allocator manages, it is all
+ * directly mapped at KERN_BASE_ADDR by the boot page tables */
+#define MAX_PHYS_PAGES (BOOT_MEM_SIZE / PAGE_SIZE)
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERN_BASE_ADDR, where the machine's maximum 1GB of physical memory is mapped --
+ * and returns the corresponding physical address.  It panics if you pass it a
+ * non-kernel virtual address */
+#define PADDR(kva) _paddr(__FILE__, __LINE__, kva)
+
+static inline physaddr_t
+_paddr(const char *file, int line, void *kva) {
+    if ((uintptr_t)kva < KERN_BASE_ADDR || (uintptr_t)kva >= KERN_BASE_ADDR + BOOT_MEM_SIZE)
+        _panic(file, line, "PADDR called with invalid kva %p", kva);
+    return (physaddr_t)kva - KERN_BASE_ADDR;
+}
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address */
+#define KADDR(pa) _kaddr(__FILE__, __LINE__, pa)
+
+static inline void *
+_kaddr(const char *file, int line, physaddr_t pa) {
+    if (pa >= BOOT_MEM_SIZE)
+        _panic(file, line, "KADDR called with invalid pa %p", (void *)pa);
+    return (void *)(pa + KERN_BASE_ADDR);
+}
+
+/* Flags for page_alloc() */
+#define ALLOC_ZERO 0x1 /* Fill the page with zeroes */
+
+/* Number of free pages idle loops keep zeroed in advance */
+#define PAGE_ZERO_POOL 512
+/* Bytes zeroed between two interrupt windows */
+#define PAGE_ZERO_CHUNK 512
+
+struct PmapStats {
+    size_t total_pages; /* Pages the allocator was given */
+    size_t free_pages;
+    size_t pt_pages;     /* Pages used for kernel page tables */
+    size_t zeroed_pages; /* Free pages in the pre-zeroed pool */
+    size_t zeroed_total; /* Pages ever zeroed by idle loops */
+    size_t zero_hits;    /* ALLOC_ZERO requests served from the pool */
+    size_t zero_misses;  /* ALLOC_ZERO requests zeroed on the spot */
+    size_t huge_pages;      /* Live huge page mappings */
+    size_t huge_fallbacks;  /* Huge page requests served with 4K pages */
+    size_t huge_promotions;
+    size_t huge_demotions;
+};
+
+void pmap_init(void);
+const struct PmapStats *pmap_get_stats(void);
+
+physaddr_t page_alloc(int flags);
+physaddr_t page_alloc_node(int flags, int node);
+size_t page_free_on_node(int node);
+void page_free(physaddr_t pa);
+void page_zero_idle(bool (*wake)(void));
+physaddr_t page_alloc_huge(int flags);
+void page_free_huge(physaddr_t pa);
+
+uint64_t *kpte_find(uintptr_t va);
+int kmap_page(uintptr_t va, physaddr_t pa, uint64_t perm);
+physaddr_t kunmap_page(uintptr_t va);
+int kmap_huge(uintptr_t va, physaddr_t pa, uint64_t perm);
+physaddr_t kunmap_huge(uintptr_t va);
+int kpromote(uintptr_t va);
+int kdemote(uintptr_t va);
+int kmap_span(uintptr_t va, size_t npages, uint64_t perm, int flags, int node);
+void kunmap_span(uintptr_t va, size_t npages);
+size_t kmigrate_span(uintptr_t va, size_t npages, int node);
+
+#endif /* !JOS_KERN_PMAP_H */
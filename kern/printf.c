@@ -5,6 +5,8 @@
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
 
+#include <kern/console.h>
+
 static void
 putch(int ch, int *cnt) {
     cputchar(ch);
@@ -16,6 +18,7 @@ vcprintf(const char *fmt, va_list ap) {
     int count = 0;
 
     vprintfmt((void *)putch, &count, fmt, ap);
+    fb_flush();
 
     return count;
 }
@@ -29,3 +32,16 @@ cprintf(const char *fmt, ...) {
 
     return res;
 }
+
+int
+cprintf_desc(struct FmtDesc *desc, const char *fmt, ...) {
+    int count = 0;
+
+    va_list ap;
+    va_start(ap, fmt);
+    vprintfmt_desc((void *)putch, &count, desc, fmt, ap);
+    va_end(ap);
+    fb_flush();
+
+    return count;
+}
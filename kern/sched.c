@@ -2,88 +2,172 @@
 #include <inc/x86.h>
 #include <kern/env.h>
 #include <kern/monitor.h>
+#include <kern/vsyscall.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/cpu.h>
+#include <kern/workq.h>
 
+/* CPUID.01H:ECX, MONITOR/MWAIT support */
+#define CPUID_ECX_MONITOR (1 << 3)
 
 struct Taskstate cpu_ts;
-_Noreturn void sched_halt(void);
 
-/* Choose a user environment to run and run it */
-_Noreturn void
-sched_yield(void) {
-    /* Implement simple round-robin scheduling.
-     *
-     * Search through 'envs' for an ENV_RUNNABLE environment in
-     * circular fashion starting just after the env was
-     * last running.  Switch to the first such environment found.
-     *
-     * If no envs are runnable, but the environment previously
-     * running is still ENV_RUNNING, it's okay to
-     * choose that environment.
-     *
-     * If there are no runnable environments,
-     * simply drop through to the code
-     * below to halt the cpu */
+/* Idle environment of each CPU, created the first time the CPU
+ * has nothing to run. It is never saved, every run starts it anew */
+static struct Env *idle_envs[NCPU];
+static struct SchedIdleStats idle_stats[NCPU];
 
-    // LAB 3: Your code here:
+/* MONITOR/MWAIT are supported, set by sched_idle_init() */
+static bool idle_mwait;
+/* Line armed by MONITOR. Interrupts end the wait, so it only has to exist
+ * until something needs to wake an idle CPU with a store */
+static volatile uint64_t idle_wakeup[NCPU][CPU_CACHE_LINE / sizeof(uint64_t)] __attribute__((aligned(CPU_CACHE_LINE)));
+
+static bool
+env_is_idle(const struct Env *env) {
+    return env->env_type == ENV_TYPE_IDLE;
+}
 
+/* Checks whether some environment is waiting for the CPU */
+static bool
+sched_has_work(void) {
+    for (size_t i = 0; i < NENV; i++)
+        if (envs[i].env_status == ENV_RUNNABLE && !env_is_idle(&envs[i])) return 1;
+    return 0;
+}
 
-    struct Env *lastEnv = &envs[NENV - 1];
+/* Checks whether the idle environment should stop what it is doing */
+static bool
+sched_idle_wake(void) {
+    return sched_has_work() || work_pending();
+}
+
+/* Waits for an interrupt in the deepest state we know of and accounts
+ * the time spent there. Called and returns with interrupts disabled,
+ * they are enabled by the instruction just before the wait, so an
+ * interrupt arriving in between still ends it */
+static void
+sched_idle_wait(void) {
+    struct SchedIdleStats *stats = &idle_stats[cpunum()];
+    enum SchedIdleState state = idle_mwait ? IDLE_MWAIT : IDLE_HLT;
+    uint64_t start = read_tsc();
+
+    if (idle_mwait) {
+        volatile uint64_t *line = idle_wakeup[cpunum()];
+        asm volatile("monitor" ::"a"(line), "c"(0), "d"(0));
+        /* Hint 0 is C1, ECX bit 0 makes interrupts break the wait */
+        if (!sched_idle_wake()) asm volatile("sti\n\tmwait\n\tcli" ::"a"(0), "c"(0) : "memory");
+    } else {
+        asm volatile("sti\n\thlt\n\tcli" ::: "memory");
+    }
 
-    for (struct Env *curr = curenv == NULL || curenv == lastEnv ? envs : curenv + 1;
-         curr != curenv;
-         curr = curr == lastEnv ? envs : curr + 1) {
+    stats->entries[state]++;
+    stats->tsc[state] += read_tsc() - start;
+}
 
-        if (curr->env_status == ENV_DYING) {
-            env_free(curr);
-            continue;
+/* Body of the idle environments: gives the CPU away as soon as
+ * there is something to run, otherwise runs deferred work and other
+ * housekeeping in small chunks and waits for interrupts */
+static _Noreturn void
+sched_idle(void) {
+    struct SchedIdleStats *stats = &idle_stats[cpunum()];
+
+    for (;;) {
+        if (sched_has_work()) sched_yield();
+
+        uint64_t start = read_tsc();
+        if (work_pending()) {
+            work_run(WORK_BUDGET);
+        } else {
+            /* Refill the pool of zeroed pages */
+            page_zero_idle(sched_idle_wake);
         }
+        stats->entries[IDLE_WORK]++;
+        stats->tsc[IDLE_WORK] += read_tsc() - start;
 
-        if (curr->env_status == ENV_RUNNABLE) {
-            env_run(curr);
-        };
+        if (!sched_idle_wake()) sched_idle_wait();
     }
+}
 
-    if (curenv->env_status == ENV_RUNNING) {
-        env_run(curenv);
-    } else if (curenv->env_status == ENV_DYING)
-        env_free(curenv);
-
-    cprintf("Halt\n");
+void
+sched_idle_init(void) {
+    uint32_t ecx;
+    cpuid(1, NULL, NULL, &ecx, NULL);
+    idle_mwait = !!(ecx & CPUID_ECX_MONITOR);
+}
 
-    /* No runnable environments,
-     * so just halt the cpu */
-    sched_halt();
+const struct SchedIdleStats *
+sched_idle_stats(int cpu) {
+    return &idle_stats[cpu];
 }
 
-/* Halt this CPU when there is nothing to do. Wait until the
- * timer interrupt wakes it up. This function never returns */
-_Noreturn void
-sched_halt(void) {
+/* Switches to the idle environment of this CPU,
+ * or to the monitor if there is nothing left to wait for */
+static _Noreturn void
+sched_idle_enter(void) {
+    /* Destroyed environments may still be waiting to be freed */
+    while (work_run(WORK_BUDGET))
+        ;
 
     /* For debugging and testing purposes, if there are no runnable
      * environments in the system, then drop into the kernel monitor */
     int i;
     for (i = 0; i < NENV; i++)
-        if (envs[i].env_status == ENV_RUNNABLE ||
-            envs[i].env_status == ENV_RUNNING) break;
+        if (!env_is_idle(&envs[i]) &&
+            (envs[i].env_status == ENV_RUNNABLE ||
+             envs[i].env_status == ENV_RUNNING ||
+             envs[i].env_status == ENV_NOT_RUNNABLE)) break;
     if (i == NENV) {
         cprintf("No runnable environments in the system!\n");
         for (;;) monitor(NULL);
     }
 
-    /* Mark that no environment is running on CPU */
-    curenv = NULL;
+    struct Env **idle = &idle_envs[cpunum()];
+    if (!*idle) {
+        int res = env_alloc_idle(idle, sched_idle);
+        if (res < 0) panic("sched: can't create idle environment: %i", res);
+    }
 
-    /* Reset stack pointer, enable interrupts and then halt */
-    asm volatile(
-            "movq $0, %%rbp\n"
-            "movq %0, %%rsp\n"
-            "pushq $0\n"
-            "pushq $0\n"
-            "sti\n"
-            "hlt\n" ::"a"(cpu_ts.ts_rsp0));
+    vsys[VSYS_sched_halts]++;
+    env_idle_reset(*idle, sched_idle);
+    env_run(*idle);
+}
 
-    /* Unreachable */
-    for (;;)
-        ;
+/* Choose a user environment to run and run it */
+_Noreturn void
+sched_yield(void) {
+    /* Implement simple round-robin scheduling.
+     *
+     * Search through 'envs' for an ENV_RUNNABLE environment in
+     * circular fashion starting just after the env was
+     * last running.  Switch to the first such environment found.
+     *
+     * If no envs are runnable, but the environment previously
+     * running is still ENV_RUNNING, it's okay to
+     * choose that environment.
+     *
+     * If there are no runnable environments,
+     * run the idle environment of this CPU */
+
+    // LAB 3: Your code here:
+
+    /* Safe point for deferred work, such as freeing destroyed envs */
+    work_run(WORK_BUDGET);
+
+    /* The current env is looked at last */
+    size_t start = curenv ? curenv - envs + 1 : 0;
+
+    for (size_t i = 0; i < NENV; i++) {
+        struct Env *curr = &envs[(start + i) % NENV];
+
+        if (env_is_idle(curr)) continue;
+
+        if (curr->env_status == ENV_RUNNABLE ||
+            (curr == curenv && curr->env_status == ENV_RUNNING)) {
+            env_run(curr);
+        }
+    }
+
+    sched_idle_enter();
 }
@@ -6,6 +6,23 @@
 #error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
+/* Where idle CPUs spend their time */
+enum SchedIdleState {
+    IDLE_WORK,  /* Housekeeping */
+    IDLE_HLT,   /* Halted */
+    IDLE_MWAIT, /* Waiting in MWAIT C1 */
+    IDLE_NSTATES
+};
+
+struct SchedIdleStats {
+    uint64_t entries[IDLE_NSTATES];
+    uint64_t tsc[IDLE_NSTATES]; /* TSC ticks spent in each state */
+};
+
 _Noreturn void sched_yield(void);
+void sched_idle_init(void);
+const struct SchedIdleStats *sched_idle_stats(int cpu);
 
 #endif /* !JOS_KERN_SCHED_H */
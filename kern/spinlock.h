@@ -0,0 +1,28 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SPINLOCK_H
+#define JOS_KERN_SPINLOCK_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Test-and-test-and-set lock. Waiters spin on a plain
+ * load so that the cache line stays shared until release */
+struct spinlock {
+    volatile uint32_t locked;
+};
+
+static inline void
+spin_lock(struct spinlock *lk) {
+    while (__atomic_exchange_n(&lk->locked, 1, __ATOMIC_ACQUIRE))
+        while (lk->locked) asm volatile("pause");
+}
+
+static inline void
+spin_unlock(struct spinlock *lk) {
+    __atomic_store_n(&lk->locked, 0, __ATOMIC_RELEASE);
+}
+
+#endif /* !JOS_KERN_SPINLOCK_H */
@@ -0,0 +1,225 @@
+/* Hierarchical timing wheel, see kern/timer.h */
+
+#include <inc/types.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/trap.h>
+
+#include <kern/timer.h>
+#include <kern/kclock.h>
+#include <kern/picirq.h>
+#include <kern/vsyscall.h>
+#include <kern/workq.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* Ticks covered by one slot of a level */
+#define TIMER_WHEEL_SPAN(level) (1ULL << (TIMER_WHEEL_BITS * (level)))
+/* Timers further away are parked in the last level and cascaded again */
+#define TIMER_WHEEL_MAX (TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS) - 1)
+
+/* Only the boot CPU takes clock interrupts, so there is one wheel.
+ * It is only changed with interrupts disabled */
+static struct {
+    struct Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t clk; /* First tick not expired yet */
+    bool ticking; /* RTC periodic interrupt is enabled */
+} wheel;
+
+static struct TimerStats timer_stats;
+static struct Work timer_work;
+
+/* Ticks since vsys_init(), avoids 128-bit division */
+uint64_t
+timer_ticks(void) {
+    uint64_t hz = vsys[VSYS_tsc_hz];
+    uint64_t delta = read_tsc() - vsys[VSYS_tsc_base];
+    return delta / hz * TIMER_HZ + delta % hz * TIMER_HZ / hz;
+}
+
+/* Rounds up, so that a timer never expires early */
+static uint64_t
+ns_to_ticks(uint64_t ns) {
+    return ns / NSEC_PER_SEC * TIMER_HZ + (ns % NSEC_PER_SEC * TIMER_HZ + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
+
+/* Picks the tick in [expires, expires + slack]
+ * with the most trailing zero bits */
+static uint64_t
+timer_apply_slack(uint64_t expires, uint64_t slack) {
+    if (!slack) return expires;
+
+    uint64_t limit = expires + slack;
+    int bit = 63 - __builtin_clzll(expires ^ limit);
+    return limit & ~((1ULL << bit) - 1);
+}
+
+static void
+wheel_insert(struct Timer *timer) {
+    uint64_t delta = timer->expires > wheel.clk ? timer->expires - wheel.clk : 0;
+    delta = MIN(delta, TIMER_WHEEL_MAX);
+    uint64_t expires = wheel.clk + delta;
+
+    int level = 0;
+    while (delta >= TIMER_WHEEL_SPAN(level + 1)) level++;
+
+    size_t index = (expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    struct Timer **slot = &wheel.slots[level][index];
+
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+static void
+wheel_remove(struct Timer *timer) {
+    if (timer->next) timer->next->pprev = timer->pprev;
+    *timer->pprev = timer->next;
+    timer->pprev = NULL;
+}
+
+/* Moves the timers of the slot of 'level' the wheel has
+ * turned into to lower levels */
+static void
+wheel_cascade(int level) {
+    size_t index = (wheel.clk >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    struct Timer *timer = wheel.slots[level][index];
+    wheel.slots[level][index] = NULL;
+
+    while (timer) {
+        struct Timer *next = timer->next;
+        wheel_insert(timer);
+        timer_stats.cascaded++;
+        timer = next;
+    }
+}
+
+/* Expires everything due up to now, runs as deferred work */
+static void
+timer_run(struct Work *work) {
+    uint64_t now = timer_ticks();
+
+    while (wheel.clk <= now) {
+        if (!timer_stats.pending) {
+            wheel.clk = now + 1;
+            break;
+        }
+
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (wheel.clk & (TIMER_WHEEL_SPAN(level) - 1)) break;
+            wheel_cascade(level);
+        }
+
+        struct Timer **slot = &wheel.slots[0][wheel.clk & (TIMER_WHEEL_SLOTS - 1)];
+        struct Timer *timer = *slot;
+        *slot = NULL;
+        wheel.clk++;
+
+        if (timer) timer_stats.batches++;
+
+        /* Callbacks may arm timers again, they go to later slots */
+        while (timer) {
+            struct Timer *next = timer->next;
+            timer->pprev = NULL;
+            timer_stats.pending--;
+            timer_stats.fired++;
+            timer->func(timer);
+            timer = next;
+        }
+    }
+
+    if (!timer_stats.pending && wheel.ticking) {
+        rtc_timer_enable(0);
+        wheel.ticking = 0;
+    }
+}
+
+void
+timer_init(void) {
+    work_init(&timer_work, timer_run, NULL);
+    wheel.clk = timer_ticks();
+
+    rtc_timer_init(TIMER_RTC_RATE);
+    rtc_timer_enable(0);
+    irq_setmask_8259A(irq_mask_8259A & ~(1 << IRQ_CLOCK));
+}
+
+void
+timer_setup(struct Timer *timer, void (*func)(struct Timer *timer), void *arg) {
+    assert(!timer->pprev);
+    timer->next = NULL;
+    timer->func = func;
+    timer->arg = arg;
+}
+
+/* (Re)arms the timer to expire in 'ns' nanoseconds, or up to 'slack_ns'
+ * later if that lets it share a tick with other timers */
+void
+timer_arm(struct Timer *timer, uint64_t ns, uint64_t slack_ns) {
+    uint64_t rflags = read_rflags();
+    asm volatile("cli" ::: "memory");
+
+    if (timer->pprev) {
+        wheel_remove(timer);
+        timer_stats.pending--;
+    }
+
+    /* Nothing is pending, the wheel may have stood still */
+    uint64_t now = timer_ticks();
+    if (!timer_stats.pending) wheel.clk = MAX(wheel.clk, now);
+
+    /* The current tick has already begun */
+    uint64_t delay = ns_to_ticks(ns) + 1;
+    uint64_t slack = slack_ns == TIMER_SLACK_DEFAULT ? delay >> TIMER_SLACK_SHIFT :
+                                                       slack_ns / NSEC_PER_SEC * TIMER_HZ + slack_ns % NSEC_PER_SEC * TIMER_HZ / NSEC_PER_SEC;
+
+    timer->expires = timer_apply_slack(now + delay, slack);
+    if (timer->expires != now + delay) timer_stats.coalesced++;
+
+    wheel_insert(timer);
+    timer_stats.pending++;
+    timer_stats.armed++;
+
+    if (!wheel.ticking) {
+        rtc_timer_enable(1);
+        wheel.ticking = 1;
+    }
+
+    write_rflags(rflags);
+}
+
+/* Returns false if the timer was not pending */
+bool
+timer_cancel(struct Timer *timer) {
+    uint64_t rflags = read_rflags();
+    asm volatile("cli" ::: "memory");
+
+    bool pending = !!timer->pprev;
+    if (pending) {
+        wheel_remove(timer);
+        timer_stats.pending--;
+        timer_stats.cancelled++;
+    }
+
+    write_rflags(rflags);
+    return pending;
+}
+
+bool
+timer_pending(const struct Timer *timer) {
+    return !!timer->pprev;
+}
+
+/* RTC periodic interrupt, the tick itself is processed later */
+void
+timer_intr(void) {
+    rtc_check_status();
+    timer_stats.interrupts++;
+    work_queue(&timer_work);
+}
+
+const struct TimerStats *
+timer_get_stats(void) {
+    return &timer_stats;
+}
@@ -0,0 +1,67 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Timers.
+ *
+ * Pending timers are kept in a hashed hierarchical timing wheel: level
+ * k has TIMER_WHEEL_SLOTS lists, each covering TIMER_WHEEL_SLOTS^k ticks.
+ * A timer goes to the lowest level whose span covers its expiry and is
+ * moved down a level each time the wheel turns into its slot, so arming
+ * and cancelling are O(1) and each tick touches one slot per level.
+ *
+ * Time is counted in ticks of the RTC periodic interrupt derived from
+ * the TSC, so late or lost interrupts only delay expiry. The interrupt
+ * is stopped while no timers are pending. Expired timers are collected
+ * as deferred work, their callbacks run at the next safe point.
+ *
+ * Expiry may be delayed by up to a slack to share the tick with other
+ * timers: the deadline is rounded to the tick with the most trailing
+ * zero bits within the slack, so timers armed around the same time
+ * tend to expire together and wake the CPU once */
+
+#define TIMER_HZ          1024 /* RTC periodic rate, a power of two */
+#define TIMER_RTC_RATE    6    /* 32768 >> (6 - 1) = 1024 Hz */
+#define TIMER_WHEEL_BITS  6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 /* 2^24 ticks, about 4.5 hours */
+
+/* Slack of timer_arm() callers that don't care, 1/256 of the delay */
+#define TIMER_SLACK_DEFAULT ((uint64_t)-1)
+#define TIMER_SLACK_SHIFT   8
+
+struct Timer {
+    struct Timer *next;
+    struct Timer **pprev; /* NULL when not pending */
+    uint64_t expires;     /* Tick */
+    void (*func)(struct Timer *timer);
+    void *arg;
+};
+
+struct TimerStats {
+    uint64_t armed;
+    uint64_t cancelled;
+    uint64_t fired;
+    uint64_t cascaded;   /* Moves to a lower level */
+    uint64_t interrupts;
+    uint64_t batches;    /* Ticks that expired anything */
+    uint64_t coalesced;  /* Deadlines moved by slack */
+    uint64_t pending;
+};
+
+void timer_init(void);
+void timer_setup(struct Timer *timer, void (*func)(struct Timer *timer), void *arg);
+void timer_arm(struct Timer *timer, uint64_t ns, uint64_t slack_ns);
+bool timer_cancel(struct Timer *timer);
+bool timer_pending(const struct Timer *timer);
+uint64_t timer_ticks(void);
+void timer_intr(void);
+const struct TimerStats *timer_get_stats(void);
+
+#endif /* !JOS_KERN_TIMER_H */
@@ -0,0 +1,235 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/mmu.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/string.h>
+
+#include <kern/trap.h>
+#include <kern/console.h>
+#include <kern/monitor.h>
+#include <kern/env.h>
+#include <kern/picirq.h>
+#include <kern/pgfault.h>
+#include <kern/traceopt.h>
+#include <kern/klog.h>
+#include <kern/timer.h>
+
+extern struct Taskstate cpu_ts;
+extern uint8_t bootstacktop[];
+extern uint8_t pfstacktop[];
+
+/* Interrupt descriptor table.  (Must be built at run time because
+ * shifted function addresses can't be represented in relocation records.) */
+struct Gatedesc idt[256] = {{0}};
+struct Pseudodesc idt_pd = {sizeof(idt) - 1, (uint64_t)idt};
+
+static const char *
+trapname(int trapno) {
+    static const char *const excnames[] = {
+            "Divide error",
+            "Debug",
+            "Non-Maskable Interrupt",
+            "Breakpoint",
+            "Overflow",
+            "BOUND Range Exceeded",
+            "Invalid Opcode",
+            "Device Not Available",
+            "Double Fault",
+            "Coprocessor Segment Overrun",
+            "Invalid TSS",
+            "Segment Not Present",
+            "Stack Fault",
+            "General Protection",
+            "Page Fault",
+            "(unknown trap)",
+            "x87 FPU Floating-Point Error",
+            "Alignment Check",
+            "Machine-Check",
+            "SIMD Floating-Point Exception"};
+
+    if (trapno < sizeof(excnames) / sizeof(excnames[0])) return excnames[trapno];
+    if (trapno == T_SYSCALL) return "System call";
+    if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + MAX_IRQS) return "Hardware Interrupt";
+
+    return "(unknown trap)";
+}
+
+void
+trap_init(void) {
+    extern void divide_thdlr(void);
+    extern void debug_thdlr(void);
+    extern void nmi_thdlr(void);
+    extern void brkpt_thdlr(void);
+    extern void oflow_thdlr(void);
+    extern void bound_thdlr(void);
+    extern void illop_thdlr(void);
+    extern void device_thdlr(void);
+    extern void dblflt_thdlr(void);
+    extern void tss_thdlr(void);
+    extern void segnp_thdlr(void);
+    extern void stack_thdlr(void);
+    extern void gpflt_thdlr(void);
+    extern void pgflt_thdlr(void);
+    extern void fperr_thdlr(void);
+    extern void align_thdlr(void);
+    extern void mchk_thdlr(void);
+    extern void simderr_thdlr(void);
+
+    extern void kbd_thdlr(void);
+    extern void serial_thdlr(void);
+    extern void spurious_thdlr(void);
+    extern void clock_thdlr(void);
+
+    idt[T_DIVIDE] = GATE(0, GD_KT, (uintptr_t)divide_thdlr, 0);
+    idt[T_DEBUG] = GATE(0, GD_KT, (uintptr_t)debug_thdlr, 0);
+    idt[T_NMI] = GATE(0, GD_KT, (uintptr_t)nmi_thdlr, 0);
+    idt[T_BRKPT] = GATE(0, GD_KT, (uintptr_t)brkpt_thdlr, 3);
+    idt[T_OFLOW] = GATE(0, GD_KT, (uintptr_t)oflow_thdlr, 0);
+    idt[T_BOUND] = GATE(0, GD_KT, (uintptr_t)bound_thdlr, 0);
+    idt[T_ILLOP] = GATE(0, GD_KT, (uintptr_t)illop_thdlr, 0);
+    idt[T_DEVICE] = GATE(0, GD_KT, (uintptr_t)device_thdlr, 0);
+    idt[T_DBLFLT] = GATE(0, GD_KT, (uintptr_t)dblflt_thdlr, 0);
+    idt[T_TSS] = GATE(0, GD_KT, (uintptr_t)tss_thdlr, 0);
+    idt[T_SEGNP] = GATE(0, GD_KT, (uintptr_t)segnp_thdlr, 0);
+    idt[T_STACK] = GATE(0, GD_KT, (uintptr_t)stack_thdlr, 0);
+    idt[T_GPFLT] = GATE(0, GD_KT, (uintptr_t)gpflt_thdlr, 0);
+    idt[T_PGFLT] = GATE(0, GD_KT, (uintptr_t)pgflt_thdlr, 0);
+    /* Page faults always switch to the #PF stack */
+    idt[T_PGFLT].gd_ist = 1;
+    idt[T_FPERR] = GATE(0, GD_KT, (uintptr_t)fperr_thdlr, 0);
+    idt[T_ALIGN] = GATE(0, GD_KT, (uintptr_t)align_thdlr, 0);
+    idt[T_MCHK] = GATE(0, GD_KT, (uintptr_t)mchk_thdlr, 0);
+    idt[T_SIMDERR] = GATE(0, GD_KT, (uintptr_t)simderr_thdlr, 0);
+
+    idt[IRQ_OFFSET + IRQ_KBD] = GATE(0, GD_KT, (uintptr_t)kbd_thdlr, 0);
+    idt[IRQ_OFFSET + IRQ_SERIAL] = GATE(0, GD_KT, (uintptr_t)serial_thdlr, 0);
+    idt[IRQ_OFFSET + IRQ_SPURIOUS] = GATE(0, GD_KT, (uintptr_t)spurious_thdlr, 0);
+    idt[IRQ_OFFSET + IRQ_CLOCK] = GATE(0, GD_KT, (uintptr_t)clock_thdlr, 0);
+
+    /* Per-CPU setup */
+    trap_init_percpu();
+}
+
+/* Initialize and load the per-CPU TSS and IDT */
+void
+trap_init_percpu(void) {
+    /* Setup a TSS so that we get the right stack
+     * when we trap to the kernel. */
+    cpu_ts.ts_rsp0 = (uintptr_t)bootstacktop;
+    cpu_ts.ts_ist1 = (uintptr_t)pfstacktop;
+    cpu_ts.ts_iomb = sizeof(struct Taskstate);
+
+    /* Initialize the TSS slot of the gdt. */
+    *(struct Segdesc64 *)(&gdt[(GD_TSS0 >> 3)]) = SEG64_TSS(STS_T64A, ((uint64_t)&cpu_ts), sizeof(struct Taskstate), 0);
+
+    /* Load the TSS selector (like other segment selectors, the
+     * bottom three bits are special; we leave them 0) */
+    ltr(GD_TSS0);
+
+    /* Load the IDT */
+    lidt(&idt_pd);
+}
+
+void
+print_trapframe(struct Trapframe *tf) {
+    cprintf_fast("TRAP frame at %p\n", tf);
+    print_regs(&tf->tf_regs);
+    cprintf_fast("  es   0x----%04x\n", tf->tf_es);
+    cprintf_fast("  ds   0x----%04x\n", tf->tf_ds);
+    cprintf_fast("  trap 0x%08lx %s\n", (unsigned long)tf->tf_trapno, trapname(tf->tf_trapno));
+
+    /* If this trap was a page fault that just happened
+     * (so %cr2 is meaningful), print the faulting linear address */
+    if (tf->tf_trapno == T_PGFLT) cprintf_fast("  cr2  0x%08lx\n", (unsigned long)rcr2());
+
+    cprintf_fast("  err  0x%08lx", (unsigned long)tf->tf_err);
+
+    /* For page faults, print decoded fault error code:
+     *     U/K=fault occurred in user/kernel mode
+     *     W/R=a write/read caused the fault
+     *     PR=a protection violation caused the fault (NP=page not present) */
+    if (tf->tf_trapno == T_PGFLT) {
+        cprintf_fast(" [%s, %s, %s]\n",
+                tf->tf_err & FEC_U ? "user" : "kernel",
+                tf->tf_err & FEC_W ? "write" : "read",
+                tf->tf_err & FEC_P ? "protection" : "not-present");
+    } else
+        cprintf_fast("\n");
+
+    cprintf_fast("  rip  0x%08lx\n", (unsigned long)tf->tf_rip);
+    cprintf_fast("  cs   0x----%04x\n", tf->tf_cs);
+    cprintf_fast("  flag 0x%08lx\n", (unsigned long)tf->tf_rflags);
+    cprintf_fast("  rsp  0x%08lx\n", (unsigned long)tf->tf_rsp);
+    cprintf_fast("  ss   0x----%04x\n", tf->tf_ss);
+}
+
+void
+print_regs(struct PushRegs *regs) {
+    cprintf_fast("  r15  0x%08lx\n", (unsigned long)regs->reg_r15);
+    cprintf_fast("  r14  0x%08lx\n", (unsigned long)regs->reg_r14);
+    cprintf_fast("  r13  0x%08lx\n", (unsigned long)regs->reg_r13);
+    cprintf_fast("  r12  0x%08lx\n", (unsigned long)regs->reg_r12);
+    cprintf_fast("  r11  0x%08lx\n", (unsigned long)regs->reg_r11);
+    cprintf_fast("  r10  0x%08lx\n", (unsigned long)regs->reg_r10);
+    cprintf_fast("  r9   0x%08lx\n", (unsigned long)regs->reg_r9);
+    cprintf_fast("  r8   0x%08lx\n", (unsigned long)regs->reg_r8);
+    cprintf_fast("  rdi  0x%08lx\n", (unsigned long)regs->reg_rdi);
+    cprintf_fast("  rsi  0x%08lx\n", (unsigned long)regs->reg_rsi);
+    cprintf_fast("  rbp  0x%08lx\n", (unsigned long)regs->reg_rbp);
+    cprintf_fast("  rbx  0x%08lx\n", (unsigned long)regs->reg_rbx);
+    cprintf_fast("  rdx  0x%08lx\n", (unsigned long)regs->reg_rdx);
+    cprintf_fast("  rcx  0x%08lx\n", (unsigned long)regs->reg_rcx);
+    cprintf_fast("  rax  0x%08lx\n", (unsigned long)regs->reg_rax);
+}
+
+static void
+trap_dispatch(struct Trapframe *tf) {
+    switch (tf->tf_trapno) {
+    case IRQ_OFFSET + IRQ_SPURIOUS:
+        /* Handle spurious interrupts
+         * The hardware sometimes raises these because of noise on the
+         * IRQ line or other reasons, we don't care */
+        if (trace_traps) {
+            cprintf("Spurious interrupt on irq 7\n");
+            print_trapframe(tf);
+        }
+        return;
+    case IRQ_OFFSET + IRQ_KBD:
+        kbd_intr();
+        pic_send_eoi(IRQ_KBD);
+        return;
+    case IRQ_OFFSET + IRQ_SERIAL:
+        serial_intr();
+        pic_send_eoi(IRQ_SERIAL);
+        return;
+    case IRQ_OFFSET + IRQ_CLOCK:
+        timer_intr();
+        pic_send_eoi(IRQ_CLOCK);
+        return;
+    case T_PGFLT:
+        if (pgfault_handle(tf)) return;
+        /* fallthrough */
+    default:
+        /* Every environment runs in kernel mode, so an unexpected
+         * trap is always a kernel bug */
+        print_trapframe(tf);
+        panic("Unhandled trap in kernel");
+    }
+}
+
+/* Called from trapentry.S for every exception and hardware interrupt.
+ * Returns to the interrupted context through iretq */
+void
+trap(struct Trapframe *tf) {
+    /* The environment may have set DF and some versions
+     * of GCC rely on DF being clear */
+    asm volatile("cld" ::: "cc");
+
+    if (trace_traps) cprintf_fast("Incoming TRAP %s (%ld) frame %p\n", trapname(tf->tf_trapno), (long)tf->tf_trapno, tf);
+    /* Clock ticks would crowd everything else out of the log */
+    if (tf->tf_trapno != IRQ_OFFSET + IRQ_CLOCK)
+        klog("trap %s (%ld) rip %p\n", trapname(tf->tf_trapno), (long)tf->tf_trapno, (void *)tf->tf_rip);
+
+    trap_dispatch(tf);
+}
@@ -0,0 +1,39 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/assert.h>
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
+
+#include <kern/kclock.h>
+#include <kern/traceopt.h>
+#include <kern/vsyscall.h>
+
+/* TSC is converted to nanoseconds with a 32.32 fixed point multiplier */
+#define VSYS_TSC_SHIFT 32
+
+static uint64_t vsys_page[PAGE_SIZE / sizeof(uint64_t)] __attribute__((aligned(PAGE_SIZE)));
+
+volatile uint64_t *vsys = vsys_page;
+
+void map_page_early_boot(uintptr_t va, uintptr_t pa, uint64_t perm);
+
+/* Fill in the virtual syscall page and map it read-only at UVSYS.
+ * The kernel keeps updating it through its own mapping */
+void
+vsys_init(void) {
+    static_assert(NVSYSCALLS * sizeof(uint64_t) <= UVSYS_SIZE, "Virtual syscall page overflow");
+
+    uint64_t hz = tsc_calibrate();
+    assert(hz);
+
+    vsys[VSYS_boot_time] = rtc_gettime();
+    vsys[VSYS_tsc_base] = read_tsc();
+    vsys[VSYS_tsc_hz] = hz;
+    vsys[VSYS_tsc_mult] = (1000000000ULL << VSYS_TSC_SHIFT) / hz;
+    vsys[VSYS_tsc_shift] = VSYS_TSC_SHIFT;
+
+    map_page_early_boot(UVSYS, (uintptr_t)vsys_page - KERN_BASE_ADDR, PTE_P | PTE_U);
+
+    if (trace_init) cprintf("TSC frequency %lu Hz\n", (unsigned long)hz);
+}
@@ -0,0 +1,17 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VSYSCALL_H
+#define JOS_KERN_VSYSCALL_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/vsyscall.h>
+
+/* Kernel's writable view of the virtual syscall page */
+extern volatile uint64_t *vsys;
+
+void vsys_init(void);
+
+#endif /* !JOS_KERN_VSYSCALL_H */
@@ -0,0 +1,91 @@
+/* Per-CPU deferred work queues, see kern/workq.h */
+
+#include <inc/types.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/workq.h>
+
+struct WorkQueue {
+    struct Work *head;
+    struct Work **tail;
+    struct WorkStats stats;
+} __attribute__((aligned(CPU_CACHE_LINE)));
+
+static struct WorkQueue work_queues[NCPU];
+
+void
+work_init(struct Work *work, void (*func)(struct Work *work), void *arg) {
+    assert(!work->pending);
+    work->next = NULL;
+    work->func = func;
+    work->arg = arg;
+}
+
+/* Queues work on this CPU, can be called from interrupt handlers.
+ * Returns false if the item is already queued */
+bool
+work_queue(struct Work *work) {
+    struct WorkQueue *queue = &work_queues[cpunum()];
+
+    uint64_t rflags = read_rflags();
+    asm volatile("cli" ::: "memory");
+
+    bool queued = !work->pending;
+    if (queued) {
+        work->pending = 1;
+        work->next = NULL;
+        work->queued = read_tsc();
+        if (!queue->head) queue->tail = &queue->head;
+        *queue->tail = work;
+        queue->tail = &work->next;
+        queue->stats.queued++;
+    }
+
+    write_rflags(rflags);
+    return queued;
+}
+
+bool
+work_pending(void) {
+    return !!work_queues[cpunum()].head;
+}
+
+/* Runs up to 'budget' items queued on this CPU in queueing order,
+ * items queued meanwhile are run in the same pass if budget allows.
+ * Returns the number of items run */
+size_t
+work_run(size_t budget) {
+    struct WorkQueue *queue = &work_queues[cpunum()];
+    size_t runs = 0;
+
+    while (runs < budget) {
+        uint64_t rflags = read_rflags();
+        asm volatile("cli" ::: "memory");
+        struct Work *work = queue->head;
+        if (work) {
+            queue->head = work->next;
+            work->pending = 0;
+        }
+        write_rflags(rflags);
+
+        if (!work) break;
+
+        uint64_t latency = read_tsc() - work->queued;
+        queue->stats.lat_sum += latency;
+        queue->stats.lat_max = MAX(queue->stats.lat_max, latency);
+        queue->stats.runs++;
+        runs++;
+
+        work->func(work);
+    }
+
+    if (runs) queue->stats.passes++;
+    if (runs == budget && queue->head) queue->stats.overruns++;
+    return runs;
+}
+
+const struct WorkStats *
+work_get_stats(int cpu) {
+    return &work_queues[cpu].stats;
+}
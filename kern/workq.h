@@ -0,0 +1,50 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_WORKQ_H
+#define JOS_KERN_WORKQ_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/cpu.h>
+
+/* Deferred work.
+ *
+ * Work that doesn't have to be done where it is triggered, possibly
+ * from an interrupt handler, is queued on the current CPU and run at
+ * the next safe point: when the scheduler is entered and from the idle
+ * environment. Safe points run at most a budget of items per pass, so
+ * the latency they add stays bounded; whatever is left waits for the
+ * next pass.
+ *
+ * Interrupts can arrive while kernel-space programs are inside kernel
+ * functions and locks, so interrupt return is not a safe point */
+
+/* Items run per pass by the scheduler */
+#define WORK_BUDGET 4
+
+struct Work {
+    struct Work *next;
+    void (*func)(struct Work *work);
+    void *arg;
+    uint64_t queued; /* TSC when the item was queued */
+    bool pending;
+};
+
+struct WorkStats {
+    uint64_t queued;
+    uint64_t runs;
+    uint64_t passes;   /* Passes that ran anything */
+    uint64_t overruns; /* Passes that left items for later */
+    uint64_t lat_sum;  /* TSC ticks from queueing to running */
+    uint64_t lat_max;
+};
+
+void work_init(struct Work *work, void (*func)(struct Work *work), void *arg);
+bool work_queue(struct Work *work);
+bool work_pending(void);
+size_t work_run(size_t budget);
+const struct WorkStats *work_get_stats(int cpu);
+
+#endif /* !JOS_KERN_WORKQ_H */
@@ -0,0 +1,28 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+/* Take a consistent snapshot of the EnvStat record of envs[envx]
+ * without entering the kernel. Retries while the record is
+ * being updated or if it changed during the copy */
+void
+envstat_read(size_t envx, struct EnvStat *stat) {
+    const volatile struct EnvStat *es = &envstats[envx];
+    uint32_t seq;
+
+    do {
+        while ((seq = es->es_seq) & 1)
+            asm volatile("pause");
+        asm volatile("" ::: "memory");
+
+        stat->es_seq = seq;
+        stat->es_id = es->es_id;
+        stat->es_status = es->es_status;
+        stat->es_runs = es->es_runs;
+        stat->es_cputime = es->es_cputime;
+        stat->es_started = es->es_started;
+
+        asm volatile("" ::: "memory");
+    } while (es->es_seq != seq);
+}
@@ -11,11 +11,16 @@ const char *binaryname = "<unknown>";
 
 #ifdef JOS_PROG
 void (*volatile sys_exit)(void);
+void *(*volatile sys_fmap)(const char *path, size_t *size);
+int (*volatile sys_funmap)(void *va);
 #endif
 
 void
 libmain(int argc, char **argv) {
 
+    /* Set thisenv to point at our Env structure in envs[] */
+    thisenv = &envs[ENVX(vsys_getenvid())];
+
     /* Save the name of the program so that panic() can use it */
     if (argc > 0) binaryname = argv[0];
 
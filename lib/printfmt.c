@@ -89,6 +89,173 @@ get_int(va_list *ap, int lflag, bool zflag) {
 /* Main function to format and print a string. */
 void printfmt(void (*putch)(int, void *), void *put_arg, const char *fmt, ...);
 
+/* Parses a %-escape sequence at ufmt, just past the '%', into spec.
+ * An indirect '*' field is taken from ap, without ap such formats
+ * can't be parsed ahead of time and NULL is returned. Otherwise
+ * returns the position following the conversion character */
+static const unsigned char *
+fmt_parse(const unsigned char *ufmt, struct FmtSpec *spec, va_list *ap) {
+    char padc = ' ';
+    int width = -1, precision = -1;
+    unsigned lflag = 0;
+    bool altflag = 0, zflag = 0;
+    unsigned char ch;
+
+reswitch:
+    switch (ch = *ufmt++) {
+    case '0': /* '-' flag to pad on the right */
+    case '-': /* '0' flag to pad with 0's instead of spaces */
+        padc = ch;
+        goto reswitch;
+
+    case '*': /* Indirect width field */
+        if (!ap) return NULL;
+        precision = va_arg(*ap, int);
+        goto process_precision;
+
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9': /* width field */
+        for (precision = 0;; ++ufmt) {
+            precision = precision * 10 + ch - '0';
+            if ((ch = *ufmt) - '0' > 9) break;
+        }
+
+    process_precision:
+        if (width < 0) {
+            width = precision;
+            precision = -1;
+        }
+        goto reswitch;
+
+    case '.':
+        width = MAX(0, width);
+        goto reswitch;
+
+    case '#':
+        altflag = 1;
+        goto reswitch;
+
+    case 'l': /* long flag (doubled for long long) */
+        lflag++;
+        goto reswitch;
+
+    case 'z':
+        zflag = 1;
+        goto reswitch;
+    }
+
+    spec->conv = ch;
+    spec->padc = padc;
+    spec->width = width;
+    spec->precision = precision;
+    spec->lflag = MIN(lflag, 2);
+    spec->altflag = altflag;
+    spec->zflag = zflag;
+    return ufmt;
+}
+
+/* Formats one conversion described by spec,
+ * returns false if the conversion is not known */
+static bool
+fmt_convert(void (*putch)(int, void *), void *put_arg, const struct FmtSpec *spec, va_list *ap) {
+    int width = spec->width, precision = spec->precision;
+    unsigned lflag = spec->lflag, base = 10;
+    char padc = spec->padc;
+    uintmax_t num = 0;
+    unsigned char ch;
+
+    switch (ch = spec->conv) {
+    case 'c': /* character */
+        putch(va_arg(*ap, int), put_arg);
+        break;
+
+    case 'i': /* error message */ {
+        int err = va_arg(*ap, int);
+        const char *strerr;
+
+        if (err < 0) err = -err;
+
+        if (err >= MAXERROR || !(strerr = error_string[err])) {
+            printfmt(putch, put_arg, "error %d", err);
+        } else {
+            printfmt(putch, put_arg, "%s", strerr);
+        }
+        break;
+    }
+
+    case 's': /* string */ {
+        const char *ptr = va_arg(*ap, char *);
+        if (!ptr) ptr = "(null)";
+
+        if (width > 0 && padc != '-') {
+            width -= strnlen(ptr, precision);
+
+            while (width-- > 0) putch(padc, put_arg);
+        }
+
+        for (; (ch = *ptr++) && (precision < 0 || --precision >= 0); width--) {
+            putch(spec->altflag && (ch < ' ' || ch > '~') ? '?' : ch, put_arg);
+        }
+
+        while (width-- > 0) putch(' ', put_arg);
+        break;
+    }
+
+    case 'd': /* (signed) decimal */ {
+        intmax_t i = get_int(ap, lflag, spec->zflag);
+        if (i < 0) {
+            putch('-', put_arg);
+            i = -i;
+        }
+        num = i;
+        /* base = 10; */
+        goto number;
+    }
+
+    case 'u': /* unsigned decimal */
+        num = get_unsigned(ap, lflag, spec->zflag);
+        /* base = 10; */
+        goto number;
+
+    case 'o': /* (unsigned) octal */
+        // LAB 1: Your code here:
+        num = get_unsigned(ap, lflag, spec->zflag);
+        base = 8;
+        goto number;
+
+    case 'p': /* pointer */
+        putch('0', put_arg);
+        putch('x', put_arg);
+        num = (uintptr_t)va_arg(*ap, void *);
+        base = 16;
+        goto number;
+
+    case 'X': /* (unsigned) hexadecimal, uppercase */
+    case 'x': /* (unsigned) hexadecimal, lowercase */
+        num = get_unsigned(ap, lflag, spec->zflag);
+        base = 16;
+    number:
+        print_num(putch, put_arg, num, base, width, padc, ch == 'X');
+        break;
+
+    case '%': /* escaped '%' character */
+        putch(ch, put_arg);
+        break;
+
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
 void
 vprintfmt(void (*putch)(int, void *), void *put_arg, const char *fmt, va_list ap) {
     const unsigned char *ufmt = (unsigned char *)fmt;
@@ -104,142 +271,71 @@ vprintfmt(void (*putch)(int, void *), void *put_arg, const char *fmt, va_list ap
         }
 
         /* Process a %-escape sequence */
-        char padc = ' ';
-        int width = -1, precision = -1;
-        unsigned lflag = 0, base = 10;
-        bool altflag = 0, zflag = 0;
-        uintmax_t num = 0;
-    reswitch:
-
-        switch (ch = *ufmt++) {
-        case '0': /* '-' flag to pad on the right */
-        case '-': /* '0' flag to pad with 0's instead of spaces */
-            padc = ch;
-            goto reswitch;
-
-        case '*': /* Indirect width field */
-            precision = va_arg(aq, int);
-            goto process_precision;
-
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9': /* width field */
-            for (precision = 0;; ++ufmt) {
-                precision = precision * 10 + ch - '0';
-                if ((ch = *ufmt) - '0' > 9) break;
-            }
-
-        process_precision:
-            if (width < 0) {
-                width = precision;
-                precision = -1;
-            }
-            goto reswitch;
-
-        case '.':
-            width = MAX(0, width);
-            goto reswitch;
-
-        case '#':
-            altflag = 1;
-            goto reswitch;
-
-        case 'l': /* long flag (doubled for long long) */
-            lflag++;
-            goto reswitch;
-
-        case 'z':
-            zflag = 1;
-            goto reswitch;
-
-        case 'c': /* character */
-            putch(va_arg(aq, int), put_arg);
-            break;
-
-        case 'i': /* error message */ {
-            int err = va_arg(aq, int);
-            const char *strerr;
-
-            if (err < 0) err = -err;
-
-            if (err >= MAXERROR || !(strerr = error_string[err])) {
-                printfmt(putch, put_arg, "error %d", err);
-            } else {
-                printfmt(putch, put_arg, "%s", strerr);
-            }
-            break;
+        struct FmtSpec spec;
+        const unsigned char *next = fmt_parse(ufmt, &spec, &aq);
+
+        if (fmt_convert(putch, put_arg, &spec, &aq)) {
+            ufmt = next;
+        } else {
+            /* Unrecognized escape sequence - just print it literally */
+            putch('%', put_arg);
         }
+    }
+}
 
-        case 's': /* string */ {
-            const char *ptr = va_arg(aq, char *);
-            if (!ptr) ptr = "(null)";
+/* Parses fmt into desc once, so that formatting it later skips
+ * the flag, width and length state machine. Formats with an
+ * indirect '*' field, unknown conversions or too many conversions
+ * are marked to be handled by vprintfmt() instead */
+void
+fmt_compile(struct FmtDesc *desc, const char *fmt) {
+    const unsigned char *ufmt = (unsigned char *)fmt;
+    size_t nspecs = 0;
 
-            if (width > 0 && padc != '-') {
-                width -= strnlen(ptr, precision);
+    desc->fmt = fmt;
+    desc->state = FMT_DESC_FALLBACK;
 
-                while (width-- > 0) putch(padc, put_arg);
-            }
+    for (;;) {
+        const unsigned char *text = ufmt;
+        while (*ufmt && *ufmt != '%') ufmt++;
 
-            for (; (ch = *ptr++) && (precision < 0 || --precision >= 0); width--) {
-                putch(altflag && (ch < ' ' || ch > '~') ? '?' : ch, put_arg);
-            }
+        if (nspecs == FMT_DESC_MAX_SPECS || ufmt - (unsigned char *)fmt > 0xFFFF) return;
 
-            while (width-- > 0) putch(' ', put_arg);
-            break;
-        }
+        struct FmtSpec *spec = &desc->specs[nspecs++];
+        spec->text = text - (unsigned char *)fmt;
+        spec->textlen = ufmt - text;
+        spec->conv = 0;
 
-        case 'd': /* (signed) decimal */ {
-            intmax_t i = get_int(&aq, lflag, zflag);
-            if (i < 0) {
-                putch('-', put_arg);
-                i = -i;
-            }
-            num = i;
-            /* base = 10; */
-            goto number;
-        }
+        if (!*ufmt) break;
 
-        case 'u': /* unsigned decimal */
-            num = get_unsigned(&aq, lflag, zflag);
-            /* base = 10; */
-            goto number;
-
-        case 'o': /* (unsigned) octal */
-            // LAB 1: Your code here:
-            num = get_unsigned(&aq, lflag, zflag);
-            base = 8;
-            goto number;
-
-        case 'p': /* pointer */
-            putch('0', put_arg);
-            putch('x', put_arg);
-            num = (uintptr_t)va_arg(aq, void *);
-            base = 16;
-            goto number;
-
-        case 'X': /* (unsigned) hexadecimal, uppercase */
-        case 'x': /* (unsigned) hexadecimal, lowercase */
-            num = get_unsigned(&aq, lflag, zflag);
-            base = 16;
-        number:
-            print_num(putch, put_arg, num, base, width, padc, ch == 'X');
-            break;
-
-        case '%': /* escaped '%' character */
-            putch(ch, put_arg);
-            break;
+        const unsigned char *next = fmt_parse(ufmt + 1, spec, NULL);
+        if (!next || !spec->conv || !strchr("cisduopxX%", spec->conv) ||
+            spec->width > 0x7FFF || spec->precision > 0x7FFF) return;
+        ufmt = next;
+    }
 
-        default: /* unrecognized escape sequence - just print it literally */
-            putch('%', put_arg);
-            while ((--ufmt)[-1] != '%') /* nothing */
-                ;
-        }
+    desc->nspecs = nspecs;
+    desc->state = FMT_DESC_READY;
+}
+
+void
+vprintfmt_desc(void (*putch)(int, void *), void *put_arg, struct FmtDesc *desc, const char *fmt, va_list ap) {
+    if (desc->state == FMT_DESC_EMPTY || desc->fmt != fmt) fmt_compile(desc, fmt);
+    if (desc->state != FMT_DESC_READY) {
+        vprintfmt(putch, put_arg, fmt, ap);
+        return;
+    }
+
+    va_list aq;
+    va_copy(aq, ap);
+
+    for (size_t i = 0; i < desc->nspecs; i++) {
+        const struct FmtSpec *spec = &desc->specs[i];
+
+        const char *text = fmt + spec->text;
+        for (size_t j = 0; j < spec->textlen; j++) putch(text[j], put_arg);
+
+        if (spec->conv) fmt_convert(putch, put_arg, spec, &aq);
     }
 }
 
@@ -2,46 +2,131 @@
 #include <inc/error.h>
 #include <inc/types.h>
 #include <inc/string.h>
+#include <inc/kbdreg.h>
 
-#define BUFLEN 1024
+#define BUFLEN  1024
+#define HISTLEN 16
+#define ECHOLEN 256
 
 static char buf[BUFLEN];
 
+/* Ring of the last HISTLEN lines, hist_count is the number
+ * of lines ever added, the newest one is at (hist_count - 1) % HISTLEN */
+static char hist[HISTLEN][BUFLEN];
+static size_t hist_count;
+
+/* Echo is collected here and written out in one go
+ * once all pending input has been consumed */
+static char echo_buf[ECHOLEN];
+static size_t echo_len;
+static bool echo;
+
+static void
+echo_flush(void) {
+    if (echo_len) cputs(echo_buf, echo_len);
+    echo_len = 0;
+}
+
+static void
+echo_char(char c) {
+    if (!echo) return;
+    if (echo_len == ECHOLEN) echo_flush();
+    echo_buf[echo_len++] = c;
+}
+
+static void
+hist_add(const char *line) {
+    if (!*line) return;
+    if (hist_count && !strcmp(hist[(hist_count - 1) % HISTLEN], line)) return;
+
+    strcpy(hist[hist_count++ % HISTLEN], line);
+}
+
+/* Replace the first 'len' characters being edited with 'line' */
+static size_t
+line_replace(size_t len, const char *line) {
+    for (; len; len--) {
+        echo_char('\b');
+        echo_char(' ');
+        echo_char('\b');
+    }
+
+    for (; *line; line++) {
+        echo_char(*line);
+        buf[len++] = *line;
+    }
+
+    return len;
+}
+
 char *
 readline(const char *prompt) {
     if (prompt) {
         cprintf("%s", prompt);
     }
 
-    bool echo = iscons(0);
+    echo = iscons(0);
+
+    /* Position in history of the line being edited, hist_count for a new one */
+    size_t hist_pos = hist_count;
+    /* ANSI escape sequence state, arrow keys come from
+     * serial terminals as ESC [ A and ESC [ B */
+    int esc = 0;
 
     for (size_t i = 0;;) {
+        /* Block for the first character, then take
+         * everything that has arrived since without waiting */
         int c = getchar();
 
-        if (c < 0) {
-            return NULL;
-        } else if ((c == '\b' || c == '\x7F')) {
-            if (i) {
-                if (echo) {
-                    cputchar('\b');
-                    cputchar(' ');
-                    cputchar('\b');
-                }
-                i--;
+        for (; c; c = getchar_nowait()) {
+            if (c < 0) {
+                echo_flush();
+                return NULL;
             }
-        } else if (c >= ' ') {
-            if (i < BUFLEN - 1) {
-                if (echo) {
-                    cputchar(c);
-                }
-                buf[i++] = (char)c;
+
+            if (esc == 1) {
+                esc = c == '[' ? 2 : 0;
+                continue;
+            } else if (esc == 2) {
+                esc = 0;
+                if (c == 'A') c = KEY_UP;
+                else if (c == 'B') c = KEY_DN;
+                else continue;
             }
-        } else if (c == '\n' || c == '\r') {
-            if (echo) {
-                cputchar('\n');
+
+            if (c == '\x1B') {
+                esc = 1;
+            } else if (c == KEY_UP) {
+                if (hist_pos && hist_pos + HISTLEN > hist_count) {
+                    hist_pos--;
+                    i = line_replace(i, hist[hist_pos % HISTLEN]);
+                }
+            } else if (c == KEY_DN) {
+                if (hist_pos < hist_count) {
+                    hist_pos++;
+                    i = line_replace(i, hist_pos < hist_count ? hist[hist_pos % HISTLEN] : "");
+                }
+            } else if ((c == '\b' || c == '\x7F')) {
+                if (i) {
+                    echo_char('\b');
+                    echo_char(' ');
+                    echo_char('\b');
+                    i--;
+                }
+            } else if (c >= ' ' && c < 0x80) {
+                if (i < BUFLEN - 1) {
+                    echo_char((char)c);
+                    buf[i++] = (char)c;
+                }
+            } else if (c == '\n' || c == '\r') {
+                echo_char('\n');
+                echo_flush();
+                buf[i] = 0;
+                hist_add(buf);
+                return buf;
             }
-            buf[i] = 0;
-            return buf;
         }
+
+        echo_flush();
     }
 }
@@ -0,0 +1,25 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/lib.h>
+#include <inc/vsyscall.h>
+#include <inc/x86.h>
+
+/* These read the virtual syscall page and never enter the kernel */
+
+envid_t
+vsys_getenvid(void) {
+    return (envid_t)vsys[VSYS_envid];
+}
+
+/* Nanoseconds since boot */
+uint64_t
+vsys_clock_ns(void) {
+    uint64_t delta = read_tsc() - vsys[VSYS_tsc_base];
+    return (uint64_t)(((unsigned __int128)delta * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift]);
+}
+
+/* Wall clock time in seconds since the epoch */
+int
+vsys_gettime(void) {
+    return (int)(vsys[VSYS_boot_time] + vsys_clock_ns() / 1000000000ULL);
+}
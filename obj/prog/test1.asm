@@ -0,0 +1,195 @@
+
+obj/prog/test1:     file format elf64-x86-64
+
+
+Disassembly of section .text:
+
+0000000000000000 <_start>:
+
+    # If not, push dummy argc/argv arguments.
+    # This happens when we are loaded by the kernel,
+    # because the kernel does not know about passing arguments.
+    # Marking argc and argv as zero.
+    pushq $0
+   0:	6a 00                	push   $0x0
+    pushq $0
+   2:	6a 00                	push   $0x0
+
+0000000000000004 <args_exist>:
+
+args_exist:
+    movq 8(%rsp), %rsi
+   4:	48 8b 74 24 08       	mov    0x8(%rsp),%rsi
+    movq (%rsp), %rdi
+   9:	48 8b 3c 24          	mov    (%rsp),%rdi
+    xorl %ebp, %ebp
+   d:	31 ed                	xor    %ebp,%ebp
+    call libmain
+   f:	e8 2e 00 00 00       	call   42 <libmain>
+    jmp .
+  14:	eb fe                	jmp    14 <args_exist+0x10>
+
+0000000000000016 <umain>:
+void (*volatile sys_yield)(void);
+
+void
+umain(int argc, char **argv) {
+  16:	55                   	push   %rbp
+  17:	48 89 e5             	mov    %rsp,%rbp
+  1a:	53                   	push   %rbx
+  1b:	48 83 ec 08          	sub    $0x8,%rsp
+  1f:	bb 03 00 00 00       	mov    $0x3,%ebx
+  24:	b8 10 27 00 00       	mov    $0x2710,%eax
+    int i, j;
+
+    for (j = 0; j < 3; ++j) {
+        for (i = 0; i < 10000; ++i)
+  29:	83 e8 01             	sub    $0x1,%eax
+  2c:	75 fb                	jne    29 <umain+0x13>
+            ;
+        sys_yield();
+  2e:	48 8b 05 d3 0f 00 00 	mov    0xfd3(%rip),%rax        # 1008 <sys_yield>
+  35:	ff d0                	call   *%rax
+    for (j = 0; j < 3; ++j) {
+  37:	83 eb 01             	sub    $0x1,%ebx
+  3a:	75 e8                	jne    24 <umain+0xe>
+    }
+}
+  3c:	48 8b 5d f8          	mov    -0x8(%rbp),%rbx
+  40:	c9                   	leave
+  41:	c3                   	ret
+
+0000000000000042 <libmain>:
+void *(*volatile sys_fmap)(const char *path, size_t *size);
+int (*volatile sys_funmap)(void *va);
+#endif
+
+void
+libmain(int argc, char **argv) {
+  42:	55                   	push   %rbp
+  43:	48 89 e5             	mov    %rsp,%rbp
+  46:	41 54                	push   %r12
+  48:	53                   	push   %rbx
+  49:	89 fb                	mov    %edi,%ebx
+  4b:	49 89 f4             	mov    %rsi,%r12
+
+    /* Set thisenv to point at our Env structure in envs[] */
+    thisenv = &envs[ENVX(vsys_getenvid())];
+  4e:	e8 4b 00 00 00       	call   9e <vsys_getenvid>
+  53:	25 ff 03 00 00       	and    $0x3ff,%eax
+  58:	48 89 c2             	mov    %rax,%rdx
+  5b:	48 c1 e2 05          	shl    $0x5,%rdx
+  5f:	48 29 c2             	sub    %rax,%rdx
+  62:	48 b8 00 00 c0 1f 80 	movabs $0x801fc00000,%rax
+  69:	00 00 00 
+  6c:	48 8d 04 d0          	lea    (%rax,%rdx,8),%rax
+  70:	48 89 05 b1 0f 00 00 	mov    %rax,0xfb1(%rip)        # 1028 <thisenv>
+
+    /* Save the name of the program so that panic() can use it */
+    if (argc > 0) binaryname = argv[0];
+  77:	85 db                	test   %ebx,%ebx
+  79:	7e 0b                	jle    86 <libmain+0x44>
+  7b:	49 8b 04 24          	mov    (%r12),%rax
+  7f:	48 89 05 7a 0f 00 00 	mov    %rax,0xf7a(%rip)        # 1000 <binaryname>
+
+    /* Call user main routine */
+    umain(argc, argv);
+  86:	4c 89 e6             	mov    %r12,%rsi
+  89:	89 df                	mov    %ebx,%edi
+  8b:	e8 86 ff ff ff       	call   16 <umain>
+
+#ifdef JOS_PROG
+    sys_exit();
+  90:	48 8b 05 89 0f 00 00 	mov    0xf89(%rip),%rax        # 1020 <sys_exit>
+  97:	ff d0                	call   *%rax
+#endif
+}
+  99:	5b                   	pop    %rbx
+  9a:	41 5c                	pop    %r12
+  9c:	5d                   	pop    %rbp
+  9d:	c3                   	ret
+
+000000000000009e <vsys_getenvid>:
+
+/* These read the virtual syscall page and never enter the kernel */
+
+envid_t
+vsys_getenvid(void) {
+    return (envid_t)vsys[VSYS_envid];
+  9e:	48 a1 00 f0 bf 1f 80 	movabs 0x801fbff000,%rax
+  a5:	00 00 00 
+}
+  a8:	c3                   	ret
+
+00000000000000a9 <vsys_clock_ns>:
+}
+
+static inline uint64_t __attribute__((always_inline))
+read_tsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc"
+  a9:	0f 31                	rdtsc
+  ab:	89 c6                	mov    %eax,%esi
+
+/* Nanoseconds since boot */
+uint64_t
+vsys_clock_ns(void) {
+    uint64_t delta = read_tsc() - vsys[VSYS_tsc_base];
+  ad:	48 b8 08 f0 bf 1f 80 	movabs $0x801fbff008,%rax
+  b4:	00 00 00 
+  b7:	4c 8b 00             	mov    (%rax),%r8
+    return (uint64_t)(((unsigned __int128)delta * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift]);
+  ba:	48 8d 40 08          	lea    0x8(%rax),%rax
+  be:	48 8b 38             	mov    (%rax),%rdi
+  c1:	48 8d 40 08          	lea    0x8(%rax),%rax
+  c5:	48 8b 08             	mov    (%rax),%rcx
+                 : "=a"(lo), "=d"(hi));
+    return (uint64_t)lo | ((uint64_t)hi << 32);
+  c8:	48 89 d0             	mov    %rdx,%rax
+  cb:	48 c1 e0 20          	shl    $0x20,%rax
+  cf:	89 f6                	mov    %esi,%esi
+  d1:	48 09 f0             	or     %rsi,%rax
+    uint64_t delta = read_tsc() - vsys[VSYS_tsc_base];
+  d4:	4c 29 c0             	sub    %r8,%rax
+    return (uint64_t)(((unsigned __int128)delta * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift]);
+  d7:	48 f7 e7             	mul    %rdi
+  da:	48 0f ad d0          	shrd   %cl,%rdx,%rax
+  de:	48 d3 ea             	shr    %cl,%rdx
+  e1:	f6 c1 40             	test   $0x40,%cl
+  e4:	74 05                	je     eb <vsys_clock_ns+0x42>
+  e6:	48 89 d0             	mov    %rdx,%rax
+  e9:	31 d2                	xor    %edx,%edx
+}
+  eb:	c3                   	ret
+
+00000000000000ec <vsys_gettime>:
+
+/* Wall clock time in seconds since the epoch */
+int
+vsys_gettime(void) {
+  ec:	55                   	push   %rbp
+  ed:	48 89 e5             	mov    %rsp,%rbp
+  f0:	53                   	push   %rbx
+  f1:	48 83 ec 08          	sub    $0x8,%rsp
+    return (int)(vsys[VSYS_boot_time] + vsys_clock_ns() / 1000000000ULL);
+  f5:	48 b8 28 f0 bf 1f 80 	movabs $0x801fbff028,%rax
+  fc:	00 00 00 
+  ff:	48 8b 18             	mov    (%rax),%rbx
+ 102:	e8 a2 ff ff ff       	call   a9 <vsys_clock_ns>
+ 107:	48 c1 e8 09          	shr    $0x9,%rax
+ 10b:	48 ba 53 5a 9b a0 2f 	movabs $0x44b82fa09b5a53,%rdx
+ 112:	b8 44 00 
+ 115:	48 f7 e2             	mul    %rdx
+ 118:	48 c1 ea 0b          	shr    $0xb,%rdx
+ 11c:	8d 04 1a             	lea    (%rdx,%rbx,1),%eax
+}
+ 11f:	48 8b 5d f8          	mov    -0x8(%rbp),%rbx
+ 123:	c9                   	leave
+ 124:	c3                   	ret
+ 125:	0f 1f 00             	nopl   (%rax)
+ 128:	3c 75                	cmp    $0x75,%al
+ 12a:	6e                   	outsb  %ds:(%rsi),(%dx)
+ 12b:	6b 6e 6f 77          	imul   $0x77,0x6f(%rsi),%ebp
+ 12f:	6e                   	outsb  %ds:(%rsi),(%dx)
+ 130:	3e                   	ds
+	...
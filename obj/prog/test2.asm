@@ -0,0 +1,220 @@
+
+obj/prog/test2:     file format elf64-x86-64
+
+
+Disassembly of section .text:
+
+0000000000000000 <_start>:
+
+    # If not, push dummy argc/argv arguments.
+    # This happens when we are loaded by the kernel,
+    # because the kernel does not know about passing arguments.
+    # Marking argc and argv as zero.
+    pushq $0
+   0:	6a 00                	push   $0x0
+    pushq $0
+   2:	6a 00                	push   $0x0
+
+0000000000000004 <args_exist>:
+
+args_exist:
+    movq 8(%rsp), %rsi
+   4:	48 8b 74 24 08       	mov    0x8(%rsp),%rsi
+    movq (%rsp), %rdi
+   9:	48 8b 3c 24          	mov    (%rsp),%rdi
+    xorl %ebp, %ebp
+   d:	31 ed                	xor    %ebp,%ebp
+    call libmain
+   f:	e8 43 00 00 00       	call   57 <libmain>
+    jmp .
+  14:	eb fe                	jmp    14 <args_exist+0x10>
+
+0000000000000016 <umain>:
+void (*volatile GRADE3_FUNC)(unsigned);
+void (*volatile xc(GRADE3_FAIL, GRADE3_PFX1))(void);
+#endif
+
+void
+umain(int argc, char **argv) {
+  16:	55                   	push   %rbp
+  17:	48 89 e5             	mov    %rsp,%rbp
+  1a:	53                   	push   %rbx
+  1b:	48 83 ec 08          	sub    $0x8,%rsp
+    int test2_i;
+    int test2_j;
+
+#if !defined(GRADE3_TEST)
+    cprintf("TEST2 LOADED.\n");
+  1f:	48 8b 15 ea 0f 00 00 	mov    0xfea(%rip),%rdx        # 1010 <cprintf>
+  26:	48 8d 3d 13 01 00 00 	lea    0x113(%rip),%rdi        # 140 <vsys_gettime+0x3f>
+  2d:	b8 00 00 00 00       	mov    $0x0,%eax
+  32:	ff d2                	call   *%rdx
+  34:	bb 05 00 00 00       	mov    $0x5,%ebx
+umain(int argc, char **argv) {
+  39:	b8 10 27 00 00       	mov    $0x2710,%eax
+        xc(GRADE3_FAIL, GRADE3_PFX1)();
+    }
+#endif
+
+    for (test2_j = 0; test2_j < 5; ++test2_j) {
+        for (test2_i = 0; test2_i < 10000; ++test2_i)
+  3e:	83 e8 01             	sub    $0x1,%eax
+  41:	75 fb                	jne    3e <umain+0x28>
+            ;
+        sys_yield();
+  43:	48 8b 05 be 0f 00 00 	mov    0xfbe(%rip),%rax        # 1008 <sys_yield>
+  4a:	ff d0                	call   *%rax
+    for (test2_j = 0; test2_j < 5; ++test2_j) {
+  4c:	83 eb 01             	sub    $0x1,%ebx
+  4f:	75 e8                	jne    39 <umain+0x23>
+    }
+}
+  51:	48 8b 5d f8          	mov    -0x8(%rbp),%rbx
+  55:	c9                   	leave
+  56:	c3                   	ret
+
+0000000000000057 <libmain>:
+void *(*volatile sys_fmap)(const char *path, size_t *size);
+int (*volatile sys_funmap)(void *va);
+#endif
+
+void
+libmain(int argc, char **argv) {
+  57:	55                   	push   %rbp
+  58:	48 89 e5             	mov    %rsp,%rbp
+  5b:	41 54                	push   %r12
+  5d:	53                   	push   %rbx
+  5e:	89 fb                	mov    %edi,%ebx
+  60:	49 89 f4             	mov    %rsi,%r12
+
+    /* Set thisenv to point at our Env structure in envs[] */
+    thisenv = &envs[ENVX(vsys_getenvid())];
+  63:	e8 4b 00 00 00       	call   b3 <vsys_getenvid>
+  68:	25 ff 03 00 00       	and    $0x3ff,%eax
+  6d:	48 89 c2             	mov    %rax,%rdx
+  70:	48 c1 e2 05          	shl    $0x5,%rdx
+  74:	48 29 c2             	sub    %rax,%rdx
+  77:	48 b8 00 00 c0 1f 80 	movabs $0x801fc00000,%rax
+  7e:	00 00 00 
+  81:	48 8d 04 d0          	lea    (%rax,%rdx,8),%rax
+  85:	48 89 05 a4 0f 00 00 	mov    %rax,0xfa4(%rip)        # 1030 <thisenv>
+
+    /* Save the name of the program so that panic() can use it */
+    if (argc > 0) binaryname = argv[0];
+  8c:	85 db                	test   %ebx,%ebx
+  8e:	7e 0b                	jle    9b <libmain+0x44>
+  90:	49 8b 04 24          	mov    (%r12),%rax
+  94:	48 89 05 65 0f 00 00 	mov    %rax,0xf65(%rip)        # 1000 <binaryname>
+
+    /* Call user main routine */
+    umain(argc, argv);
+  9b:	4c 89 e6             	mov    %r12,%rsi
+  9e:	89 df                	mov    %ebx,%edi
+  a0:	e8 71 ff ff ff       	call   16 <umain>
+
+#ifdef JOS_PROG
+    sys_exit();
+  a5:	48 8b 05 7c 0f 00 00 	mov    0xf7c(%rip),%rax        # 1028 <sys_exit>
+  ac:	ff d0                	call   *%rax
+#endif
+}
+  ae:	5b                   	pop    %rbx
+  af:	41 5c                	pop    %r12
+  b1:	5d                   	pop    %rbp
+  b2:	c3                   	ret
+
+00000000000000b3 <vsys_getenvid>:
+
+/* These read the virtual syscall page and never enter the kernel */
+
+envid_t
+vsys_getenvid(void) {
+    return (envid_t)vsys[VSYS_envid];
+  b3:	48 a1 00 f0 bf 1f 80 	movabs 0x801fbff000,%rax
+  ba:	00 00 00 
+}
+  bd:	c3                   	ret
+
+00000000000000be <vsys_clock_ns>:
+}
+
+static inline uint64_t __attribute__((always_inline))
+read_tsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc"
+  be:	0f 31                	rdtsc
+  c0:	89 c6                	mov    %eax,%esi
+
+/* Nanoseconds since boot */
+uint64_t
+vsys_clock_ns(void) {
+    uint64_t delta = read_tsc() - vsys[VSYS_tsc_base];
+  c2:	48 b8 08 f0 bf 1f 80 	movabs $0x801fbff008,%rax
+  c9:	00 00 00 
+  cc:	4c 8b 00             	mov    (%rax),%r8
+    return (uint64_t)(((unsigned __int128)delta * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift]);
+  cf:	48 8d 40 08          	lea    0x8(%rax),%rax
+  d3:	48 8b 38             	mov    (%rax),%rdi
+  d6:	48 8d 40 08          	lea    0x8(%rax),%rax
+  da:	48 8b 08             	mov    (%rax),%rcx
+                 : "=a"(lo), "=d"(hi));
+    return (uint64_t)lo | ((uint64_t)hi << 32);
+  dd:	48 89 d0             	mov    %rdx,%rax
+  e0:	48 c1 e0 20          	shl    $0x20,%rax
+  e4:	89 f6                	mov    %esi,%esi
+  e6:	48 09 f0             	or     %rsi,%rax
+    uint64_t delta = read_tsc() - vsys[VSYS_tsc_base];
+  e9:	4c 29 c0             	sub    %r8,%rax
+    return (uint64_t)(((unsigned __int128)delta * vsys[VSYS_tsc_mult]) >> vsys[VSYS_tsc_shift]);
+  ec:	48 f7 e7             	mul    %rdi
+  ef:	48 0f ad d0          	shrd   %cl,%rdx,%rax
+  f3:	48 d3 ea             	shr    %cl,%rdx
+  f6:	f6 c1 40             	test   $0x40,%cl
+  f9:	74 05                	je     100 <vsys_clock_ns+0x42>
+  fb:	48 89 d0             	mov    %rdx,%rax
+  fe:	31 d2                	xor    %edx,%edx
+}
+ 100:	c3                   	ret
+
+0000000000000101 <vsys_gettime>:
+
+/* Wall clock time in seconds since the epoch */
+int
+vsys_gettime(void) {
+ 101:	55                   	push   %rbp
+ 102:	48 89 e5             	mov    %rsp,%rbp
+ 105:	53                   	push   %rbx
+ 106:	48 83 ec 08          	sub    $0x8,%rsp
+    return (int)(vsys[VSYS_boot_time] + vsys_clock_ns() / 1000000000ULL);
+ 10a:	48 b8 28 f0 bf 1f 80 	movabs $0x801fbff028,%rax
+ 111:	00 00 00 
+ 114:	48 8b 18             	mov    (%rax),%rbx
+ 117:	e8 a2 ff ff ff       	call   be <vsys_clock_ns>
+ 11c:	48 c1 e8 09          	shr    $0x9,%rax
+ 120:	48 ba 53 5a 9b a0 2f 	movabs $0x44b82fa09b5a53,%rdx
+ 127:	b8 44 00 
+ 12a:	48 f7 e2             	mul    %rdx
+ 12d:	48 c1 ea 0b          	shr    $0xb,%rdx
+ 131:	8d 04 1a             	lea    (%rdx,%rbx,1),%eax
+}
+ 134:	48 8b 5d f8          	mov    -0x8(%rbp),%rbx
+ 138:	c9                   	leave
+ 139:	c3                   	ret
+ 13a:	66 0f 1f 44 00 00    	nopw   0x0(%rax,%rax,1)
+ 140:	54                   	push   %rsp
+ 141:	45 53                	rex.RB push %r11
+ 143:	54                   	push   %rsp
+ 144:	32 20                	xor    (%rax),%ah
+ 146:	4c                   	rex.WR
+ 147:	4f                   	rex.WRXB
+ 148:	41                   	rex.B
+ 149:	44                   	rex.R
+ 14a:	45                   	rex.RB
+ 14b:	44                   	rex.R
+ 14c:	2e 0a 00             	cs or  (%rax),%al
+ 14f:	3c 75                	cmp    $0x75,%al
+ 151:	6e                   	outsb  %ds:(%rsi),(%dx)
+ 152:	6b 6e 6f 77          	imul   $0x77,0x6f(%rsi),%ebp
+ 156:	6e                   	outsb  %ds:(%rsi),(%dx)
+ 157:	3e                   	ds
+	...